@@ -0,0 +1,61 @@
+#include "HypoxRayTracer.hpp"
+#include "test_scene.hpp"
+#include <cstring>
+
+// Renders of the test box must not depend on the thread count, for every sampler and integrator
+using test_scene::check;
+
+namespace {
+    Film render(const std::string& config_path, int threads) {
+        Config config(config_path);
+        config.threads = threads;
+        auto image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y());
+        auto camera = std::make_shared<Camera>(config.camera_config, image);
+        auto scene = std::make_shared<Scene>(config);
+        HypoxRayTracer tracer(camera, scene, config);
+        Film film(config.image_resolution, false);
+        tracer.renderPasses(film, 0, 1);
+        return film;
+    }
+
+    // Whether every pixel mean has the same bits in both films
+    bool identical(const Film& a, const Film& b) {
+        Vec2i resolution = a.getResolution();
+        for (int y = 0; y < resolution.y(); y++) {
+            for (int x = 0; x < resolution.x(); x++) {
+                Vec3f ca = a.getColor(x, y), cb = b.getColor(x, y);
+                if (a.getSampleCount(x, y) != b.getSampleCount(x, y) || std::memcmp(ca.data(), cb.data(), sizeof(float) * 3) != 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    float mean(const Film& film) {
+        Vec2i resolution = film.getResolution();
+        float sum = 0;
+        for (int y = 0; y < resolution.y(); y++) {
+            for (int x = 0; x < resolution.x(); x++) sum += film.getColor(x, y).mean();
+        }
+        return sum / static_cast<float>(resolution.x() * resolution.y());
+    }
+}
+
+int main() {
+    auto dir = test_scene::makeDirectory("determinism");
+    auto scene = test_scene::cornellBox(dir);
+    for (const char* integrator: {"path", "wavefront"}) {
+        for (const char* sampler: {"random", "sobol", "halton"}) {
+            scene["integrator"] = integrator;
+            scene["sampler"] = sampler;
+            std::string config_path = test_scene::writeConfig(dir, std::string(integrator) + "_" + sampler, scene);
+            Film one = render(config_path, 1);
+            Film four = render(config_path, 4);
+            printf("%s integrator, %s sampler: mean %g\n", integrator, sampler, mean(one));
+            check(mean(one) > 0, "the box is lit");
+            check(identical(one, four), "1 and 4 threads render identical films");
+        }
+    }
+    return test_scene::finish("Determinism");
+}
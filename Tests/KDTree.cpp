@@ -1,27 +1,112 @@
-#include <iostream>
-#include <vector>
-#include <memory>
+#include "kdtree.hpp"
+#include <cstdio>
+#include <random>
 
-// For Test
+// KDTree queries against brute force over the same points
 struct Point {
-    float x;
-    float y;
+    Vec3f position;
+    int id;
 };
 
-// KD Tree
-struct KDTreeNode {
-    int key;
-    std::shared_ptr<KDTreeNode> left;
-    std::shared_ptr<KDTreeNode> right;
+static int failures = 0;
 
-    int size; // Number of points in the subtree rooted at this node
-    int count; // Number of points in the subtree rooted at this node with key equal to this node's key
-};
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Squared distances of the k points closest to `point` within `radius`, ascending
+static std::vector<float> bruteNearest(const std::vector<Point>& points, const Vec3f& point, int k, float radius) {
+    std::vector<float> distances;
+    for (const auto& p: points) {
+        float distance2 = (p.position - point).squaredNorm();
+        if (distance2 < radius * radius) distances.push_back(distance2);
+    }
+    std::sort(distances.begin(), distances.end());
+    if (static_cast<int>(distances.size()) > k) distances.resize(k);
+    return distances;
+}
+
+// Ids of the points within `radius` of `point`, ascending
+static std::vector<int> bruteRadius(const std::vector<Point>& points, const Vec3f& point, float radius) {
+    std::vector<int> ids;
+    for (const auto& p: points) {
+        if ((p.position - point).squaredNorm() < radius * radius) ids.push_back(p.id);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+static void compare(const std::vector<Point>& points, const Vec3f& point, int k, float radius) {
+    KDTree<Point> tree(points);
+    std::vector<KDTree<Point>::Neighbor> found;
+    float max_distance2 = tree.findNearest(point, k, radius, found);
+
+    std::vector<float> expected = bruteNearest(points, point, k, radius);
+    std::vector<float> distances;
+    for (const auto& neighbor: found) {
+        distances.push_back(neighbor.distance2);
+        check((tree[neighbor.index].position - point).squaredNorm() == neighbor.distance2, "neighbor distance");
+    }
+    std::sort(distances.begin(), distances.end());
+    // Ties can pick other points, but never other distances
+    check(distances == expected, "findNearest matches brute force");
+    float expected_max = static_cast<int>(expected.size()) == k ? expected.back() : radius * radius;
+    check(max_distance2 == expected_max, "findNearest search radius");
+
+    std::vector<int> ids;
+    tree.forEachInRadius(point, radius, [&](const Point& p) { ids.push_back(p.id); });
+    std::sort(ids.begin(), ids.end());
+    check(ids == bruteRadius(points, point, radius), "forEachInRadius matches brute force");
+}
 
 int main() {
-    // Test: Sample Points
-    // A: (2, 3), B: (4, 7), C: (5, 4), D: (7, 2), E: (9, 6), F: (8, 1)
-    std::vector<Point> points = {
-        {2, 3}, {4, 7}, {5, 4}, {7, 2}, {9, 6}, {8, 1}
-    };
-}
\ No newline at end of file
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    auto random_point = [&]() { return Vec3f(uniform(rng), uniform(rng), uniform(rng)); };
+
+    // Random points, k below and above the point count
+    std::vector<Point> points;
+    for (int i = 0; i < 2000; i++) {
+        points.push_back({random_point(), i});
+    }
+    for (int query = 0; query < 200; query++) {
+        Vec3f point = random_point();
+        compare(points, point, 16, 0.3f);
+        compare(points, point, 1, 2.0f);
+        compare(points, point, 5000, 0.5f);
+    }
+
+    // Fewer points than k
+    std::vector<Point> few(points.begin(), points.begin() + 5);
+    compare(few, Vec3f(0, 0, 0), 8, 4.0f);
+
+    // Ties: duplicated points and a grid of equal distances around the query
+    std::vector<Point> ties;
+    for (int x = -3; x <= 3; x++) {
+        for (int y = -3; y <= 3; y++) {
+            for (int z = -3; z <= 3; z++) {
+                ties.push_back({Vec3f(x, y, z) * 0.25f, static_cast<int>(ties.size())});
+                ties.push_back({Vec3f(x, y, z) * 0.25f, static_cast<int>(ties.size())});
+            }
+        }
+    }
+    compare(ties, Vec3f(0, 0, 0), 7, 1.0f);
+    compare(ties, Vec3f(0.125f, 0, 0), 4, 1.0f);
+    compare(ties, Vec3f(0.125f, 0.125f, 0.125f), 20, 0.5f);
+
+    // Empty tree
+    KDTree<Point> empty;
+    std::vector<KDTree<Point>::Neighbor> found {{0, 0}};
+    check(empty.findNearest(Vec3f(0, 0, 0), 4, 0.5f, found) == 0.25f, "empty tree search radius");
+    check(found.empty(), "empty tree has no neighbors");
+    int visited = 0;
+    empty.forEachInRadius(Vec3f(0, 0, 0), 1.0f, [&](const Point&) { visited++; });
+    check(visited == 0, "empty tree visits nothing");
+    compare({}, Vec3f(0, 0, 0), 4, 1.0f);
+
+    if (failures == 0) printf("KDTree: all tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
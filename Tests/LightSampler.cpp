@@ -0,0 +1,81 @@
+#include "light_sampler.hpp"
+#include "test_scene.hpp"
+#include <random>
+
+// LightSampler over 200 area lights: sampled frequencies against getPMF, for every strategy
+using test_scene::check;
+
+namespace {
+    // Lights on a 20 x 10 grid under a ceiling, most facing down, some tilted, each with its own radiance
+    std::vector<std::shared_ptr<Light>> makeLights(std::mt19937& rng) {
+        std::uniform_real_distribution<float> uniform(0, 1);
+        std::vector<std::shared_ptr<Light>> lights;
+        for (int i = 0; i < 20; i++) {
+            for (int j = 0; j < 10; j++) {
+                Vec3f position(-1 + 2.0f * i / 19, 1.5f + 0.4f * uniform(rng), -1 + 2.0f * j / 9);
+                Vec3f normal = (Vec3f(0, -1, 0) + (lights.size() % 4 == 0 ? 1.5f : 0.2f) * Vec3f(uniform(rng) - 0.5f, 0, uniform(rng) - 0.5f)).normalized();
+                Vec3f tangent = normal.cross(Vec3f(0, 0, 1)).normalized();
+                Vec3f radiance = Vec3f(uniform(rng), uniform(rng), uniform(rng)) * (1 + 20 * uniform(rng));
+                lights.push_back(std::make_shared<SquareAreaLight>(position, radiance, Vec2f(0.05f, 0.05f), normal, tangent));
+            }
+        }
+        return lights;
+    }
+
+    // Whether the light's center emits towards the point and lies above its surface
+    bool faces(const Light& light, const Vec3f& normal_light, const Vec3f& position, const Vec3f& normal) {
+        Vec3f to_light = light.getPosition() - position;
+        return normal_light.dot(-to_light) > 0 && normal.dot(to_light) > 0;
+    }
+
+    void testSampler(LightSamplerType type, const char* name, const std::vector<std::shared_ptr<Light>>& lights,
+        const std::vector<Vec3f>& light_normals, std::mt19937& rng) {
+        LightSampler sampler;
+        sampler.build(lights, type);
+        std::uniform_real_distribution<float> uniform(-1, 1);
+        constexpr int SAMPLES = 200000;
+        bool pmf_matches = true, frequencies_match = true, sums_to_one = true, facing_reachable = true;
+        for (int point = 0; point < 20; point++) {
+            Vec3f position(uniform(rng), 0.5f * (uniform(rng) + 1), uniform(rng));
+            Vec3f normal = Vec3f(0.5f * uniform(rng), 1, 0.5f * uniform(rng)).normalized();
+
+            // Stratified u, so the frequencies only differ from the pmfs by the strata cut at branch boundaries
+            std::vector<int> counts(lights.size(), 0);
+            for (int i = 0; i < SAMPLES; i++) {
+                SampledLight sampled = sampler.sample(position, normal, (i + 0.5f) / SAMPLES);
+                if (sampled.light < 0) continue;
+                counts[sampled.light]++;
+                float pmf = sampler.getPMF(position, normal, sampled.light);
+                pmf_matches &= std::abs(sampled.pmf - pmf) <= 1e-5f * pmf;
+            }
+
+            float sum = 0;
+            for (size_t light = 0; light < lights.size(); light++) {
+                float pmf = sampler.getPMF(position, normal, static_cast<int>(light));
+                sum += pmf;
+                float frequency = static_cast<float>(counts[light]) / SAMPLES;
+                frequencies_match &= std::abs(frequency - pmf) <= 1e-4f + 1e-3f * pmf;
+                if (faces(*lights[light], light_normals[light], position, normal)) facing_reachable &= pmf > 0;
+            }
+            sums_to_one &= std::abs(sum - 1) < 1e-4f;
+        }
+        printf("%s sampler\n", name);
+        check(pmf_matches, "sample reports the pmf getPMF returns");
+        check(frequencies_match, "sampled frequencies match getPMF");
+        check(sums_to_one, "getPMF sums to one over the lights");
+        check(facing_reachable, "no light facing the point has a zero pmf");
+    }
+}
+
+int main() {
+    std::mt19937 rng(13);
+    auto lights = makeLights(rng);
+    std::vector<Vec3f> light_normals;
+    for (const auto& light: lights) {
+        light_normals.push_back(light->getBounds().axis);
+    }
+    testSampler(LightSamplerType::Uniform, "uniform", lights, light_normals, rng);
+    testSampler(LightSamplerType::Power, "power", lights, light_normals, rng);
+    testSampler(LightSamplerType::BVH, "bvh", lights, light_normals, rng);
+    return test_scene::finish("LightSampler");
+}
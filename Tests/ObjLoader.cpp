@@ -0,0 +1,108 @@
+#include "obj_loader.hpp"
+#include "test_scene.hpp"
+
+// obj_loader::load on small files covering the record forms, and on one large enough to be chunked
+using test_scene::check;
+
+namespace {
+    std::filesystem::path dir;
+
+    bool load(const std::string& name, const std::string& contents, obj_loader::ObjData& data, int threads = 1) {
+        auto path = dir / name;
+        test_scene::writeFile(path, contents);
+        std::string error;
+        bool loaded = obj_loader::load(path.string(), data, threads, error);
+        if (!loaded) printf("%s\n", error.c_str());
+        return loaded;
+    }
+
+    void testPolygons() {
+        // A triangle, a quad and a pentagon, fanned around their first corners
+        obj_loader::ObjData data;
+        check(load("polygons.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv -1 0.5 0\n"
+            "f 1 2 3\nf 1 2 3 4\nf 1 2 3 4 5\n", data), "polygons load");
+        check(data.vertices.size() == 5 && data.normals.empty(), "polygon records counted");
+        std::vector<int> expected = {0, 1, 2, 0, 1, 2, 0, 2, 3, 0, 1, 2, 0, 2, 3, 0, 3, 4};
+        check(data.v_indices == expected, "polygons are triangle fans");
+        check(data.n_indices == std::vector<int>(expected.size(), -1), "faces without normals have -1 normals");
+        check(data.vertices[4] == Vec3f(-1, 0.5f, 0), "vertex values");
+    }
+
+    void testIndexForms() {
+        // v//vn, v/vt/vn and v/vt corners, and indices relative to the records so far
+        obj_loader::ObjData data;
+        check(load("forms.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nvn 0 0 -1\nvt 0 0\n"
+            "f 1//1 2//1 3//1\nf 1/1/2 2/1/2 3/1/2\nf 3/1 2/1 1/1\nf -3//-2 -2//-2 -1//-1\n"
+            "v 0 0 1\nf -4 -3 -1\n", data), "index forms load");
+        check(data.vertices.size() == 4 && data.normals.size() == 2, "index form records counted");
+        check(data.v_indices == std::vector<int>({0, 1, 2, 0, 1, 2, 2, 1, 0, 0, 1, 2, 0, 1, 3}), "vertex indices");
+        check(data.n_indices == std::vector<int>({0, 0, 0, 1, 1, 1, -1, -1, -1, 0, 0, 1, -1, -1, -1}), "normal indices");
+
+        check(!load("bad_index.obj", "v 0 0 0\nf 1 2 3\n", data), "out of range indices are rejected");
+    }
+
+    void testLineForms() {
+        // CRLF line ends, comment lines, trailing comments and blank lines
+        obj_loader::ObjData data;
+        check(load("lines.obj", "# header\r\nv 0 0 0\r\nv 1 0 0 # x\r\n\r\n  v 0 1 0\r\nvn 0 0 1\r\n"
+            "f 1//1 2//1 3//1 # tri\r\nf 1 2 3#tight\r\n# f 1 2 3\r\nf 3 2 1", data), "line forms load");
+        check(data.vertices.size() == 3 && data.normals.size() == 1, "comments are not records");
+        check(data.v_indices == std::vector<int>({0, 1, 2, 0, 1, 2, 2, 1, 0}), "faces around comments and CRLF");
+        check(data.vertices[1] == Vec3f(1, 0, 0), "CRLF vertex values");
+    }
+
+    void testChunks() {
+        // More than a chunk, with records straddling every chunk boundary
+        std::string contents = "# chunked\n";
+        std::vector<Vec3f> vertices;
+        while (contents.size() < 3 * obj_loader::CHUNK_SIZE) {
+            Vec3f v(static_cast<float>(vertices.size()), 0.5f, -0.25f);
+            vertices.push_back(v);
+            char line[64];
+            snprintf(line, sizeof(line), "v %g %g %g\n", v.x(), v.y(), v.z());
+            contents += line;
+            if (vertices.size() >= 4 && vertices.size() % 4 == 0) contents += "f -4 -3 -2 -1\n";
+        }
+        for (size_t boundary = obj_loader::CHUNK_SIZE; boundary < contents.size(); boundary += obj_loader::CHUNK_SIZE) {
+            check(contents[boundary - 1] != '\n', "test file has a record across the chunk boundary");
+        }
+        size_t quads = vertices.size() / 4;
+
+        for (int threads: {1, 4}) {
+            obj_loader::ObjData data;
+            check(load("chunks.obj", contents, data, threads), "chunked file loads");
+            check(data.vertices == vertices, "chunked vertices");
+            bool faces = data.v_indices.size() == 6 * quads;
+            for (size_t q = 0; faces && q < quads; q++) {
+                int first = static_cast<int>(4 * q);
+                std::vector<int> expected = {first, first + 1, first + 2, first, first + 2, first + 3};
+                faces = std::equal(expected.begin(), expected.end(), data.v_indices.begin() + 6 * q);
+            }
+            check(faces, "chunked faces resolve relative indices in every chunk");
+        }
+    }
+
+    void testErrors() {
+        obj_loader::ObjData data;
+        std::string error;
+        test_scene::writeFile(dir / "empty.obj", "");
+        check(!obj_loader::load((dir / "empty.obj").string(), data, 1, error), "empty file fails");
+        check(error.find("empty file") != std::string::npos, "empty file is reported as empty");
+        check(!obj_loader::load((dir / "missing.obj").string(), data, 1, error), "missing file fails");
+        check(error.find("cannot open") != std::string::npos, "missing file is reported as unopenable");
+
+        test_scene::writeFile(dir / "malformed.obj", "v 0 0 0\nv 1 0 0\nv 0 1 x\n");
+        check(!obj_loader::load((dir / "malformed.obj").string(), data, 1, error), "malformed vertex fails");
+        check(error.find(":3: malformed record") != std::string::npos, "malformed record reports its line");
+    }
+}
+
+int main() {
+    dir = test_scene::makeDirectory("obj_loader");
+    testPolygons();
+    testIndexForms();
+    testLineForms();
+    testChunks();
+    testErrors();
+    return test_scene::finish("ObjLoader");
+}
@@ -0,0 +1,91 @@
+#include "render_farm.hpp"
+#include "HypoxRayTracer.hpp"
+#include "test_scene.hpp"
+
+// Farm renders of the test box, worked in process, against the same render done locally
+using test_scene::check;
+namespace fs = std::filesystem;
+
+namespace {
+    // Passes [0, passes) of the config rendered by one tracer, as render_farm::work renders items
+    Film renderLocal(const std::string& config_path, int passes) {
+        Config config(config_path);
+        config.render_mode = RenderMode::Final;
+        auto image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y());
+        auto camera = std::make_shared<Camera>(config.camera_config, image);
+        auto scene = std::make_shared<Scene>(config);
+        HypoxRayTracer tracer(camera, scene, config);
+        Film film(config.image_resolution, false);
+        for (int pass = 0; pass < passes; pass++) {
+            tracer.renderPasses(film, pass, 1);
+        }
+        return film;
+    }
+
+    Film renderFarm(const fs::path& job_dir, const render_farm::Job& job, const Vec2i& resolution) {
+        Film film(resolution, false);
+        check(render_farm::submit(job_dir.string(), job), "job is submitted");
+        render_farm::work(job_dir.string(), 2);
+        check(render_farm::merge(job_dir.string(), film, 30), "films are merged");
+        return film;
+    }
+
+    // Largest difference of the pixel means, -1 if the sample counts differ
+    float compare(const Film& a, const Film& b) {
+        float difference = 0;
+        Vec2i resolution = a.getResolution();
+        for (int y = 0; y < resolution.y(); y++) {
+            for (int x = 0; x < resolution.x(); x++) {
+                if (a.getSampleCount(x, y) != b.getSampleCount(x, y)) return -1;
+                difference = std::max(difference, (a.getColor(x, y) - b.getColor(x, y)).cwiseAbs().maxCoeff());
+            }
+        }
+        return difference;
+    }
+
+    void setAge(const fs::path& path, int seconds) {
+        fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::seconds(seconds));
+    }
+}
+
+int main() {
+    auto dir = test_scene::makeDirectory("render_farm");
+    auto scene = test_scene::cornellBox(dir);
+    std::string config_path = test_scene::writeConfig(dir, "box", scene);
+    Vec2i resolution(scene["image_resolution"][0].get<int>(), scene["image_resolution"][1].get<int>());
+
+    // Tile strips of one pass each hold exactly the samples of the local render
+    render_farm::Job tiles;
+    tiles.config_path = config_path;
+    tiles.rows_per_item = 1;
+    Film local = renderLocal(config_path, 1);
+    check(compare(local, renderFarm(dir / "tiles", tiles, resolution)) == 0, "tile sharded render is identical to a local one");
+
+    // Reusing a job directory is refused, its films belong to the earlier job
+    check(!render_farm::submit((dir / "tiles").string(), tiles), "submit into a used job directory is refused");
+
+    // Passes as items: the same samples, summed per pass, so equal up to rounding
+    render_farm::Job samples;
+    samples.config_path = config_path;
+    samples.shard = render_farm::ShardMode::Samples;
+    samples.passes = 3;
+    float difference = compare(renderLocal(config_path, 3), renderFarm(dir / "samples", samples, resolution));
+    check(difference >= 0 && difference < 1e-4f, "sample sharded render matches a local one");
+
+    // An item whose owner and first backup both died is backed up again
+    render_farm::Job stragglers = tiles;
+    stragglers.straggler_seconds = 1;
+    fs::path job_dir = dir / "stragglers";
+    check(render_farm::submit(job_dir.string(), stragglers), "straggler job is submitted");
+    fs::create_directory(job_dir / "claims" / "item_0");
+    fs::create_directory(job_dir / "claims" / "item_0.backup1");
+    setAge(job_dir / "claims" / "item_0", 10);
+    setAge(job_dir / "claims" / "item_0.backup1", 10);
+    render_farm::work(job_dir.string(), 2);
+    check(fs::exists(job_dir / "claims" / "item_0.backup2"), "a late backup is backed up");
+    Film recovered(resolution, false);
+    check(render_farm::merge(job_dir.string(), recovered, 30), "films of the straggler job are merged");
+    check(compare(local, recovered) == 0, "backed up render is identical to a local one");
+
+    return test_scene::finish("RenderFarm");
+}
@@ -0,0 +1,99 @@
+#ifndef TEST_SCENE_HPP_
+#define TEST_SCENE_HPP_
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <nlohmann/json.hpp>
+
+/*
+Scenes for the tests that render: a small Cornell box (five walls, a block
+and one area light) written as obj files and a config into a fresh
+temporary directory, since the assets of configs/ are not in the tree.
+*/
+namespace test_scene {
+    inline int failures = 0;
+
+    inline void check(bool condition, const char* what) {
+        if (!condition) {
+            printf("FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    // Empty directory of the test, removed and recreated on every run
+    inline std::filesystem::path makeDirectory(const std::string& name) {
+        auto dir = std::filesystem::temp_directory_path() / ("hypox_test_" + name);
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        return dir;
+    }
+
+    inline void writeFile(const std::filesystem::path& path, const std::string& contents) {
+        std::ofstream(path, std::ios::binary) << contents;
+    }
+
+    // Config of the box, with its obj files written to `dir`
+    inline nlohmann::json cornellBox(const std::filesystem::path& dir) {
+        // Mesh shading needs vertex normals, every face carries one
+        auto quad = [](const char* a, const char* b, const char* c, const char* d, const char* n) {
+            return std::string("v ") + a + "\nv " + b + "\nv " + c + "\nv " + d + "\nvn " + n + "\nf 1//1 2//1 3//1 4//1\n";
+        };
+        writeFile(dir / "floor.obj", quad("-1 0 -1", "1 0 -1", "1 0 1", "-1 0 1", "0 1 0"));
+        writeFile(dir / "ceiling.obj", quad("-1 2 -1", "1 2 -1", "1 2 1", "-1 2 1", "0 -1 0"));
+        writeFile(dir / "back.obj", quad("-1 0 -1", "1 0 -1", "1 2 -1", "-1 2 -1", "0 0 1"));
+        writeFile(dir / "left.obj", quad("-1 0 -1", "-1 2 -1", "-1 2 1", "-1 0 1", "1 0 0"));
+        writeFile(dir / "right.obj", quad("1 0 -1", "1 2 -1", "1 2 1", "1 0 1", "-1 0 0"));
+        writeFile(dir / "block.obj",
+            "v -0.3 0 -0.3\nv 0.3 0 -0.3\nv 0.3 0 0.3\nv -0.3 0 0.3\n"
+            "v -0.3 0.9 -0.3\nv 0.3 0.9 -0.3\nv 0.3 0.9 0.3\nv -0.3 0.9 0.3\n"
+            "vn 0 -1 0\nvn 0 1 0\nvn 0 0 -1\nvn 1 0 0\nvn 0 0 1\nvn -1 0 0\n"
+            "f 1//1 2//1 3//1 4//1\nf 5//2 6//2 7//2 8//2\nf 1//3 2//3 6//3 5//3\n"
+            "f 2//4 3//4 7//4 6//4\nf 3//5 4//5 8//5 7//5\nf 4//6 1//6 5//6 8//6\n");
+
+        nlohmann::json config;
+        config["spp"] = 2;
+        config["max_depth"] = 4;
+        config["image_resolution"] = {32, 32};
+        config["cam_config"] = {
+            {"position", {0, 1, 6.8}}, {"look_at", {0, 1, 0}}, {"ref_up", {0, 1, 0}},
+            {"vertical_fov", 19.5}, {"focal_length", 1}
+        };
+        config["light_config"] = {{{"position", {0, 1.98, 0}}, {"size", {0.5, 0.5}}, {"radiance", {17.0, 12.0, 5.0}}}};
+        config["materials"] = {
+            {{"color", {0.725, 0.71, 0.68}}, {"type", "diffuse"}, {"name", "grey"}},
+            {{"color", {0.63, 0.065, 0.05}}, {"type", "diffuse"}, {"name", "red"}},
+            {{"color", {0.14, 0.45, 0.091}}, {"type", "diffuse"}, {"name", "green"}}
+        };
+        config["objects"] = nlohmann::json::array();
+        auto object = [&](const char* file, const char* material, int has_acc) {
+            config["objects"].push_back({
+                {"obj_file_path", (dir / file).string()}, {"material_name", material},
+                {"translate", {0, 0, 0}}, {"scale", 1}, {"has_acc", has_acc}
+            });
+        };
+        object("floor.obj", "grey", 0);
+        object("ceiling.obj", "grey", 0);
+        object("back.obj", "grey", 0);
+        object("left.obj", "red", 0);
+        object("right.obj", "green", 0);
+        object("block.obj", "grey", 1);
+        return config;
+    }
+
+    // Write the config next to the scene and return its path
+    inline std::string writeConfig(const std::filesystem::path& dir, const std::string& name, const nlohmann::json& config) {
+        auto path = dir / (name + ".json");
+        writeFile(path, config.dump(2));
+        return path.string();
+    }
+
+    // Exit status of a test
+    inline int finish(const char* name) {
+        if (failures == 0) printf("%s: all tests passed\n", name);
+        return failures == 0 ? 0 : 1;
+    }
+}
+
+#endif // TEST_SCENE_HPP_
@@ -0,0 +1,254 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "HypoxRayTracer.hpp"
+#include "stats.hpp"
+
+/*
+Render benchmark: renders every scene once per thread count and reports the
+stage times, ray counts and traversal work per ray, as a table and as JSON.
+Sampling is counter based, so every run of a scene traces the same rays on
+any machine and thread count.
+
+    HypoxBenchmark [--threads 1,2,4] [--json benchmark.json] [--no-synthetic] [config.json ...]
+*/
+
+namespace {
+    using json = nlohmann::json;
+
+    struct Scenario {
+        std::string name;
+        std::string config_path;
+    };
+
+    double millisecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<int> parseThreadList(const std::string& list) {
+        std::vector<int> threads;
+        size_t begin = 0;
+        while (begin < list.size()) {
+            size_t end = list.find(',', begin);
+            if (end == std::string::npos) end = list.size();
+            int count = std::atoi(list.substr(begin, end - begin).c_str());
+            if (count > 0) threads.push_back(count);
+            begin = end + 1;
+        }
+        return threads;
+    }
+
+    std::vector<int> defaultThreadList() {
+        int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        std::vector<int> threads;
+        for (int count = 1; count < hardware; count *= 2) {
+            threads.push_back(count);
+        }
+        threads.push_back(hardware);
+        return threads;
+    }
+
+    // Stress scenes derived from the small Cornell box, written next to the other temporary files
+    std::vector<Scenario> writeSyntheticScenes(const std::string& base_path) {
+        std::ifstream file(base_path);
+        if (!file) {
+            std::cerr << "Benchmark: cannot open " << base_path << ", skipping the synthetic scenes" << std::endl;
+            return {};
+        }
+        json base = json::parse(file);
+        std::vector<Scenario> scenarios;
+        auto write = [&](const std::string& name, const json& config) {
+            std::string path = (std::filesystem::temp_directory_path() / ("hypox_bench_" + name + ".json")).string();
+            std::ofstream(path) << config.dump(2);
+            scenarios.push_back({ name, path });
+        };
+
+        // Many instances of one accelerated mesh, stressing the top level BVH
+        json instances = base;
+        json bunny;
+        for (const auto& object: base["objects"]) {
+            if (object.value("has_acc", 0) != 0) bunny = object;
+        }
+        if (!bunny.is_null()) {
+            constexpr int grid = 8;
+            for (int i = 0; i < grid; i++) {
+                for (int j = 0; j < grid; j++) {
+                    json copy = bunny;
+                    copy["scale"] = bunny["scale"].get<float>() / 3;
+                    copy["translate"] = { -0.85 + 1.7 * i / (grid - 1), 0.0, -0.85 + 1.7 * j / (grid - 1) };
+                    instances["objects"].push_back(copy);
+                }
+            }
+            write("stress_instances", instances);
+        }
+
+        // Many small lights sharing the power of the original one, stressing light sampling
+        json lights = base;
+        const json light = base["light_config"][0];
+        constexpr int light_grid = 8;
+        lights["light_config"] = json::array();
+        for (int i = 0; i < light_grid; i++) {
+            for (int j = 0; j < light_grid; j++) {
+                json copy = light;
+                copy["position"] = { -0.8 + 1.6 * i / (light_grid - 1), light["position"][1].get<float>(), -0.8 + 1.6 * j / (light_grid - 1) };
+                copy["size"] = { 0.1, 0.1 };
+                for (int k = 0; k < 3; k++) {
+                    copy["radiance"][k] = light["radiance"][k].get<float>() * 25.0f / (light_grid * light_grid);
+                }
+                lights["light_config"].push_back(copy);
+            }
+        }
+        write("stress_lights", lights);
+
+        // Long paths, stressing the bounce loop
+        json deep = base;
+        deep["max_depth"] = 16;
+        deep["rr_depth"] = 16;
+        write("stress_depth", deep);
+        return scenarios;
+    }
+
+    json runScenario(const Scenario& scenario, const std::vector<int>& thread_counts) {
+        json result;
+        result["name"] = scenario.name;
+        result["config"] = scenario.config_path;
+
+        // Load: config and scene, which reads the meshes and builds their acceleration structures
+        stats::reset();
+        auto start = std::chrono::steady_clock::now();
+        Config config(scenario.config_path);
+        auto image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y());
+        auto camera = std::make_shared<Camera>(config.camera_config, image);
+        auto scene = std::make_shared<Scene>(config);
+        double scene_ms = millisecondsSince(start);
+        stats::Counters load_stats = stats::collect();
+        result["resolution"] = { config.image_resolution.x(), config.image_resolution.y() };
+        result["spp"] = config.spp * config.spp;
+        result["max_depth"] = config.max_depth;
+        result["scene_ms"] = scene_ms;
+        result["mesh_load_cpu_ms"] = load_stats[stats::LoadTime] * 1e-6;
+        result["accel_build_cpu_ms"] = load_stats[stats::BuildTime] * 1e-6;
+
+        double single_thread_ms = 0;
+        result["runs"] = json::array();
+        for (int threads: thread_counts) {
+            Config run_config = config;
+            run_config.threads = threads;
+            run_config.render_mode = RenderMode::Final;
+            HypoxRayTracer tracer(camera, scene, run_config);
+
+            stats::reset();
+            start = std::chrono::steady_clock::now();
+            tracer.render();
+            double render_ms = millisecondsSince(start);
+            stats::Counters render_stats = stats::collect();
+            if (single_thread_ms == 0) single_thread_ms = render_ms * threads;
+
+            uint64_t rays = render_stats[stats::PrimaryRays] + render_stats[stats::BounceRays] + render_stats[stats::ShadowRays];
+            double per_ray = rays > 0 ? 1.0 / static_cast<double>(rays) : 0.0;
+            json run;
+            run["threads"] = threads;
+            run["render_ms"] = render_ms;
+            run["primary_rays"] = render_stats[stats::PrimaryRays];
+            run["bounce_rays"] = render_stats[stats::BounceRays];
+            run["shadow_rays"] = render_stats[stats::ShadowRays];
+            run["mrays_per_s"] = rays / (render_ms * 1e3);
+            run["node_tests_per_ray"] = render_stats[stats::NodeTests] * per_ray;
+            run["triangle_tests_per_ray"] = render_stats[stats::TriangleTests] * per_ray;
+            // Relative to the first run scaled to one thread
+            run["speedup"] = single_thread_ms / render_ms;
+            run["efficiency"] = single_thread_ms / render_ms / threads;
+            for (int i = 0; i < stats::COUNTER_COUNT; i++) {
+                run["counters"][stats::getName(static_cast<stats::Counter>(i))] = render_stats.values[i];
+            }
+            result["runs"].push_back(run);
+        }
+
+        // Write: the image of the last run
+        std::string image_path = (std::filesystem::temp_directory_path() / ("hypox_bench_" + scenario.name + ".png")).string();
+        start = std::chrono::steady_clock::now();
+        image->writeImage(image_path);
+        result["write_ms"] = millisecondsSince(start);
+        result["image"] = image_path;
+        return result;
+    }
+
+    void printScenario(const json& result) {
+        printf("\n%s (%dx%d, %d spp, %s)\n", result["name"].get<std::string>().c_str(),
+            result["resolution"][0].get<int>(), result["resolution"][1].get<int>(), result["spp"].get<int>(),
+            result["config"].get<std::string>().c_str());
+        printf("  scene %.1f ms (mesh load %.1f ms, accel build %.1f ms cpu), write %.1f ms\n",
+            result["scene_ms"].get<double>(), result["mesh_load_cpu_ms"].get<double>(),
+            result["accel_build_cpu_ms"].get<double>(), result["write_ms"].get<double>());
+        printf("  %7s %10s %9s %10s %10s %10s %9s %9s %8s\n",
+            "threads", "render ms", "Mrays/s", "primary", "bounce", "shadow", "nodes/ray", "tris/ray", "speedup");
+        for (const auto& run: result["runs"]) {
+            printf("  %7d %10.1f %9.2f %10llu %10llu %10llu %9.1f %9.1f %8.2f\n",
+                run["threads"].get<int>(), run["render_ms"].get<double>(), run["mrays_per_s"].get<double>(),
+                run["primary_rays"].get<unsigned long long>(), run["bounce_rays"].get<unsigned long long>(),
+                run["shadow_rays"].get<unsigned long long>(), run["node_tests_per_ray"].get<double>(),
+                run["triangle_tests_per_ray"].get<double>(), run["speedup"].get<double>());
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    puts("==========   HypoxBenchmark    ==========");
+    if (!stats::ENABLED) {
+        puts("Built without HYPOX_STATS: ray and traversal counts read 0");
+    }
+
+    std::vector<int> thread_counts = defaultThreadList();
+    std::string json_path = "benchmark.json";
+    bool synthetic = true;
+    std::vector<Scenario> scenarios;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_counts = parseThreadList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--no-synthetic") == 0) {
+            synthetic = false;
+        } else {
+            scenarios.push_back({ std::filesystem::path(argv[i]).stem().string(), argv[i] });
+        }
+    }
+    if (thread_counts.empty()) {
+        std::cerr << "Benchmark: no valid thread count" << std::endl;
+        return 1;
+    }
+    if (scenarios.empty()) {
+        for (const char* name: { "small", "base", "big" }) {
+            scenarios.push_back({ name, std::string("./configs/") + name + ".json" });
+        }
+    }
+    if (synthetic) {
+        for (auto& scenario: writeSyntheticScenes("./configs/small.json")) {
+            scenarios.push_back(std::move(scenario));
+        }
+    }
+
+    json report;
+    report["hardware_threads"] = std::thread::hardware_concurrency();
+    report["simd"] = simd::getName(simd::getKernels().isa);
+    report["stats"] = stats::ENABLED;
+    report["scenes"] = json::array();
+    for (const auto& scenario: scenarios) {
+        if (!std::filesystem::exists(scenario.config_path)) {
+            std::cerr << "Benchmark: missing config " << scenario.config_path << std::endl;
+            continue;
+        }
+        report["scenes"].push_back(runScenario(scenario, thread_counts));
+    }
+
+    puts("\n==========  Benchmark Results   ==========");
+    for (const auto& result: report["scenes"]) {
+        printScenario(result);
+    }
+    std::ofstream(json_path) << report.dump(2) << std::endl;
+    printf("\nResults written to %s\n", json_path.c_str());
+}
@@ -0,0 +1,88 @@
+#include <cstring>
+#include <iostream>
+
+#include "render_farm.hpp"
+#include "HypoxRayTracer.hpp"
+
+/*
+Distributed rendering over a shared job directory (see render_farm.hpp).
+Start the coordinator and any number of workers, on any nodes that see the
+job directory, the config and its assets at the same paths:
+
+    HypoxDistributed render <config.json> <job_dir> <output> [--shard tiles|samples] [--rows n] [--passes n]
+        [--seed n] [--straggler seconds] [--timeout seconds] [--local]
+    HypoxDistributed work <job_dir> [--threads n]
+
+`render` submits the job, waits for the films and writes the merged image;
+with --local it also works on the job itself until nothing is left to claim.
+Every render needs a job directory of its own: one holding the claims or
+films of an earlier job is refused.
+*/
+
+namespace {
+    int usage() {
+        std::cerr << "Usage: HypoxDistributed render <config.json> <job_dir> <output> [options]" << std::endl
+            << "       HypoxDistributed work <job_dir> [--threads n]" << std::endl;
+        return 1;
+    }
+}
+
+int main(int argc, char** argv) {
+    puts("==========   HypoxDistributed   ==========");
+    if (argc < 3) return usage();
+
+    if (std::strcmp(argv[1], "work") == 0) {
+        int threads = 0;
+        for (int i = 3; i < argc; i++) {
+            if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = std::atoi(argv[++i]);
+        }
+        int rendered = render_farm::work(argv[2], threads);
+        if (rendered < 0) return 1;
+        printf("Rendered %d items\n", rendered);
+        return 0;
+    }
+
+    if (std::strcmp(argv[1], "render") != 0 || argc < 5) return usage();
+    render_farm::Job job;
+    job.config_path = argv[2];
+    std::string job_dir = argv[3], output = argv[4];
+    float timeout = 0;
+    bool local = false;
+    for (int i = 5; i < argc; i++) {
+        if (std::strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            job.shard = std::strcmp(argv[++i], "samples") == 0 ? render_farm::ShardMode::Samples : render_farm::ShardMode::Tiles;
+        } else if (std::strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            job.rows_per_item = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            job.passes = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            job.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--straggler") == 0 && i + 1 < argc) {
+            job.straggler_seconds = static_cast<float>(std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout = static_cast<float>(std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--local") == 0) {
+            local = true;
+        } else {
+            return usage();
+        }
+    }
+
+    Config config(job.config_path);
+    if (!render_farm::submit(job_dir, job)) {
+        std::cerr << "Cannot create the job in " << job_dir << std::endl;
+        return 1;
+    }
+    std::cout << "Job submitted to " << job_dir << std::endl;
+    if (local) {
+        render_farm::work(job_dir, config.threads);
+    }
+
+    Film film(config.image_resolution, false);
+    if (!render_farm::merge(job_dir, film, timeout)) return 1;
+    Image image(config.image_resolution.x(), config.image_resolution.y(), config.framebuffer);
+    film.develop(image);
+    image.writeImage(output);
+    std::cout << output << " written" << std::endl;
+    return 0;
+}
@@ -3,24 +3,179 @@
 
 #include "camera.hpp"
 #include "scene.hpp"
+#include "photon_map.hpp"
+#include "tile_trace.hpp"
+#include <functional>
 
 class HypoxRayTracer {
 public:
     HypoxRayTracer() = delete;
-    HypoxRayTracer(std::shared_ptr<Camera> camera, std::shared_ptr<Scene> scene, int spp = 1, int max_depth = 3): 
-        camera(camera), scene(scene), spp(spp), max_depth(max_depth) {}
-    HypoxRayTracer(std::shared_ptr<Camera> camera, std::shared_ptr<Scene> scene, Config config): 
-        camera(camera), scene(scene), spp(config.spp), max_depth(config.max_depth) {}
+    HypoxRayTracer(std::shared_ptr<Camera> camera, std::shared_ptr<Scene> scene, int spp = 1, int max_depth = 3, int threads = 0): 
+        camera(camera), scene(scene), spp(spp), max_depth(max_depth), threads(threads), tile_kernel(selectTileKernel(spp, max_depth)) {}
+    HypoxRayTracer(std::shared_ptr<Camera> camera, std::shared_ptr<Scene> scene, const Config& config):
+        camera(camera), scene(scene) { configure(config); }
 
+    /*
+    Take the render settings of `config`, whose scene must be the tracer's:
+    the photon map is kept unless a setting it was traced with changed, so
+    a batch over one scene traces it once.
+    */
+    void configure(const Config& config);
+    // Render the next frames from `camera`, keeping the photon map
+    void setCamera(std::shared_ptr<Camera> camera) { this->camera = std::move(camera); }
+
+    /*
+    Render the image in TILE_SIZE x TILE_SIZE tiles spread over a work-stealing
+    scheduler. Progressive mode renders passes of spp * spp samples per pixel,
+    skipping converged pixels, and develops the image after each pass.
+    */
     void render();
+    /*
+    Continue the accumulation in `film`, which must match the image resolution:
+    renders passes first_pass .. first_pass + pass_count - 1 as render() does
+    (Final mode renders pass first_pass once) and develops the image after each.
+    Returns the number of passes rendered, fewer once every pixel converged.
+    */
+    int renderPasses(Film& film, int first_pass, int pass_count);
+    /*
+    Add pass `pass` of the tiles in tile rows [row0, row1) to `film`, all of
+    their pixels and without developing the image; used to render shards of
+    a frame whose films are merged elsewhere.
+    */
+    void renderTileRows(Film& film, int row0, int row1, int pass);
+    // Called after each progressive pass, once the camera image holds its result
+    void setPassCallback(std::function<void(int pass)> callback) { pass_callback = std::move(callback); }
+    /*
+    Called from the render threads, concurrently, after every pass of a tile
+    with the pixel means of [x0, x1) x [y0, y1) final for that pass.
+    */
+    void setTileCallback(std::function<void(const Film& film, int x0, int y0, int x1, int y1)> callback) { tile_callback = std::move(callback); }
+    // Record when every tile of the next renders starts and ends
+    void setTraceTiles(bool trace) { trace_tiles = trace; }
+    // Tile timeline of the last render, empty unless tiles are traced
+    [[nodiscard]] const TileTrace& getTileTrace() const { return tile_trace; }
+    // Trace the photon map again before the next render, after lights or surfaces changed
+    void invalidatePhotonMap() { photon_map_built = false; }
+    [[nodiscard]] const PhotonMap& getPhotonMap() const { return photon_map; }
+
+    static constexpr int TILE_SIZE = 16;
+    // Kernel parameter read from the tracer at runtime instead of fixed at compile time
+    static constexpr int DYNAMIC = -1;
+    // Passes every pixel gets before its variance estimate is trusted
+    static constexpr int MIN_PASSES = 2;
 
 private:
+    // The last scattering event of a path, needed to weight the emitters its next ray hits
+    struct PathVertex {
+        Vec3f position {0, 0, 0};
+        Vec3f normal {0, 0, 0};
+        // Solid angle pdf of the sampled direction
+        float pdf {0};
+        // Camera rays and delta BSDFs, whose emitter hits have no light sampling counterpart
+        bool specular {true};
+    };
+    // Path being traced by the wavefront integrator
+    struct PathState {
+        Ray ray;
+        Vec3f beta;
+        Vec3f radiance;
+        RandomSampler sampler;
+        PathVertex vertex;
+    };
+    struct WavefrontHit {
+        int path;
+        uintptr_t sort_key;
+        Interaction interaction;
+    };
+    struct ShadowRay {
+        Ray ray;
+        // Added to the path radiance when the ray is not blocked
+        Vec3f contribution;
+        int path;
+    };
+    // Per thread buffers of renderTileWavefront
+    struct WavefrontQueues {
+        // Pixels of the tile that are rendered, in path order
+        std::vector<Vec2i> pixels;
+        std::vector<PathState> paths;
+        std::vector<int> active, next;
+        std::vector<WavefrontHit> hits;
+        std::vector<ShadowRay> shadow_rays;
+    };
+
+    // Build the photon map when the indirect light comes from it and it is out of date
+    void preparePhotonMap();
+    // Render pass `pass` of tile `tile` (row major over the image) into the film
+    void renderTileIndex(int tile, Camera::SamplePattern sample_pattern, int pass, Film& film, WavefrontQueues& queues);
+    // Whether pass `pass` still samples the pixel
+    [[nodiscard]] bool needsSamples(const Film& film, int x, int y, int pass) const;
+    /*
+    Add pass `pass` of every pixel of [x0, x1) x [y0, y1) still needing samples
+    to the film, one path at a time. MAX_DEPTH and SAMPLES (spp * spp), unless
+    DYNAMIC, are the tracer's max_depth and sample count known at compile time,
+    so the bounce and supersampling loops have constant trip counts.
+    */
+    template <int MAX_DEPTH, int SAMPLES>
+    void renderTile(int x0, int y0, int x1, int y1, Camera::SamplePattern sample_pattern, int pass, Film& film);
+    using TileKernel = void (HypoxRayTracer::*)(int x0, int y0, int x1, int y1, Camera::SamplePattern sample_pattern, int pass, Film& film);
+    // renderTile instantiated for spp and max_depth, the DYNAMIC one for uncommon values
+    static TileKernel selectTileKernel(int spp, int max_depth);
+    /*
+    Same estimator and random numbers as renderTile, by stages: all camera
+    rays of the tile are queued, then each bounce intersects every live path
+    (camera rays as packets), sorts the hits by material, samples lights and
+    BSDFs, and finally traces the batch of shadow rays. The two kernels are
+    compiled separately, so with fast math the images agree only up to
+    rounding, not bit for bit. Packets only walk the top level BVH; every
+    instance's bottom level BVH is still traversed one ray at a time, so
+    scenes of a few instances gain little from them.
+    */
+    void renderTileWavefront(int x0, int y0, int x1, int y1, Camera::SamplePattern sample_pattern, int pass, Film& film, WavefrontQueues& queues);
+
+    /*
+    Light sample for the interaction: picks a light through the scene's light
+    sampler, then writes the unoccluded contribution, MIS weighted against
+    BSDF sampling unless a photon map ends the path after it, and the shadow
+    ray that decides it. False if no light can
+    reach the point or the BSDF is delta.
+    */
+    bool sampleDirectLighting(Interaction& interaction, RandomSampler& sampler, Ray& shadow_ray, Vec3f& contribution) const;
     Vec3f evalDirectLighting(const Ray& ray, Interaction& interaction, RandomSampler& sampler) const;
+    // Emission of a light hit by a ray leaving `vertex`, MIS weighted against light sampling
+    Vec3f evalEmission(const Interaction& light_hit, const PathVertex& vertex) const;
+    /*
+    Sample the next direction of the path: updates the throughput, the vertex
+    and the ray to trace. False if the path carries no more energy.
+    */
+    bool sampleBSDF(Interaction& interaction, RandomSampler& sampler, Vec3f& beta, PathVertex& vertex, Ray& next_ray) const;
+    // Russian roulette after rr_depth bounces, false terminates the path
+    bool russianRoulette(int depth, Vec3f& beta, RandomSampler& sampler) const;
+    template <int MAX_DEPTH>
     Vec3f evalRadiance(const Ray& ray, Interaction& interaction, RandomSampler& sampler) const;
 
     std::shared_ptr<Camera> camera;
     std::shared_ptr<Scene> scene;
-    int spp, max_depth;
+    int spp {1}, max_depth {3};
+    int rr_depth {2};
+    // Render threads, 0 uses the hardware thread count
+    int threads {0};
+    SamplerType sampler_type {SamplerType::Random};
+    uint32_t seed {0};
+    IntegratorType integrator_type {IntegratorType::Path};
+    IndirectType indirect_type {IndirectType::Path};
+    PhotonMapConfig photon_map_config;
+    PhotonMap photon_map;
+    bool photon_map_built {false};
+    RenderMode render_mode {RenderMode::Final};
+    float noise_threshold {0.01f};
+    int max_passes {64};
+    // Seconds, 0 for no limit
+    float time_budget {0};
+    bool trace_tiles {false};
+    TileTrace tile_trace;
+    TileKernel tile_kernel {nullptr};
+    std::function<void(int pass)> pass_callback;
+    std::function<void(const Film& film, int x0, int y0, int x1, int y1)> tile_callback;
 };
 
 #endif // HYPOX_RAY_TRACER_HPP_
\ No newline at end of file
@@ -16,6 +16,13 @@ struct IndirectVPLsData {
     Vec3f flux;
 };
 
+/*
+Shadow of the key light at a pixel. d is the distance from the light center
+to the receiver and d_f the distance to the first blocker in between (d_f = d
+when nothing blocks it), the terms of the PCSS penumbra width. c_e is the
+visible fraction of the light, c_c the visibility of its center, and position
+the blocker (the receiver itself when unblocked).
+*/
 struct ShadowData {
     float d_sub_df;
     float d_div_df;
@@ -32,22 +39,98 @@ struct GBufferEntry {
     float roughness;
 };
 
+/*
+Buffers of the front end, one contiguous array per field (structure of
+arrays), so each pass touches only the fields it writes and a consumer can
+upload every field as a plain float array. Per-pixel buffers are
+width * height long in row-major order; pixels whose primary ray misses keep
+zeros and a zero mask.
+*/
+struct LightFormerBuffers {
+    // G-buffer of the primary hits
+    std::vector<Vec3f> gbuffer_position, gbuffer_normal, gbuffer_albedo, gbuffer_specular;
+    std::vector<float> gbuffer_roughness, gbuffer_mask;
+    // Towards the key light, and halfway between it and the viewer
+    std::vector<Vec3f> light_directions, half_vectors;
+    // ShadowData fields
+    std::vector<float> shadow_d_sub_df, shadow_d_div_df, shadow_c_e, shadow_c_c;
+    std::vector<Vec3f> shadow_position;
+    std::vector<Vec3f> direct_position, direct_normal, direct_power;
+    // indirect_per_direct entries per direct VPL, misses keep zero flux
+    std::vector<Vec3f> indirect_position, indirect_normal, indirect_flux;
+};
+
+/*
+Generates the inputs of LightFormer for one view: the G-buffer of the
+primary hits, the key light direction and shadow terms per pixel, and direct
+VPLs on the lights with their first-bounce indirect VPLs. Every pass runs on
+the TaskScheduler over the scene's shared acceleration structures, and each
+pixel or VPL draws from its own RandomSampler stream, so the buffers do not
+depend on the thread count.
+
+write() stores every buffer as a float32 channel in one file laid out like the
+mesh cache: a Header, a table of Channel entries, and the channel data, each
+starting on a cache line, so the file can be mapped and read in place.
+*/
 class LightFormerFrontEnd {
 public:
     using LightDirection = Vec3f;
     using HalfVector = Vec3f;
+
+    static constexpr uint32_t VERSION = 1;
+    static constexpr int CHANNEL_NAME_SIZE = 32;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t channel_count;
+        int32_t width, height;
+        uint32_t direct_count, indirect_count;
+    };
+
+    // count elements of components float32 values each, at offset from the start of the file
+    struct Channel {
+        char name[CHANNEL_NAME_SIZE];
+        uint32_t components;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t offset;
+    };
+
+    LightFormerFrontEnd(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, const Config& render_config);
+
+    // Fill every buffer, returns the number of rays traced
+    uint64_t generate();
+    bool write(const std::string& path) const;
+
+    [[nodiscard]] const LightFormerBuffers& getBuffers() const { return buffers; }
+    // One element of the buffers as a record
+    [[nodiscard]] GBufferEntry getGBufferEntry(int pixel) const;
+    [[nodiscard]] ShadowData getShadowData(int pixel) const;
+    [[nodiscard]] DirectVPLsData getDirectVPL(int index) const;
+    [[nodiscard]] IndirectVPLsData getIndirectVPL(int index) const;
+
 private:
+    // G-buffer, key light direction and shadow of the pixels in row y
+    uint64_t generatePixels(int y, RandomSampler& sampler);
+    // Direct VPL `index` and its indirect VPLs
+    uint64_t generateVPLs(int index, RandomSampler& sampler);
+
     // Basic Components: Camera and Scene
     std::shared_ptr<Camera> camera;
     std::shared_ptr<Scene> scene;
+    LightFormerConfig config;
+    int threads;
+    SamplerType sampler_type;
+    uint32_t seed;
+    int width, height;
+    // Brightest light, the one the per-pixel direction and shadow buffers refer to
+    int key_light {-1};
+    // Picks the light of each direct VPL by power
+    AliasTable light_table;
 
     // Buffers For Light Former
-    std::vector<DirectVPLsData> direct_vpls;
-    std::vector<IndirectVPLsData> indirect_vpls;
-    std::vector<LightDirection> light_directions;
-    std::vector<HalfVector> half_vectors;
-    std::vector<ShadowData> shadow_data;
-    std::vector<GBufferEntry> gbuffer;
+    LightFormerBuffers buffers;
 };
 
-#endif // LIGHT_FORMER_FRONT_END_HPP_
\ No newline at end of file
+#endif // LIGHT_FORMER_FRONT_END_HPP_
@@ -1,9 +1,16 @@
 #ifndef ACCEL_HPP_
 #define ACCEL_HPP_
 
+#include <array>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include "utils.hpp"
+#include "configs.hpp"
 #include "camera.hpp"
 #include "interaction.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
 
 class AABB {
 public:
@@ -53,11 +60,24 @@ public:
 
     bool intersect(const Ray& ray) const;
     bool intersect(const Ray& ray, float* t_in, float* t_out) const;
+    // Slab test with a precomputed inverse direction, clipped to [t_min, t_max]
+    bool intersect(const Vec3f& origin, const Vec3f& inv_direction, float t_min, float t_max, float* t_in) const {
+        Vec3f t0 = (xyz_min - origin).cwiseProduct(inv_direction),
+            t1 = (xyz_max - origin).cwiseProduct(inv_direction);
+        float t_near = std::max(t_min, t0.cwiseMin(t1).maxCoeff()),
+            t_far = std::min(t_max, t0.cwiseMax(t1).minCoeff());
+        *t_in = t_near;
+        return t_near <= t_far;
+    }
 
     [[nodiscard]] Vec3f getCenter() const { return (xyz_min + xyz_max) / 2; }
     [[nodiscard]] float getSize(int dim) const { return xyz_max[dim] - xyz_min[dim]; }
     [[nodiscard]] Vec3f getMin() const { return xyz_min; }
     [[nodiscard]] Vec3f getMax() const { return xyz_max; }
+    [[nodiscard]] float getSurfaceArea() const {
+        Vec3f d = xyz_max - xyz_min;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
     [[nodiscard]] bool isOverlapWith(const AABB& other) const {
         return (xyz_min.x() <= other.xyz_max.x() && xyz_max.x() >= other.xyz_min.x()) &&
                (xyz_min.y() <= other.xyz_max.y() && xyz_max.y() >= other.xyz_min.y()) &&
@@ -79,43 +99,554 @@ private:
 };
 
 
-struct GridCell {
-// Constructor
-    GridCell(): aabb(Vec3f(0,0,0), Vec3f(1,1,1)) {};
-    GridCell(const Vec3f& min, const Vec3f& max): aabb(min, max) {}
+/*
+Uniform grid accelerator. Primitives are binned by their bounds into cells
+stored as one flat reference list (cell i owns the references in
+[cell_offsets[i], cell_offsets[i + 1])). Traversal walks the cells along the
+ray with the Amanatides-Woo 3D-DDA and stops at the first cell that contains
+the closest hit.
+*/
+class OccupancyGrid {
+public:
+    // A zero resolution picks one from the primitive density at build time
+    OccupancyGrid(): grid_resolution(0, 0, 0) {}
+    OccupancyGrid(int resolution): grid_resolution(resolution, resolution, resolution) {}
+    OccupancyGrid(int res_x, int res_y, int res_z): grid_resolution(res_x, res_y, res_z) {}
+    OccupancyGrid(const Vec3i& resolution): grid_resolution(resolution) {}
+
+    void build(const std::vector<AABB>& prim_aabbs);
+
+    /*
+    Closest-hit traversal. `intersect_prim(prim, t_max)` tests one primitive,
+    shrinks `t_max` and returns true on a closer hit.
+    */
+    template <typename IntersectFunc>
+    bool intersect(const Ray& ray, float& t_max, IntersectFunc&& intersect_prim) const {
+        DDAState state;
+        if (!setupDDA(ray, t_max, state)) return false;
+
+        Mailbox mailbox;
+        bool hit = false;
+        while (true) {
+            int cell = state.cell.x() + grid_resolution.x() * (state.cell.y() + grid_resolution.y() * state.cell.z());
+            for (int i = cell_offsets[cell]; i < cell_offsets[cell + 1]; i++) {
+                int prim = cell_prims[i];
+                if (mailbox.testAndInsert(prim)) continue;
+                if (intersect_prim(prim, t_max)) hit = true;
+            }
+            // A hit inside the current cell cannot be beaten by later cells
+            if (!stepDDA(state, t_max)) break;
+        }
+        return hit;
+    }
+
+    // Any-hit traversal, returns as soon as `occluded_prim(prim)` reports a hit
+    template <typename OccludedFunc>
+    bool occluded(const Ray& ray, OccludedFunc&& occluded_prim) const {
+        DDAState state;
+        float t_max = ray.getTMax();
+        if (!setupDDA(ray, t_max, state)) return false;
+
+        Mailbox mailbox;
+        do {
+            int cell = state.cell.x() + grid_resolution.x() * (state.cell.y() + grid_resolution.y() * state.cell.z());
+            for (int i = cell_offsets[cell]; i < cell_offsets[cell + 1]; i++) {
+                int prim = cell_prims[i];
+                if (mailbox.testAndInsert(prim)) continue;
+                if (occluded_prim(prim)) return true;
+            }
+        } while (stepDDA(state, t_max));
+        return false;
+    }
+
+    [[nodiscard]] bool empty() const { return cell_offsets.empty(); }
+    [[nodiscard]] Vec3i getResolution() const { return grid_resolution; }
+    [[nodiscard]] AABB getAABB() const { return aabb; }
 
-    void add_object(std::shared_ptr<Geometry> object) {
-        objects.push_back(object);
+private:
+    struct DDAState {
+        Vec3i cell, step, out;
+        Vec3f next_t, delta_t;
+    };
+    bool setupDDA(const Ray& ray, float t_max, DDAState& state) const;
+    // Move to the next cell, false once the ray leaves the grid or passes t_max
+    bool stepDDA(DDAState& state, float t_max) const {
+        int axis = (state.next_t.x() < state.next_t.y())
+            ? (state.next_t.x() < state.next_t.z() ? 0 : 2)
+            : (state.next_t.y() < state.next_t.z() ? 1 : 2);
+        if (t_max < state.next_t[axis]) return false;
+        state.cell[axis] += state.step[axis];
+        if (state.cell[axis] == state.out[axis]) return false;
+        state.next_t[axis] += state.delta_t[axis];
+        return true;
     }
 
-    // The Grid Cell
+    // Per-ray set of already tested primitives (open addressing on the stack),
+    // so a primitive covering several cells is intersected once. Once half full
+    // it stops recording, and later primitives are simply tested again.
+    struct Mailbox {
+        static constexpr int MAILBOX_SIZE = 256;
+        Mailbox() { slots.fill(-1); }
+        bool testAndInsert(int prim) {
+            if (count >= MAILBOX_SIZE / 2) return false;
+            unsigned int h = (static_cast<unsigned int>(prim) * 2654435761u) & (MAILBOX_SIZE - 1);
+            while (slots[h] != -1) {
+                if (slots[h] == prim) return true;
+                h = (h + 1) & (MAILBOX_SIZE - 1);
+            }
+            slots[h] = prim;
+            count++;
+            return false;
+        }
+        std::array<int, MAILBOX_SIZE> slots;
+        int count {0};
+    };
+
+    std::vector<int> cell_offsets;
+    std::vector<int> cell_prims;
+    Vec3i grid_resolution;
+    Vec3f cell_size {Vec3f::Zero()};
     AABB aabb;
-    // Objects
-    std::vector<std::shared_ptr<Geometry>> objects;
 };
 
-class OccupancyGrid {
+struct BVHNode {
+    AABB aabb;
+    // Interior node: index of the right child (the left child is the next node)
+    // Leaf node: index of the first primitive slot
+    int offset;
+    // Number of primitives, 0 for interior nodes
+    int count;
+    int axis;
+};
+
+class BVH {
+public:
+    BVH() = default;
+
+    /*
+    Build the hierarchy over the given primitive bounds, by default with the full
+    sweep surface area heuristic. Nodes are stored flattened in depth-first order,
+    and leaves refer to primitive slots: slot i holds the primitive
+    getPrimIndices()[i], so callers can store their primitives in build order
+    and index them by slot directly. Binned and LBVH builds use up to `threads`
+    threads (0 for the hardware thread count).
+    */
+    void build(const std::vector<AABB>& prim_aabbs, int max_leaf_size = 4, BVHBuildType type = BVHBuildType::Sweep, int threads = 1);
+    // Recompute the node bounds for primitives that moved, keeping the topology and the slots
+    void refit(const std::vector<AABB>& prim_aabbs);
+
+    /*
+    Closest-hit traversal. `intersect_prim(slot, t_max)` tests one primitive,
+    shrinks `t_max` and returns true on a closer hit.
+    */
+    template <typename IntersectFunc>
+    bool intersect(const Ray& ray, float& t_max, IntersectFunc&& intersect_prim) const {
+        if (nodes.empty()) return false;
+        Vec3f origin = ray.getOrigin(), inv_direction = ray.getDirection().cwiseInverse();
+        bool dir_is_neg[3] = { inv_direction.x() < 0, inv_direction.y() < 0, inv_direction.z() < 0 };
+
+        int stack[BVH_STACK_SIZE];
+        int stack_ptr = 0, node_id = 0;
+        bool hit = false;
+        while (true) {
+            const BVHNode& node = nodes[node_id];
+            stats::add(stats::NodeTests);
+            float t_in;
+            if (node.aabb.intersect(origin, inv_direction, ray.getTMin(), t_max, &t_in)) {
+                if (node.count > 0) {
+                    for (int i = 0; i < node.count; i++) {
+                        if (intersect_prim(node.offset + i, t_max)) hit = true;
+                    }
+                    if (stack_ptr == 0) break;
+                    node_id = stack[--stack_ptr];
+                }
+                else if (dir_is_neg[node.axis]) {
+                    // Visit the near child first
+                    stack[stack_ptr++] = node_id + 1;
+                    node_id = node.offset;
+                }
+                else {
+                    stack[stack_ptr++] = node.offset;
+                    node_id = node_id + 1;
+                }
+            }
+            else {
+                if (stack_ptr == 0) break;
+                node_id = stack[--stack_ptr];
+            }
+        }
+        return hit;
+    }
+
+    // Any-hit traversal, returns as soon as `occluded_prim(slot)` reports a hit
+    template <typename OccludedFunc>
+    bool occluded(const Ray& ray, OccludedFunc&& occluded_prim) const {
+        if (nodes.empty()) return false;
+        Vec3f origin = ray.getOrigin(), inv_direction = ray.getDirection().cwiseInverse();
+        float t_max = ray.getTMax();
+
+        int stack[BVH_STACK_SIZE];
+        int stack_ptr = 0, node_id = 0;
+        while (true) {
+            const BVHNode& node = nodes[node_id];
+            stats::add(stats::NodeTests);
+            float t_in;
+            if (node.aabb.intersect(origin, inv_direction, ray.getTMin(), t_max, &t_in)) {
+                if (node.count > 0) {
+                    for (int i = 0; i < node.count; i++) {
+                        if (occluded_prim(node.offset + i)) return true;
+                    }
+                    if (stack_ptr == 0) break;
+                    node_id = stack[--stack_ptr];
+                }
+                else {
+                    stack[stack_ptr++] = node.offset;
+                    node_id = node_id + 1;
+                }
+            }
+            else {
+                if (stack_ptr == 0) break;
+                node_id = stack[--stack_ptr];
+            }
+        }
+        return false;
+    }
+
+    /*
+    Closest-hit traversal of up to PACKET_SIZE coherent rays together. A node is
+    visited once for all the rays that reach it, and children are ordered by the
+    first of them. `intersect_prim(ray_index, slot, t_max)` works like the single
+    ray callback, with t_max = t_max[ray_index].
+    */
+    template <typename IntersectFunc>
+    void intersectPacket(const Ray* rays, int count, float* t_max, IntersectFunc&& intersect_prim) const {
+        if (nodes.empty() || count <= 0) return;
+        Vec3f origins[PACKET_SIZE], inv_directions[PACKET_SIZE];
+        for (int i = 0; i < count; i++) {
+            origins[i] = rays[i].getOrigin();
+            inv_directions[i] = rays[i].getDirection().cwiseInverse();
+        }
+
+        struct StackEntry {
+            int node_id;
+            uint64_t mask;
+        };
+        StackEntry stack[BVH_STACK_SIZE];
+        int stack_ptr = 0, node_id = 0;
+        uint64_t mask = count == PACKET_SIZE ? ~0ull : (1ull << count) - 1;
+        while (true) {
+            const BVHNode& node = nodes[node_id];
+            stats::add(stats::NodeTests, __builtin_popcountll(mask));
+            // Rays of the packet that hit this node
+            uint64_t hit_mask = 0;
+            for (uint64_t bits = mask; bits; bits &= bits - 1) {
+                int i = __builtin_ctzll(bits);
+                float t_in;
+                if (node.aabb.intersect(origins[i], inv_directions[i], rays[i].getTMin(), t_max[i], &t_in)) {
+                    hit_mask |= 1ull << i;
+                }
+            }
+            if (hit_mask != 0 && node.count > 0) {
+                for (int p = 0; p < node.count; p++) {
+                    for (uint64_t bits = hit_mask; bits; bits &= bits - 1) {
+                        int i = __builtin_ctzll(bits);
+                        intersect_prim(i, node.offset + p, t_max[i]);
+                    }
+                }
+            }
+            else if (hit_mask != 0) {
+                // Visit the near child of the first active ray first
+                int first = __builtin_ctzll(hit_mask);
+                bool dir_is_neg = inv_directions[first][node.axis] < 0;
+                stack[stack_ptr++] = { dir_is_neg ? node_id + 1 : node.offset, hit_mask };
+                node_id = dir_is_neg ? node.offset : node_id + 1;
+                mask = hit_mask;
+                continue;
+            }
+            if (stack_ptr == 0) break;
+            --stack_ptr;
+            node_id = stack[stack_ptr].node_id;
+            mask = stack[stack_ptr].mask;
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+    [[nodiscard]] const std::vector<BVHNode>& getNodes() const { return nodes; }
+    [[nodiscard]] const std::vector<int>& getPrimIndices() const { return prim_indices; }
+
+    static constexpr int BVH_STACK_SIZE = 128;
+    static constexpr int BVH_MAX_DEPTH = 64;
+    // Rays per intersectPacket call, one bit each in the active mask
+    static constexpr int PACKET_SIZE = 64;
+
+    // Centroid bins of a Binned build split
+    static constexpr int SAH_BINS = 16;
+    // Ranges of at most this many primitives are built by one task
+    static constexpr int MIN_TASK_PRIMS = 4096;
+
+private:
+    struct BuildPrim {
+        AABB aabb;
+        Vec3f centroid;
+        int index;
+        uint32_t morton;
+    };
+    // Node of a top down build, before flattening
+    struct BuildNode {
+        AABB aabb;
+        // Children in the same task, -1 for leaves
+        int left {-1};
+        int right {-1};
+        // Primitive range of a leaf
+        int begin {0};
+        int end {0};
+        int axis {0};
+        // Task that builds the subtree in place of this node, -1 if none
+        int task {-1};
+    };
+    struct BuildTask {
+        int begin, end, depth;
+        std::vector<BuildNode> nodes;
+    };
+    /*
+    Split [begin, end) of the bounds `bounds` at a returned mid (reordering the
+    range), setting the split axis, or return -1 for a leaf. `threads` may work
+    on the range together.
+    */
+    using SplitFunc = std::function<int(std::vector<BuildPrim>& prims, int begin, int end, const AABB& bounds, int& axis, int threads)>;
+
+    int buildRecursive(std::vector<BuildPrim>& prims, int begin, int end, int depth, int max_leaf_size);
+    /*
+    Top down build shared by the Binned and LBVH builders: the top levels are
+    split with all threads until the ranges are small enough to be tasks, the
+    tasks build their subtrees in parallel, and the tree is flattened.
+    */
+    void buildTopDown(std::vector<BuildPrim>& prims, int max_leaf_size, int threads, const SplitFunc& split);
+    int buildTaskNode(std::vector<BuildPrim>& prims, std::vector<BuildNode>& nodes, std::vector<BuildTask>& tasks,
+        int begin, int end, int depth, int max_leaf_size, int threads, int task_size, const SplitFunc& split);
+    int flatten(const std::vector<BuildTask>& tasks, const std::vector<BuildNode>& pool, int node);
+    static int splitBinned(std::vector<BuildPrim>& prims, int begin, int end, const AABB& bounds, int& axis, int threads, int max_leaf_size);
+    static int splitMorton(std::vector<BuildPrim>& prims, int begin, int end, int& axis);
+
+    std::vector<BVHNode> nodes;
+    std::vector<int> prim_indices;
+};
+
+struct alignas(32) WideBVHNode {
+    // Child bounds as bounds[axis][child], min corner in axis 0-2 and max corner in axis 3-5
+    float bounds[6][simd::BOX_WIDTH];
+    // Interior child: node index, leaf child: first primitive slot
+    int child[simd::BOX_WIDTH];
+    // Primitives in a leaf child, 0 for interior children and -1 for empty slots
+    int count[simd::BOX_WIDTH];
+};
+
+/*
+WideBVHNode with the child bounds quantized to 8 bits per plane, on a grid
+of power of two steps anchored at the union of the children. Planes are
+rounded outwards, so a grid box always contains the exact one. The box
+kernel works on the grid directly: 104 bytes instead of 256, and the origin
+and planes share the first cache line.
+*/
+struct alignas(8) CompactWideBVHNode {
+    float origin[3];
+    // Grid step of every axis is 2^exponent
+    int8_t exponent[3];
+    // Bit c set if child c exists
+    uint8_t valid;
+    // Grid planes laid out like WideBVHNode::bounds
+    uint8_t bounds[6][simd::BOX_WIDTH];
+    int child[simd::BOX_WIDTH];
+    int8_t count[simd::BOX_WIDTH];
+
+    // Largest leaf the node can store
+    static constexpr int MAX_LEAF_COUNT = 127;
+    static_assert(simd::BOX_WIDTH <= 8, "the valid mask holds one bit per child");
+
+    // False if a leaf child holds more than MAX_LEAF_COUNT primitives
+    bool encode(const WideBVHNode& node);
+    [[nodiscard]] simd::QuantizedBoxes getBoxes() const {
+        simd::QuantizedBoxes boxes;
+        boxes.planes = bounds;
+        for (int axis = 0; axis < 3; axis++) {
+            boxes.origin[axis] = origin[axis];
+            uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+            std::memcpy(&boxes.step[axis], &bits, sizeof(float));
+        }
+        boxes.valid = valid;
+        return boxes;
+    }
+};
+
+/*
+BVH with BOX_WIDTH children per node, collapsed from a binary BVH and keeping
+its primitive slots. All children of a node are tested against the ray in one
+SIMD box kernel call, and leaves are handed to the caller as slot ranges so
+their primitives can be tested by a SIMD kernel as well. After compress() the
+nodes are stored as CompactWideBVHNode, which trades a few instructions per
+box test for less than half the memory traffic.
+*/
+class WideBVH {
 public:
-    OccupancyGrid(): grid_resolution(4, 4, 4) {
-        occupancy_grid.resize(grid_resolution.x() * grid_resolution.y() * grid_resolution.z());
+    WideBVH() = default;
+
+    void build(const BVH& bvh);
+    // Recompute the child bounds for primitives that moved, `slot_aabbs[i]` bounding slot i
+    void refit(const std::vector<AABB>& slot_aabbs);
+    // Switch to the compact node format, false (keeping the full nodes) if a leaf is too large for it
+    bool compress();
+
+    /*
+    Closest-hit traversal. `intersect_leaf(first, count, t_max)` tests the
+    slots [first, first + count), shrinks `t_max` and returns true on a closer hit.
+    */
+    template <typename LeafFunc>
+    bool intersect(const simd::RayData& ray, float& t_max, LeafFunc&& intersect_leaf) const {
+        if (isCompact()) return intersectNodes(getCompactNodes(), ray, t_max, intersect_leaf);
+        return intersectNodes(getNodes(), ray, t_max, intersect_leaf);
+    }
+
+    // Any-hit traversal, returns as soon as `occluded_leaf(first, count)` reports a hit
+    template <typename LeafFunc>
+    bool occluded(const simd::RayData& ray, float t_max, LeafFunc&& occluded_leaf) const {
+        if (isCompact()) return occludedNodes(getCompactNodes(), ray, t_max, occluded_leaf);
+        return occludedNodes(getNodes(), ray, t_max, occluded_leaf);
+    }
+
+    [[nodiscard]] bool empty() const { return getNodes().empty() && getCompactNodes().empty(); }
+    [[nodiscard]] bool isCompact() const { return !getCompactNodes().empty(); }
+    [[nodiscard]] size_t getNodeCount() const { return isCompact() ? getCompactNodes().size() : getNodes().size(); }
+    [[nodiscard]] size_t getMemorySize() const {
+        return isCompact() ? getCompactNodes().size() * sizeof(CompactWideBVHNode) : getNodes().size() * sizeof(WideBVHNode);
     }
-    OccupancyGrid(int resolution): grid_resolution(resolution, resolution, resolution) {
-        occupancy_grid.resize(grid_resolution.x() * grid_resolution.y() * grid_resolution.z());
+    // The built nodes, or the external ones given to setNodes
+    [[nodiscard]] utils::Span<const WideBVHNode> getNodes() const {
+        return external_nodes.empty() ? utils::Span<const WideBVHNode>(built_nodes.data(), built_nodes.size()) : external_nodes;
     }
-    OccupancyGrid(int res_x, int res_y, int res_z): grid_resolution(res_x, res_y, res_z) {
-        occupancy_grid.resize(grid_resolution.x() * grid_resolution.y() * grid_resolution.z());
+    [[nodiscard]] utils::Span<const CompactWideBVHNode> getCompactNodes() const {
+        return external_compact_nodes.empty() ?
+            utils::Span<const CompactWideBVHNode>(compact_nodes.data(), compact_nodes.size()) : external_compact_nodes;
     }
-    OccupancyGrid(const Vec3i& resolution): grid_resolution(resolution) {
-        occupancy_grid.resize(grid_resolution.x() * grid_resolution.y() * grid_resolution.z());
+    // Traverse nodes stored elsewhere (a mapped mesh cache) instead of building them, they must outlive the BVH
+    void setNodes(utils::Span<const WideBVHNode> nodes) {
+        clear();
+        external_nodes = nodes;
     }
+    void setNodes(utils::Span<const CompactWideBVHNode> nodes) {
+        clear();
+        external_compact_nodes = nodes;
+    }
+    // Copy the external nodes into the BVH, so it no longer depends on their storage
+    void ownNodes() {
+        if (!external_nodes.empty()) {
+            built_nodes.assign(external_nodes.begin(), external_nodes.end());
+            external_nodes = {};
+        }
+        if (!external_compact_nodes.empty()) {
+            compact_nodes.assign(external_compact_nodes.begin(), external_compact_nodes.end());
+            external_compact_nodes = {};
+        }
+    }
+
+    static constexpr int WIDE_BVH_STACK_SIZE = simd::BOX_WIDTH * BVH::BVH_MAX_DEPTH;
 
+private:
+    struct StackEntry {
+        int node;
+        float t_near;
+    };
+    // Box test of all the children of a node
+    static int intersectChildren(const simd::Kernels& kernels, const WideBVHNode& node, const simd::RayData& ray, float t_max, float* t_near) {
+        return kernels.intersectBoxes(node.bounds, ray, t_max, t_near);
+    }
+    static int intersectChildren(const simd::Kernels& kernels, const CompactWideBVHNode& node, const simd::RayData& ray, float t_max, float* t_near) {
+        return kernels.intersectQuantizedBoxes(node.getBoxes(), ray, t_max, t_near);
+    }
 
-    bool intersect(const Ray& ray, Interaction& interaction) const;
+    template <typename Node, typename LeafFunc>
+    static bool intersectNodes(utils::Span<const Node> nodes, const simd::RayData& ray, float& t_max, LeafFunc&& intersect_leaf) {
+        if (nodes.empty()) return false;
+        const simd::Kernels& kernels = simd::getKernels();
 
+        StackEntry stack[WIDE_BVH_STACK_SIZE];
+        int stack_ptr = 0;
+        stack[stack_ptr++] = { 0, ray.t_min };
+        bool hit = false;
+        while (stack_ptr > 0) {
+            StackEntry entry = stack[--stack_ptr];
+            if (entry.t_near > t_max) continue;
+            const Node& node = nodes[entry.node];
+            stats::add(stats::NodeTests);
 
-    std::vector<GridCell> occupancy_grid;
-    Vec3i grid_resolution;
-    AABB aabb;
+            float t_near[simd::BOX_WIDTH];
+            int mask = intersectChildren(kernels, node, ray, t_max, t_near);
+            // Sort the hit children front to back
+            int order[simd::BOX_WIDTH], hit_count = 0;
+            for (int c = 0; c < simd::BOX_WIDTH; c++) {
+                if (!(mask & (1 << c))) continue;
+                int k = hit_count++;
+                while (k > 0 && t_near[order[k - 1]] > t_near[c]) {
+                    order[k] = order[k - 1];
+                    k--;
+                }
+                order[k] = c;
+            }
+            // Test leaves right away, push interior children farthest first
+            for (int k = 0; k < hit_count; k++) {
+                int c = order[k];
+                if (node.count[c] > 0 && t_near[c] <= t_max && intersect_leaf(node.child[c], node.count[c], t_max)) {
+                    hit = true;
+                }
+            }
+            for (int k = hit_count - 1; k >= 0; k--) {
+                int c = order[k];
+                if (node.count[c] == 0) {
+                    stack[stack_ptr++] = { node.child[c], t_near[c] };
+                }
+            }
+        }
+        return hit;
+    }
+
+    template <typename Node, typename LeafFunc>
+    static bool occludedNodes(utils::Span<const Node> nodes, const simd::RayData& ray, float t_max, LeafFunc&& occluded_leaf) {
+        if (nodes.empty()) return false;
+        const simd::Kernels& kernels = simd::getKernels();
+
+        int stack[WIDE_BVH_STACK_SIZE];
+        int stack_ptr = 0;
+        stack[stack_ptr++] = 0;
+        while (stack_ptr > 0) {
+            const Node& node = nodes[stack[--stack_ptr]];
+            stats::add(stats::NodeTests);
+            float t_near[simd::BOX_WIDTH];
+            int mask = intersectChildren(kernels, node, ray, t_max, t_near);
+            for (int c = 0; c < simd::BOX_WIDTH; c++) {
+                if (!(mask & (1 << c))) continue;
+                if (node.count[c] > 0) {
+                    if (occluded_leaf(node.child[c], node.count[c])) return true;
+                }
+                else if (node.count[c] == 0) {
+                    stack[stack_ptr++] = node.child[c];
+                }
+            }
+        }
+        return false;
+    }
+
+    void clear() {
+        built_nodes.clear();
+        compact_nodes.clear();
+        external_nodes = {};
+        external_compact_nodes = {};
+    }
+    int collapse(const BVH& bvh, int binary_node);
+
+    utils::AlignedVector<WideBVHNode> built_nodes;
+    utils::Span<const WideBVHNode> external_nodes;
+    // Only one of the formats holds nodes
+    utils::AlignedVector<CompactWideBVHNode> compact_nodes;
+    utils::Span<const CompactWideBVHNode> external_compact_nodes;
 };
 
 #endif // ACCEL_HPP_
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+Bump allocator for objects that live as long as their owner (the scene).
+Objects are placed one after another in large cache line aligned blocks, so
+objects created together sit together in memory, and are never freed one by
+one: the destructor runs the destructors that are not trivial, newest first,
+and then releases the blocks. Not thread safe; objects built by several
+threads take their storage from allocateArray first and are handed back
+with adoptArray once constructed.
+*/
+class Arena {
+public:
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE): block_size(block_size) {}
+    ~Arena() { clear(); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Uninitialized storage, larger requests get a block of their own
+    void* allocate(size_t size, size_t alignment);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        adoptArray(object, 1);
+        return object;
+    }
+    // Storage for `count` contiguous objects, to be constructed in place by the caller
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+    // Destroy the constructed objects of an allocateArray with the arena
+    template <typename T>
+    void adoptArray(T* objects, size_t count) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            destructors.push_back({ objects, count, [](void* objects, size_t count) {
+                for (size_t i = count; i-- > 0;) static_cast<T*>(objects)[i].~T();
+            } });
+        }
+    }
+
+    // Destroy every object and release the blocks
+    void clear();
+    // Bytes of the blocks, used or not
+    [[nodiscard]] size_t getCapacity() const { return capacity; }
+    [[nodiscard]] size_t getUsedSize() const { return used; }
+
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 16;
+    static constexpr size_t BLOCK_ALIGNMENT = 64;
+
+private:
+    struct BlockDeleter {
+        void operator()(std::byte* block) const { ::operator delete(block, std::align_val_t(BLOCK_ALIGNMENT)); }
+    };
+    struct Destructor {
+        void* objects;
+        size_t count;
+        void (*destroy)(void* objects, size_t count);
+    };
+
+    size_t block_size;
+    std::vector<std::unique_ptr<std::byte[], BlockDeleter>> blocks;
+    std::vector<Destructor> destructors;
+    // Free range of the current block
+    std::byte* head {nullptr};
+    std::byte* end {nullptr};
+    size_t capacity {0};
+    size_t used {0};
+};
+
+#endif // ARENA_HPP_
@@ -9,56 +9,99 @@ public:
     BSDF() = default;
     BSDF(const Vec3f& color): color(color) {}
     BSDF(const MaterialConfig& config): color(config.color) {}
+    BSDF(MaterialType type, const Vec3f& color): color(color), type(type) {}
     virtual ~BSDF() = default;
 
-    [[nodiscard]] virtual Vec3f evaluate(Interaction& interaction) const {
-        return getPDF(interaction) * color;
-    }
+    /*
+    f(w_o, w_i) for the directions in the interaction. Delta BSDFs instead
+    return the weight f * cos / pdf of their sampled direction.
+    */
+    [[nodiscard]] virtual Vec3f evaluate(Interaction& interaction) const = 0;
+    // Sample interaction.w_i and return its solid angle pdf (1 for delta BSDFs)
     virtual float sample(Interaction& interaction, RandomSampler& sampler) const = 0;
-protected:
-    virtual float getPDF(Interaction& interaction) const = 0;
+    // Solid angle pdf of sample() picking interaction.w_i, 0 for delta BSDFs
+    [[nodiscard]] virtual float getPDF(const Interaction& interaction) const = 0;
     [[nodiscard]] virtual bool isDelta() const = 0;
 
+    // Concrete type, for the static dispatch of bsdf::dispatch
+    [[nodiscard]] MaterialType getType() const { return type; }
+    [[nodiscard]] Vec3f getColor() const { return color; }
+    void setColor(const Vec3f& c) { color = c; }
+protected:
     // Any BSDF should have a color
     Vec3f color;
+    MaterialType type {MaterialType::Custom};
 };
 
-class IdealDiffuseBSDF: public BSDF {
+// Lambertian: f = color / PI, sampled with a cosine weighted pdf cos / PI
+class IdealDiffuseBSDF final: public BSDF {
 public:
-    IdealDiffuseBSDF(const Vec3f& color): BSDF(color) {}
-    IdealDiffuseBSDF(const MaterialConfig& config): BSDF(config) {}
+    IdealDiffuseBSDF(const Vec3f& color): BSDF(MaterialType::Diffuse, color) {}
+    IdealDiffuseBSDF(const MaterialConfig& config): BSDF(MaterialType::Diffuse, config.color) {}
+    [[nodiscard]] Vec3f evaluate(Interaction& interaction) const override {
+        if (interaction.normal.dot(interaction.w_i) <= 0) return Vec3f(0, 0, 0);
+        return color * INV_PI;
+    }
     virtual float sample(Interaction& interaction, RandomSampler& sampler) const override;
-    
-protected:
-    virtual float getPDF(Interaction& interaction) const override {
-        return 1.0f / (2 * PI);
+    [[nodiscard]] float getPDF(const Interaction& interaction) const override {
+        return std::max(0.0f, interaction.normal.normalized().dot(interaction.w_i)) * INV_PI;
     }
-    virtual bool isDelta() const override {
+    [[nodiscard]] bool isDelta() const override {
         return false;
     }
 };
 
-class IdealSpecularBSDF: public BSDF {
+class IdealSpecularBSDF final: public BSDF {
 public:
-    IdealSpecularBSDF(const Vec3f& color): BSDF(color) {}
-    IdealSpecularBSDF(const MaterialConfig& config): BSDF(config) {}
-    virtual float sample(Interaction& interaction, RandomSampler& sampler) const override;
-
-protected:
-    virtual float getPDF(Interaction& interaction) const override {
+    IdealSpecularBSDF(const Vec3f& color): BSDF(MaterialType::Specular, color) {}
+    IdealSpecularBSDF(const MaterialConfig& config): BSDF(MaterialType::Specular, config.color) {}
+    [[nodiscard]] Vec3f evaluate(Interaction& interaction) const override {
         Vec3f normal = interaction.normal.normalized(),
             wi = interaction.w_i.normalized(), wo = interaction.w_o.normalized();
         // Generate the reflect direction
         Vec3f reflect_dir = 2 * (normal.dot(wo)) * normal - wo;
         // Check the angle between the reflect direction and the outgoing direction
         if ((reflect_dir - wi).norm() < EPS) {
-            return 1.0f; // Delta BSDF
+            return color; // Delta BSDF
         }
-        else return 0.0f;
+        else return Vec3f(0, 0, 0);
+    }
+    virtual float sample(Interaction& interaction, RandomSampler& sampler) const override;
+    [[nodiscard]] float getPDF(const Interaction& interaction) const override {
+        return 0.0f;
     }
-    virtual bool isDelta() const override {
+    [[nodiscard]] bool isDelta() const override {
         return true;
     }
 };
 
+/*
+Material calls of the integrators, switching on the type tag of the BSDF
+instead of loading its vtable. The built-in BSDFs are final, so each case is
+a direct, inlinable call; Custom BSDFs keep their virtual calls.
+*/
+namespace bsdf {
+template <typename Func>
+decltype(auto) dispatch(const BSDF& bsdf, Func&& func) {
+    switch (bsdf.getType()) {
+        case MaterialType::Diffuse: return func(static_cast<const IdealDiffuseBSDF&>(bsdf));
+        case MaterialType::Specular: return func(static_cast<const IdealSpecularBSDF&>(bsdf));
+        default: return func(bsdf);
+    }
+}
+
+inline Vec3f evaluate(const BSDF& bsdf, Interaction& interaction) {
+    return dispatch(bsdf, [&](const auto& material) { return material.evaluate(interaction); });
+}
+inline float sample(const BSDF& bsdf, Interaction& interaction, RandomSampler& sampler) {
+    return dispatch(bsdf, [&](const auto& material) { return material.sample(interaction, sampler); });
+}
+inline float getPDF(const BSDF& bsdf, const Interaction& interaction) {
+    return dispatch(bsdf, [&](const auto& material) { return material.getPDF(interaction); });
+}
+inline bool isDelta(const BSDF& bsdf) {
+    return dispatch(bsdf, [](const auto& material) { return material.isDelta(); });
+}
+}
+
 #endif // BSDF_HPP_
\ No newline at end of file
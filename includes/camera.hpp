@@ -7,6 +7,7 @@
 
 class Ray {
 public:
+    Ray(): Ray(Vec3f(0, 0, 0), Vec3f(0, 0, 1)) {}
     Ray(const Vec3f& origin, const Vec3f& direction): origin(origin), direction(direction), t_min(1e-4), t_max(1e9) {}
     Ray(const Vec3f& origin, const Vec3f& direction, float t_min, float t_max): origin(origin), direction(direction), t_min(t_min), t_max(t_max) {}
     
@@ -33,12 +34,50 @@ private:
     float t_min, t_max;
 };
 
+// Position of a sample inside its pixel, in pixels from the pixel corner
+struct SampleOffset {
+    float x, y;
+};
+
+/*
+Rotated grid super sampling: an n x n grid inside the pixel, rotated by
+ROTATE_ANGLE around the pixel corner. The pattern only depends on n, so it is
+built once instead of per pixel, at compile time for the common sizes.
+*/
+constexpr void fillRotatedGrid(int n, SampleOffset* pattern) {
+    const double theta = ROTATE_ANGLE * static_cast<double>(PI) / 180;
+    const double cos_theta = utils::constexprCos(theta), sin_theta = utils::constexprSin(theta);
+    const double delta = 1.0 / (n + 1);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double bias_x = (i + 1) * delta, bias_y = (j + 1) * delta;
+            pattern[i * n + j] = {
+                static_cast<float>(cos_theta * bias_x - sin_theta * bias_y),
+                static_cast<float>(sin_theta * bias_x + cos_theta * bias_y)
+            };
+        }
+    }
+}
+template <int N>
+constexpr std::array<SampleOffset, N * N> makeRotatedGrid() {
+    std::array<SampleOffset, N * N> pattern {};
+    fillRotatedGrid(N, pattern.data());
+    return pattern;
+}
+inline constexpr auto ROTATED_GRID_1 = makeRotatedGrid<1>();
+inline constexpr auto ROTATED_GRID_2 = makeRotatedGrid<2>();
+inline constexpr auto ROTATED_GRID_3 = makeRotatedGrid<3>();
+inline constexpr auto ROTATED_GRID_4 = makeRotatedGrid<4>();
+
 class Camera {
 public:
     using SamplePoint = Vec2f;
     using SamplePoints = std::vector<SamplePoint>;
+    using SamplePattern = utils::Span<const SampleOffset>;
     
-    Camera(): fov(45), focal_length(1.0), image(nullptr) {}
+    Camera(): fov(45), focal_length(1.0), image(nullptr) {
+        updateRayCache();
+    }
     Camera(CameraConfig camera_config): fov(camera_config.fov), focal_length(camera_config.focal_length) {
         position = camera_config.position;
         lookAt(camera_config.look_at, camera_config.ref_up);
@@ -56,45 +95,45 @@ public:
         forward = -(look_at - position).normalized();
         right = ref_up.cross(forward).normalized();
         up = forward.cross(right).normalized();
+        updateRayCache();
     }
 
-    SamplePoints generateSuperSamplingPoint(int dx, int dy, int spp) {
-        // Use rotate grid to do super sampling
-        SamplePoints raw_bias;
-        float delta_x = 1.0f / (spp + 1), delta_y = 1.0f / (spp + 1);
-        for (int i = 0; i < spp; i++) {
-            for (int j = 0; j < spp; j++) {
-                raw_bias.push_back(SamplePoint((i + 1) * delta_x, (j + 1) * delta_y));
-            }
+    /*
+    Rotated grid offsets for spp x spp super sampling. Sizes above 4 are built
+    on first use and cached in the camera, so call this before rendering
+    starts rather than from the render threads.
+    */
+    SamplePattern getSamplePattern(int spp) {
+        switch (spp) {
+            case 1: return ROTATED_GRID_1;
+            case 2: return ROTATED_GRID_2;
+            case 3: return ROTATED_GRID_3;
+            case 4: return ROTATED_GRID_4;
+            default: break;
         }
-        // Rotate the grid
-        Eigen::Matrix2f Rotate;
-        float theta = ROTATE_ANGLE * PI / 180;
-        Rotate << cosf(theta), -sinf(theta), sinf(theta), cosf(theta);
+        if (spp != sample_pattern_spp) {
+            sample_pattern.assign(static_cast<size_t>(spp) * spp, SampleOffset {0, 0});
+            fillRotatedGrid(spp, sample_pattern.data());
+            sample_pattern_spp = spp;
+        }
+        return sample_pattern;
+    }
+
+    SamplePoints generateSuperSamplingPoint(int dx, int dy, int spp) {
         SamplePoints sample_points;
-        for (const auto& bias : raw_bias) {
-            Vec2f new_bias = Rotate * bias;
-            Vec2f point(dx + new_bias.x(), dy + new_bias.y());
-            sample_points.push_back(point);
+        for (const auto& offset: getSamplePattern(spp)) {
+            sample_points.push_back(SamplePoint(dx + offset.x, dy + offset.y));
         }
         return sample_points;
     }
 
-    Ray generateRay(float dx, float dy) {
-        // Get the position of screen center.
-        Vec3f screen_center = position - focal_length * forward;
-
-        // Get the bias of screen point
-        Vec2i resolution = getImage()->getResolution();
-        float aspect_ratio = getImage()->getAspectRatio();
-        Vec3f delta_x = (2 * ((dx + 0.5) / (resolution.x())) - 1)
-            * focal_length * aspect_ratio * tanf(fov * PI / 360)
-            * right;
-        Vec3f delta_y = (2 * ((dy + 0.5) / (resolution.y())) - 1)
-            * focal_length * tanf(fov * PI / 360)
-            * up;
-        Vec3f screen_point_location = screen_center + delta_x + delta_y;
-        return Ray(position, (screen_point_location-position), 0.6, 10);
+    // Ray through the raster position (dx, dy); the screen mapping is cached by updateRayCache
+    [[nodiscard]] Ray generateRay(float dx, float dy) const {
+        Vec3f direction = raster_origin + dx * raster_dx + dy * raster_dy;
+        return Ray(position, direction, 0.6, 10);
+    }
+    [[nodiscard]] Ray generateRay(int dx, int dy, const SampleOffset& offset) const {
+        return generateRay(dx + offset.x, dy + offset.y);
     }
 
     // Getter
@@ -105,21 +144,55 @@ public:
     [[nodiscard]] float getFov() const { return fov; }
     [[nodiscard]] float getFocalLength() const { return focal_length; }
     [[nodiscard]] std::shared_ptr<Image> getImage() const { return image; }
+    [[nodiscard]] Vec3f getScreenCenter() const { return screen_center; }
     // Setter
-    void setPosition(const Vec3f& position) { this->position = position; }
-    void setForward(const Vec3f& forward) { this->forward = forward; }
-    void setRight(const Vec3f& right) { this->right = right; }
-    void setUp(const Vec3f& up) { this->up = up; }
-    void setFov(float fov) { this->fov = fov; }
-    void setFocalLength(float focal_length) { this->focal_length = focal_length; }
-    void setImage(const std::shared_ptr<Image>& image) { this->image = image; }
+    void setPosition(const Vec3f& position) { this->position = position; updateRayCache(); }
+    void setForward(const Vec3f& forward) { this->forward = forward; updateRayCache(); }
+    void setRight(const Vec3f& right) { this->right = right; updateRayCache(); }
+    void setUp(const Vec3f& up) { this->up = up; updateRayCache(); }
+    void setFov(float fov) { this->fov = fov; updateRayCache(); }
+    void setFocalLength(float focal_length) { this->focal_length = focal_length; updateRayCache(); }
+    void setImage(const std::shared_ptr<Image>& image) { this->image = image; updateRayCache(); }
 private:
+    // Recompute everything generateRay needs; called by every setter
+    void updateRayCache() {
+        tan_half_fov = tanf(fov * PI / 360);
+        screen_center = position - focal_length * forward;
+        aspect_ratio = image ? image->getAspectRatio() : 1.0f;
+        if (!image) {
+            raster_origin = screen_center - position;
+            raster_dx = raster_dy = Vec3f::Zero();
+            return;
+        }
+        // Screen offset of raster x: (2 * (x + 0.5) / width - 1) * half_width * right
+        Vec2i resolution = image->getResolution();
+        Vec3f half_width = focal_length * aspect_ratio * tan_half_fov * right;
+        Vec3f half_height = focal_length * tan_half_fov * up;
+        raster_dx = 2.0f / resolution.x() * half_width;
+        raster_dy = 2.0f / resolution.y() * half_height;
+        raster_origin = screen_center - position
+            + (1.0f / resolution.x() - 1) * half_width
+            + (1.0f / resolution.y() - 1) * half_height;
+    }
+
     Vec3f position;
     Vec3f forward, right, up;
     float fov;
     float focal_length;
 
     std::shared_ptr<Image> image;
+
+    // Cached by updateRayCache
+    float tan_half_fov {0};
+    float aspect_ratio {1};
+    Vec3f screen_center {Vec3f::Zero()};
+    // Ray direction for raster (0, 0) and its change per pixel
+    Vec3f raster_origin {Vec3f::Zero()};
+    Vec3f raster_dx {Vec3f::Zero()}, raster_dy {Vec3f::Zero()};
+
+    // Runtime built pattern for spp above 4
+    std::vector<SampleOffset> sample_pattern;
+    int sample_pattern_spp {0};
 };
 
 
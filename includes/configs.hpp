@@ -7,7 +7,96 @@
 
 enum MaterialType {
     Diffuse,
-    Specular
+    Specular,
+    // BSDFs defined outside bsdf.hpp, never read from a config
+    Custom
+};
+
+// Acceleration structure built for a mesh with has_accel set
+enum class AccelType {
+    BVH,
+    Grid
+};
+
+// How a BVH is built, from the best trees to the fastest builds
+enum class BVHBuildType {
+    // Full sweep SAH over sorted centroids, serial
+    Sweep,
+    // SAH over centroid bins, top levels binned and subtrees built in parallel
+    Binned,
+    // Splits at the Morton code bits of the centroids (LBVH), for fast rebuilds
+    LBVH
+};
+
+// How HypoxRayTracer traces the paths of a tile
+enum class IntegratorType {
+    // One path at a time, depth first
+    Path,
+    // All paths of the tile together, stage by stage
+    Wavefront
+};
+
+// Where HypoxRayTracer gets the indirect light of a diffuse hit
+enum class IndirectType {
+    // Continue the path by sampling the BSDF
+    Path,
+    // Look it up in a photon map traced before the render, ending the path
+    PhotonMap
+};
+
+// How HypoxRayTracer spends its samples
+enum class RenderMode {
+    // spp * spp samples in every pixel
+    Final,
+    // Passes of spp * spp samples, only into pixels that are still noisy
+    Progressive
+};
+
+// How an Image stores its pixels
+enum class PixelFormat {
+    // 12 bytes, exact
+    Float,
+    // 6 bytes, 11 bit mantissas
+    Half,
+    // 4 bytes, 8 bit mantissas sharing one exponent (Radiance HDR)
+    RGBE
+};
+
+// File format of the rendered image
+enum class ImageFormat {
+    // 8 bit, gamma encoded
+    PNG,
+    // Linear, uncompressed scanline OpenEXR
+    EXR,
+    // Linear 32 bit float portable float map
+    PFM,
+    // 8 bit, gamma encoded binary portable pixmap
+    PPM
+};
+
+// Tile timings written next to the rendered image
+enum class TileTraceOutput {
+    None,
+    // Chrome trace JSON with one event per tile
+    Chrome,
+    // Image of the time spent in each tile
+    Heatmap,
+    Both
+};
+
+// How the scene calls the objects hit by its rays
+enum class DispatchType {
+    // Through the Geometry vtable
+    Virtual,
+    // Switch on the GeometryType tag, each case calling the final class directly
+    Static
+};
+
+// How a shading point picks the light to sample
+enum class LightSamplerType {
+    Uniform,
+    Power,
+    BVH
 };
 
 struct CameraConfig {
@@ -18,6 +107,12 @@ struct CameraConfig {
     float focal_length;
 };
 
+// Camera of one animation frame, frames between two keyframes interpolate them linearly
+struct CameraKeyframe {
+    int frame;
+    CameraConfig camera;
+};
+
 struct LightConfig {
     Vec3f position;
     Vec2f size;
@@ -36,6 +131,34 @@ struct ObjectConfig {
     Vec3f translate;
     float scale;
     int has_accel;
+    AccelType accel_type {AccelType::BVH};
+    BVHBuildType bvh_build {BVHBuildType::Sweep};
+    // Store the mesh BVH with quantized child bounds (CompactWideBVHNode)
+    bool compact_bvh {false};
+    // Cells per axis for AccelType::Grid, 0 picks one from the triangle count
+    int grid_resolution {0};
+    // Directory of the binary mesh cache, empty to always build from the obj file
+    std::string cache_dir;
+};
+
+// Photon map of IndirectType::PhotonMap
+struct PhotonMapConfig {
+    // Paths traced from the lights
+    int photons {200000};
+    // Photons gathered per lookup, within at most radius
+    int neighbors {64};
+    float radius {0.1f};
+};
+
+// Buffers generated by the LightFormerFrontEnd
+struct LightFormerConfig {
+    // VPLs sampled on the lights
+    int direct_vpls {1024};
+    // VPLs traced from each direct VPL to its first bounce
+    int indirect_per_direct {1};
+    // Rays per pixel towards random points of the key light, for the penumbra estimate
+    int shadow_samples {4};
+    std::string output {"lightformer.bin"};
 };
 
 struct Config {
@@ -44,14 +167,46 @@ public:
         loadConfig(config_file_path);
     }
     void loadConfig(std::string config_file_path);
+    // camera_config for a still, else the camera path at `frame`
+    [[nodiscard]] CameraConfig getCameraConfig(int frame) const;
 
     int spp;
     int max_depth;
+    // Bounces traced before Russian roulette may end a path
+    int rr_depth {2};
+    // Render threads, 0 uses the hardware thread count
+    int threads {0};
+    SamplerType sampler_type {SamplerType::Random};
+    // Selects another set of sample sequences, renders with the same seed are identical anywhere
+    uint32_t seed {0};
+    IntegratorType integrator_type {IntegratorType::Path};
+    IndirectType indirect_type {IndirectType::Path};
+    PhotonMapConfig photon_map_config;
+    LightSamplerType light_sampler_type {LightSamplerType::BVH};
+    DispatchType dispatch_type {DispatchType::Static};
+    RenderMode render_mode {RenderMode::Final};
+    // Progressive mode: a pixel is done once the standard error of its luminance drops
+    // below noise_threshold times its mean (0 never stops early), or after max_passes
+    float noise_threshold {0.01f};
+    int max_passes {64};
+    // Progressive mode: seconds before the last pass is cut short, 0 for no limit
+    float time_budget {0};
+    TileTraceOutput tile_trace {TileTraceOutput::None};
+    PixelFormat framebuffer {PixelFormat::Float};
+    ImageFormat output_format {ImageFormat::PNG};
+    // Write every finished tile straight to the output file, for EXR, PFM and PPM
+    bool stream_tiles {false};
     Vec2i image_resolution;
     CameraConfig camera_config;
+    // Animation: frame_count frames along the camera path, sorted by frame (empty for a still)
+    int frame_count {1};
+    std::vector<CameraKeyframe> camera_path;
+    // Equal for configs describing the same scene (objects, materials, lights), so batches can share one
+    std::string scene_key;
     std::vector<LightConfig> lights_config;
     std::vector<MaterialConfig> materials_config;
     std::vector<ObjectConfig> objects_config;
+    LightFormerConfig lightformer_config;
 };
 
 
@@ -6,13 +6,39 @@
 #include "interaction.hpp"
 #include "accel.hpp"
 #include "bsdf.hpp"
+#include "mesh_cache.hpp"
+
+// Concrete type of a Geometry, for the static dispatch of geometry::dispatch
+enum class GeometryType : uint8_t {
+    Triangle,
+    Rectangle,
+    Ellipsoid,
+    Ground,
+    Mesh,
+    Instance,
+    // Subclasses defined elsewhere, always called through their vtable
+    Custom
+};
 
 class Geometry {
 public:
     Geometry(): material(nullptr) {}
+    explicit Geometry(GeometryType type): material(nullptr), geometry_type(type) {}
     virtual ~Geometry() = default;
 
-    virtual bool intersect(const Ray& ray, Interaction& interaction) const = 0;
+    /*
+    Closest-hit query: on a hit with t in [t_min, hit.t) write t, prim_id and the
+    barycentrics to `hit` and return true, otherwise leave `hit` untouched.
+    */
+    virtual bool intersect(const Ray& ray, HitRecord& hit) const = 0;
+    // Build the full interaction for a hit reported by intersect with the same ray
+    virtual void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const = 0;
+    // Any-hit query: is there a hit with t in (t_min, t_max) of the ray
+    virtual bool occluded(const Ray& ray) const {
+        HitRecord hit;
+        hit.t = ray.getTMax();
+        return intersect(ray, hit) && hit.t > ray.getTMin();
+    }
 
     void buildAccel() {
         aabb.Update();
@@ -25,28 +51,32 @@ public:
     AABB getAABB() const {
         return aabb;
     }
+    [[nodiscard]] GeometryType getGeometryType() const { return geometry_type; }
 
-    // Getters and Setters
-    [[nodiscard]] std::shared_ptr<BSDF> getMaterial() const {
+    // Getters and Setters, the material is owned by the scene
+    [[nodiscard]] const BSDF* getMaterial() const {
         return material;
     }
-    void setMaterial(std::shared_ptr<BSDF> mat) {
+    void setMaterial(const BSDF* mat) {
         material = mat;
     }
 
 protected:
-    std::shared_ptr<BSDF> material;
+    const BSDF* material {nullptr};
     AABB aabb;
+    GeometryType geometry_type {GeometryType::Custom};
 };
 
-class Triangle: public Geometry {
+class Triangle final: public Geometry {
 public:
-    Triangle(const Vec3f& v0, const Vec3f& v1, const Vec3f& v2): v0(v0), v1(v1), v2(v2) {
+    Triangle(const Vec3f& v0, const Vec3f& v1, const Vec3f& v2): Geometry(GeometryType::Triangle), v0(v0), v1(v1), v2(v2) {
         normal = (v1 - v0).cross(v2 - v0).normalized();
         aabb = AABB(v0, v1, v2);
     }
 
-    bool intersect(const Ray& ray, Interaction& interaction) const override;
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
+    bool occluded(const Ray& ray) const override;
 
     std::string getType() const override {
         return "Triangle";
@@ -57,14 +87,15 @@ protected:
     Vec3f normal;
 };
 
-class Rectangle: public Geometry {
+class Rectangle final: public Geometry {
 public:
     Rectangle(const Vec3f& position, const Vec2f& size, const Vec3f& normal, const Vec3f& tangent): 
-    position(position), size(size), normal(normal), tangent(tangent) {
+    Geometry(GeometryType::Rectangle), position(position), size(size), normal(normal), tangent(tangent) {
         aabb = AABB(position - Vec3f(size.x()/2, size.y()/2, 0), position + Vec3f(size.x()/2, size.y()/2, 0));
     }
 
-    bool intersect(const Ray& ray, Interaction& interaction) const override;
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
 
     std::string getType() const override {
         return "Rectangle";
@@ -86,32 +117,51 @@ private:
     Vec3f tangent;
 };
 
-class Ellipsoid: public Geometry {
+class Ellipsoid final: public Geometry {
 public:
     // Construct Ellipsoid as a sphere
-    Ellipsoid(const Vec3f& pos): p(pos), a({1, 0, 0}), b({0, 1, 0}), c({0, 0, 1}) {
-        aabb = AABB(pos - Vec3f(1, 1, 1), pos + Vec3f(1, 1, 1));
+    Ellipsoid(const Vec3f& pos): Geometry(GeometryType::Ellipsoid), p(pos), a({1, 0, 0}), b({0, 1, 0}), c({0, 0, 1}) {
+        precompute();
     }
     // Construct Ellipsoid as an ellipsoid
-    Ellipsoid(const Vec3f& pos, const Vec3f& a, const Vec3f& b, const Vec3f& c): p(pos), a(a), b(b), c(c) {
-        aabb = AABB(pos - a - b - c, pos + a + b + c);
+    Ellipsoid(const Vec3f& pos, const Vec3f& a, const Vec3f& b, const Vec3f& c): Geometry(GeometryType::Ellipsoid), p(pos), a(a), b(b), c(c) {
+        precompute();
     }
 
-    bool intersect(const Ray& ray, Interaction& interaction) const override;
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
 
     std::string getType() const override {
         return "Ellipsoid";
     }
 private:
+    // Intersection fast paths, picked from the semi-axes
+    enum class Shape {
+        Sphere,
+        AxisAligned,
+        General
+    };
+    // Cache the world to object transform, the normal matrix and the bounds
+    void precompute();
+
     Vec3f p;
     Vec3f a, b, c;
+
+    Shape shape;
+    // World to unit sphere: x_object = world_to_object * (x_world - p)
+    Mat3f world_to_object;
+    Mat3f normal_matrix;
+    // Per-axis inverse semi-axis lengths for Shape::AxisAligned
+    Vec3f inv_radii;
+    float radius;
 };
 
-class Ground: public Geometry {
+class Ground final: public Geometry {
 public:
-    Ground(float z): z(z) { }
+    Ground(float z): Geometry(GeometryType::Ground), z(z) { }
 
-    bool intersect(const Ray& ray, Interaction& interaction) const override;
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
 
     std::string getType() const override {
         return "Ground";
@@ -120,40 +170,198 @@ protected:
     float z;
 };
 
-class Mesh: public Geometry {
+/*
+Triangles of a mesh in build order as separate, cache-line aligned arrays:
+the first vertex, both edges and the three normal indices. Edges are
+precomputed so the intersection kernel reads each triangle without gathering
+through the index buffers. The arrays live in two blocks, one of floats and
+one of ints, either owned or mapped from a mesh cache file.
+*/
+struct TriangleSoA {
+    enum FloatArray { V0X, V0Y, V0Z, E1X, E1Y, E1Z, E2X, E2Y, E2Z, FLOAT_ARRAY_COUNT };
+    enum IntArray { N0, N1, N2, INT_ARRAY_COUNT };
+
+    // Floats between two arrays of the float block: padded, so that SIMD kernels may load a
+    // full vector past the last triangle, and rounded up so every array starts on a cache line
+    static size_t getStride(size_t n) {
+        constexpr size_t line = utils::CACHE_LINE_SIZE / sizeof(float);
+        return (n + simd::PADDING + line - 1) / line * line;
+    }
+    static size_t getFloatCount(size_t n) { return FLOAT_ARRAY_COUNT * getStride(n); }
+    static size_t getIntCount(size_t n) { return INT_ARRAY_COUNT * n; }
+
+    void resize(size_t n) {
+        count = n;
+        external_floats = nullptr;
+        external_ints = nullptr;
+        float_block.assign(getFloatCount(n), 0.0f);
+        int_block.assign(getIntCount(n), 0);
+    }
+    // Use blocks stored elsewhere (laid out like the owned ones), they must outlive the arrays
+    void setExternal(size_t n, const float* floats, const int* ints) {
+        count = n;
+        float_block.clear();
+        int_block.clear();
+        external_floats = floats;
+        external_ints = ints;
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] bool empty() const { return count == 0; }
+    [[nodiscard]] const float* getFloats() const { return external_floats ? external_floats : float_block.data(); }
+    [[nodiscard]] const int* getInts() const { return external_ints ? external_ints : int_block.data(); }
+    [[nodiscard]] const float* get(FloatArray array) const { return getFloats() + array * getStride(count); }
+    [[nodiscard]] const int* get(IntArray array) const { return getInts() + array * count; }
+    // Writable arrays of the owned blocks
+    [[nodiscard]] float* getOwned(FloatArray array) { return float_block.data() + array * getStride(count); }
+    [[nodiscard]] int* getOwned(IntArray array) { return int_block.data() + array * count; }
+
+    [[nodiscard]] simd::TriangleArrays getArrays() const {
+        return { { get(V0X), get(V0Y), get(V0Z) }, { get(E1X), get(E1Y), get(E1Z) }, { get(E2X), get(E2Y), get(E2Z) } };
+    }
+
+private:
+    size_t count {0};
+    utils::AlignedVector<float> float_block;
+    utils::AlignedVector<int> int_block;
+    const float* external_floats {nullptr};
+    const int* external_ints {nullptr};
+};
+
+class Mesh final: public Geometry {
 public:
-    Mesh() = default;
+    Mesh(): Geometry(GeometryType::Mesh) {}
     Mesh(
-        const std::vector<Vec3f>& vertices,
-        const std::vector<Vec3f>& normals,
-        const std::vector<int>& v_indices,
-        const std::vector<int>& n_indices
-    ): vertices(vertices), normals(normals), 
-    v_indices(v_indices), n_indices(n_indices),
+        std::vector<Vec3f> vertices,
+        std::vector<Vec3f> normals,
+        std::vector<int> v_indices,
+        std::vector<int> n_indices
+    ): Geometry(GeometryType::Mesh), vertices(std::move(vertices)), normals(std::move(normals)),
+    v_indices(std::move(v_indices)), n_indices(std::move(n_indices)),
     has_accel(0) {
         aabb = AABB(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
-        for (size_t i = 0; i < v_indices.size(); i += 3) {
-            Vec3f v0 = vertices[v_indices[i]];
-            Vec3f v1 = vertices[v_indices[i+1]];
-            Vec3f v2 = vertices[v_indices[i+2]];
+        for (size_t i = 0; i < this->v_indices.size(); i += 3) {
+            Vec3f v0 = this->vertices[this->v_indices[i]];
+            Vec3f v1 = this->vertices[this->v_indices[i+1]];
+            Vec3f v2 = this->vertices[this->v_indices[i+2]];
             aabb.merge_with(AABB(v0, v1, v2));
         }
+        buildTriangles();
     }
-    Mesh(const ObjectConfig& object_config);
+    /*
+    `load_threads` parse the obj file when it is not cached, `build_threads` run
+    the binned and LBVH builders; 0 uses the hardware thread count.
+    */
+    Mesh(const ObjectConfig& object_config, int load_threads = 1, int build_threads = 1);
     
-    bool intersect(const Ray& ray, Interaction& interaction) const override;
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
+    bool occluded(const Ray& ray) const override;
 
-    void loadObj(const std::string& path);
+    void loadObj(const std::string& path, int threads = 1);
+    // Also updates the triangle data and acceleration structure once they exist, refitting a BVH
     void transformObj(Vec3f translation, float scale);
+    // Build the triangle BVH (binary, collapsed to a wide BVH) and reorder the triangles into its leaf order
+    void buildBVH();
+    // Recompute the BVH bounds after the vertices moved, keeping its topology
+    void refitBVH();
+    // Bin the triangles into a uniform grid
+    void buildGrid(int resolution = 0);
+
+    [[nodiscard]] int getTriangleCount() const { return static_cast<int>(triangles.size()); }
 
 private:
-    bool intersectTriangle(const Ray& ray, Interaction& interaction, const Vec3i& v_index, const Vec3i& n_index) const; 
+    /*
+    Map the mesh cache file at `path`: triangles, normals and BVH nodes are
+    used in place. False if it is missing or was written for another key.
+    */
+    bool loadCache(const std::string& path, uint64_t key);
+    void saveCache(const std::string& path, uint64_t key) const;
+    // Copy the build data out of the mapped cache, so the mesh can be changed and rebuilt
+    void loadBuildData();
+    [[nodiscard]] utils::Span<const Vec3f> getNormals() const {
+        return cache ? cached_normals : utils::Span<const Vec3f>(normals);
+    }
+
+    void updateAABB();
+    // Build the acceleration structure selected by has_accel / accel_type, then the SoA triangles
+    void buildTriangleAccel();
+    // Fill the SoA triangles from the index buffers, in their current order
+    void buildTriangles();
+    // Moller Trumbore against triangle `triangle_id`, accepting t in [t_min, t_max)
+    bool intersectTriangle(const Ray& ray, int triangle_id, float t_max, float& t, float& u, float& v) const;
+
     std::vector<Vec3f> vertices;
     std::vector<Vec3f> normals;
     std::vector<int> v_indices;
     std::vector<int> n_indices;
+    TriangleSoA triangles;
+    // Mapped cache file the mesh was loaded from, the build data above is empty then
+    std::shared_ptr<MappedFile> cache;
+    utils::Span<const Vec3f> cached_normals;
 
-    int has_accel;
+    int has_accel {0};
+    AccelType accel_type {AccelType::BVH};
+    int grid_resolution {0};
+    BVHBuildType bvh_build {BVHBuildType::Sweep};
+    bool compact_bvh {false};
+    int build_threads {1};
+    WideBVH bvh;
+    OccupancyGrid grid;
 };
 
+/*
+Instance: a shared geometry (usually a Mesh acting as bottom level structure)
+placed in the world by an affine transform. Rays are moved into object space,
+so any number of instances reuse the same vertex data and BVH. The prototype
+is not owned, it must outlive the instance (both live in the scene arena).
+*/
+class Instance final: public Geometry {
+public:
+    Instance(const Geometry* prototype, const Mat4f& object_to_world);
+    // Placement used by ObjectConfig: scale first, then translate
+    Instance(const Geometry* prototype, const Vec3f& translation, float scale);
+
+    // Hits carry the prototype's prim_id and barycentrics, t is the same in both spaces
+    bool intersect(const Ray& ray, HitRecord& hit) const override;
+    void fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const override;
+    bool occluded(const Ray& ray) const override;
+
+    std::string getType() const override {
+        return "Instance";
+    }
+
+    [[nodiscard]] const Geometry* getPrototype() const { return prototype; }
+    [[nodiscard]] Mat4f getTransform() const { return object_to_world; }
+    // Move the instance, the scene then needs refitAccel
+    void setTransform(const Mat4f& transform);
+private:
+    [[nodiscard]] Ray toObjectSpace(const Ray& ray) const;
+
+    const Geometry* prototype;
+    Mat4f object_to_world;
+    Mat4f world_to_object;
+    Mat3f normal_matrix;
+};
+
+namespace geometry {
+/*
+Call `func` with the geometry cast to its concrete type. The concrete types
+are final, so the calls `func` makes on it are resolved at compile time and
+can be inlined; Custom geometry is passed as a Geometry and stays virtual.
+*/
+template <typename Func>
+decltype(auto) dispatch(const Geometry& geometry, Func&& func) {
+    switch (geometry.getGeometryType()) {
+        case GeometryType::Triangle: return func(static_cast<const Triangle&>(geometry));
+        case GeometryType::Rectangle: return func(static_cast<const Rectangle&>(geometry));
+        case GeometryType::Ellipsoid: return func(static_cast<const Ellipsoid&>(geometry));
+        case GeometryType::Ground: return func(static_cast<const Ground&>(geometry));
+        case GeometryType::Mesh: return func(static_cast<const Mesh&>(geometry));
+        case GeometryType::Instance: return func(static_cast<const Instance&>(geometry));
+        default: return func(geometry);
+    }
+}
+}
+
 #endif // GEOMETRY_HPP_
\ No newline at end of file
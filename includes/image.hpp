@@ -2,20 +2,102 @@
 #define IMAGE_HPP_
 
 #include "utils.hpp"
+#include "configs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
 #include <vector>
 
-class Image {
-public:
-    Image(): resolution(800, 800){
-        data.resize(resolution.x() * resolution.y());
+// Conversions between linear colors and the stored and written pixel encodings
+namespace pixel {
+    // IEEE half, rounded to nearest even, overflowing to infinity
+    inline uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+        uint16_t half;
+        if (bits >= 0x47800000u) {
+            // Too large, infinity or NaN
+            half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+        } else if (bits < 0x38800000u) {
+            // Subnormal or zero: the float addition rounds the mantissa into place
+            float magic, sum;
+            uint32_t magic_bits = 126u << 23, sum_bits;
+            std::memcpy(&magic, &magic_bits, sizeof(magic));
+            std::memcpy(&sum, &bits, sizeof(sum));
+            sum += magic;
+            std::memcpy(&sum_bits, &sum, sizeof(sum_bits));
+            half = static_cast<uint16_t>(sum_bits - magic_bits);
+        } else {
+            uint32_t odd = (bits >> 13) & 1;
+            bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + odd;
+            half = static_cast<uint16_t>(bits >> 13);
+        }
+        return static_cast<uint16_t>(half | (sign >> 16));
     }
-    Image(int w_h): resolution(w_h, w_h) {
-        data.resize(resolution.x() * resolution.y());
+
+    inline float halfToFloat(uint16_t half) {
+        uint32_t bits = static_cast<uint32_t>(half & 0x7fff) << 13;
+        uint32_t exponent = bits & (0x7c00u << 13);
+        bits += static_cast<uint32_t>(127 - 15) << 23;
+        float value;
+        if (exponent == (0x7c00u << 13)) {
+            // Infinity or NaN
+            bits += static_cast<uint32_t>(128 - 16) << 23;
+            std::memcpy(&value, &bits, sizeof(value));
+        } else if (exponent == 0) {
+            // Subnormal, renormalized by subtracting the implicit bit
+            bits += 1u << 23;
+            std::memcpy(&value, &bits, sizeof(value));
+            value -= 6.10351562e-05f;
+        } else {
+            std::memcpy(&value, &bits, sizeof(value));
+        }
+        return (half & 0x8000) ? -value : value;
+    }
+
+    // Red, green and blue mantissas in the low bytes, the shared exponent + 128 in the high one
+    inline uint32_t encodeRGBE(const Vec3f& color) {
+        float max = std::max(color.maxCoeff(), 0.0f);
+        if (!(max >= 1e-32f)) {
+            return 0;
+        }
+        int exponent;
+        float scale = std::frexp(max, &exponent) * 256.0f / max;
+        auto mantissa = [&](float c) { return static_cast<uint32_t>(std::max(c, 0.0f) * scale); };
+        return mantissa(color.x()) | (mantissa(color.y()) << 8) | (mantissa(color.z()) << 16) |
+            (static_cast<uint32_t>(exponent + 128) << 24);
     }
-    Image(int weight, int height): resolution(weight, height) {
-        data.resize(resolution.x() * resolution.y());
+
+    inline Vec3f decodeRGBE(uint32_t rgbe) {
+        if ((rgbe >> 24) == 0) {
+            return Vec3f(0, 0, 0);
+        }
+        float scale = std::ldexp(1.0f, static_cast<int>(rgbe >> 24) - (128 + 8));
+        return Vec3f(
+            (static_cast<float>(rgbe & 0xff) + 0.5f) * scale,
+            (static_cast<float>((rgbe >> 8) & 0xff) + 0.5f) * scale,
+            (static_cast<float>((rgbe >> 16) & 0xff) + 0.5f) * scale
+        );
     }
 
+    // Same result as utils::gammaCorrection from a lookup table, without powf
+    uint8_t encodeGamma(float radiance);
+}
+
+// Format the extension of `filename` names, PNG for unknown extensions
+ImageFormat getImageFormat(const std::string& filename);
+const char* getExtension(ImageFormat format);
+
+class Image {
+public:
+    Image(): Image(800, 800) {}
+    Image(int w_h): Image(w_h, w_h) {}
+    Image(int weight, int height, PixelFormat format = PixelFormat::Float);
+
     [[nodiscard]] float getAspectRatio() const {
         return static_cast<float>(resolution.x()) / static_cast<float>(resolution.y());
     }
@@ -23,19 +105,162 @@ public:
         return resolution;
     }
     
+    [[nodiscard]] PixelFormat getFormat() const {
+        return format;
+    }
+    // Bytes of pixel storage
+    [[nodiscard]] size_t getMemorySize() const;
+
     Vec3f getPixel(int x, int y) const {
-        return data[x + y * resolution.x()];
+        int i = x + y * resolution.x();
+        switch (format) {
+        case PixelFormat::Half:
+            return Vec3f(pixel::halfToFloat(half_data[3 * i]), pixel::halfToFloat(half_data[3 * i + 1]), pixel::halfToFloat(half_data[3 * i + 2]));
+        case PixelFormat::RGBE:
+            return pixel::decodeRGBE(rgbe_data[i]);
+        default:
+            return data[i];
+        }
     }
     void setPixel(int x, int y, const Vec3f& color) {
-        data[x + y * resolution.x()] = color;
+        int i = x + y * resolution.x();
+        switch (format) {
+        case PixelFormat::Half:
+            for (int k = 0; k < 3; k++) half_data[3 * i + k] = pixel::floatToHalf(color[k]);
+            break;
+        case PixelFormat::RGBE:
+            rgbe_data[i] = pixel::encodeRGBE(color);
+            break;
+        default:
+            data[i] = color;
+        }
     }
 
     void showImage();
-    void writeImage(const std::string& filename);
+    /*
+    Write the image in the format the extension of `filename` names (.png,
+    .exr, .pfm or .ppm), converting rows on `threads` threads (0 uses the
+    hardware thread count). Row 0 is the bottom of the written image.
+    */
+    void writeImage(const std::string& filename, int threads = 0) const;
 private:
+    // Only the vector of the pixel format is allocated
     std::vector<Vec3f> data;
+    std::vector<uint16_t> half_data;
+    std::vector<uint32_t> rgbe_data;
     Vec2i resolution;
+    PixelFormat format;
+};
+
+/*
+Output file of the uncompressed formats (EXR, PFM, PPM), whose rows all have
+the same size at fixed offsets. open() lays the whole file out, then regions
+can be written in any order from any thread, so finished tiles can go to
+disk as soon as they are rendered instead of through a full 8 bit copy.
+*/
+class RasterFile {
+public:
+    RasterFile() = default;
+    ~RasterFile() { close(); }
+    RasterFile(const RasterFile&) = delete;
+    RasterFile& operator=(const RasterFile&) = delete;
+
+    // False if the format is PNG, which has no fixed layout, or the file cannot be created. EXR stores halves if `half` is set
+    bool open(const std::string& path, ImageFormat format, const Vec2i& resolution, bool half = false);
+    [[nodiscard]] bool isOpen() const { return file.is_open(); }
+    /*
+    Write the pixels of [x0, x1) x [y0, y1), `pixels` holding its rows one
+    after the other with y = 0 at the bottom, as in Image. Encoding runs on
+    the calling thread, only the file writes are serialized.
+    */
+    void writeRegion(int x0, int y0, int x1, int y1, const Vec3f* pixels);
+    void close();
+
+private:
+    // Offset of pixel (x, y), of its blue channel for EXR
+    [[nodiscard]] size_t getOffset(int x, int y) const;
+
+    std::mutex mutex;
+    std::fstream file;
+    ImageFormat format {ImageFormat::PPM};
+    Vec2i resolution {0, 0};
+    bool half {false};
+    size_t header_size {0};
 };
 
+/*
+Float framebuffer the renderer accumulates samples into: the running sum of
+each pixel plus Welford estimates of the mean and variance of its luminance,
+so progressive rendering can tell which pixels are still noisy. develop()
+writes the averages into an Image. Without `track_variance` the luminance
+estimates are not kept, and every pixel counts as unconverged.
+*/
+class Film {
+public:
+    Film(const Vec2i& resolution, bool track_variance = true): resolution(resolution) {
+        pixels.resize(resolution.x() * resolution.y());
+        if (track_variance) {
+            variances.resize(pixels.size());
+        }
+    }
+
+    [[nodiscard]] Vec2i getResolution() const {
+        return resolution;
+    }
+
+    void addSample(int x, int y, const Vec3f& color);
+
+    [[nodiscard]] int getSampleCount(int x, int y) const {
+        return pixels[x + y * resolution.x()].count;
+    }
+    // Mean of the samples of the pixel, black before the first one
+    [[nodiscard]] Vec3f getColor(int x, int y) const {
+        const Pixel& pixel = pixels[x + y * resolution.x()];
+        return pixel.count > 0 ? Vec3f(pixel.sum / static_cast<float>(pixel.count)) : Vec3f(0, 0, 0);
+    }
+    // Standard error of the mean luminance of the pixel, divided by that mean
+    [[nodiscard]] float getRelativeError(int x, int y) const;
+    [[nodiscard]] bool isConverged(int x, int y, float threshold) const {
+        return getRelativeError(x, y) <= threshold;
+    }
+
+    void develop(Image& image) const;
+    void clear();
+
+    /*
+    Store the sample sums and counts of rows [y0, y1), for films rendered by
+    other processes; written to a temporary file unique to the writer and
+    renamed, so readers never see a partial one, even with several processes
+    writing the same path. False on failure.
+    */
+    bool writeRows(const std::string& path, int y0, int y1) const;
+    // Add the samples stored by writeRows, false unless the file matches the resolution
+    bool mergeRows(const std::string& path);
+
+    // Means darker than this are compared against it, so black pixels do not need infinite samples
+    static constexpr float MIN_LUMINANCE = 1e-2f;
+
+private:
+    struct Pixel {
+        Vec3f sum {0, 0, 0};
+        int count {0};
+    };
+    // Luminance mean and sum of squared deviations
+    struct Variance {
+        float mean {0};
+        float m2 {0};
+    };
+    // Header of the files of writeRows, followed by the pixels of its rows
+    struct RowsHeader {
+        char magic[8];
+        int32_t width, height;
+        int32_t y0, y1;
+    };
+    static constexpr char ROWS_MAGIC[8] = { 'H', 'Y', 'P', 'X', 'F', 'I', 'L', 'M' };
+
+    std::vector<Pixel> pixels;
+    std::vector<Variance> variances;
+    Vec2i resolution;
+};
 
 #endif // IMAGE_HPP_
\ No newline at end of file
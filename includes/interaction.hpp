@@ -22,12 +22,27 @@ struct Interaction {
     Vec3f position {0., 0., 0.};
     Vec3f normal {0., 0., 0.};
     InterType type {InterType::NONE};
-    Vec2f uv;
-    std::shared_ptr<BSDF> material;
+    Vec2f uv {0., 0.};
+    // Owned by the geometry, which outlives every interaction
+    const BSDF* material {nullptr};
     Vec3f w_i {0., 0., 0.};
     Vec3f w_o {0., 0., 0.};
+    // Scene light that was hit, for InterType::LIGHT
+    int light_id {-1};
+};
 
-    MaterialModel matmodel;
+/*
+What traversal keeps per candidate hit. The Interaction is only built once,
+from the closest HitRecord, by Geometry::fillInteraction.
+*/
+struct HitRecord {
+    float t {1e8};
+    // Primitive inside the geometry (e.g. triangle), -1 if the geometry has none
+    int prim_id {-1};
+    // Object in the scene, -1 for no hit
+    int geom_id {-1};
+    // Barycentrics of the hit primitive
+    float u {0}, v {0};
 };
 
 
@@ -0,0 +1,125 @@
+#ifndef KDTREE_HPP_
+#define KDTREE_HPP_
+
+#include "utils.hpp"
+#include <algorithm>
+
+/*
+Balanced kd-tree over elements with a `position`, stored implicitly: build
+reorders the elements so the node of a range [begin, end) is its median
+(begin + end) / 2, split on axes[median], with the two halves as its
+subtrees. There are no child pointers, and the elements themselves are the
+nodes, so a query walks one contiguous array.
+*/
+template <typename T>
+class KDTree {
+public:
+    struct Neighbor {
+        int index;
+        // Squared distance to the query point
+        float distance2;
+    };
+
+    KDTree() = default;
+    explicit KDTree(std::vector<T> elements): nodes(std::move(elements)), axes(nodes.size()) {
+        build(0, static_cast<int>(nodes.size()));
+    }
+
+    /*
+    The k elements closest to `point` within `radius`, unordered; returns the
+    squared distance of the farthest one, or radius^2 when fewer were found.
+    */
+    float findNearest(const Vec3f& point, int k, float radius, std::vector<Neighbor>& neighbors) const {
+        neighbors.clear();
+        float max_distance2 = radius * radius;
+        findNearest(0, static_cast<int>(nodes.size()), point, k, max_distance2, neighbors);
+        return max_distance2;
+    }
+
+    // Call func(element) for every element within `radius` of `point`
+    template <typename Func>
+    void forEachInRadius(const Vec3f& point, float radius, Func&& func) const {
+        forEachInRadius(0, static_cast<int>(nodes.size()), point, radius * radius, func);
+    }
+
+    [[nodiscard]] const T& operator[](int index) const { return nodes[index]; }
+    [[nodiscard]] size_t size() const { return nodes.size(); }
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+
+private:
+    void build(int begin, int end) {
+        if (end - begin <= 1) return;
+        // Split the widest extent of the range at its median
+        Vec3f lower = nodes[begin].position, upper = lower;
+        for (int i = begin + 1; i < end; i++) {
+            lower = lower.cwiseMin(nodes[i].position);
+            upper = upper.cwiseMax(nodes[i].position);
+        }
+        int axis;
+        (upper - lower).maxCoeff(&axis);
+        int mid = (begin + end) / 2;
+        std::nth_element(nodes.begin() + begin, nodes.begin() + mid, nodes.begin() + end, [axis](const T& a, const T& b) {
+            return a.position[axis] < b.position[axis];
+        });
+        axes[mid] = static_cast<uint8_t>(axis);
+        build(begin, mid);
+        build(mid + 1, end);
+    }
+
+    void findNearest(int begin, int end, const Vec3f& point, int k, float& max_distance2, std::vector<Neighbor>& neighbors) const {
+        if (begin >= end) return;
+        int mid = (begin + end) / 2;
+        float offset = point[axes[mid]] - nodes[mid].position[axes[mid]];
+        // The half holding the point first, so the other is mostly culled
+        if (offset < 0) {
+            findNearest(begin, mid, point, k, max_distance2, neighbors);
+        } else {
+            findNearest(mid + 1, end, point, k, max_distance2, neighbors);
+        }
+
+        // Max-heap on the distance, its top is replaced once k neighbors are found
+        auto farther = [](const Neighbor& a, const Neighbor& b) { return a.distance2 < b.distance2; };
+        float distance2 = (nodes[mid].position - point).squaredNorm();
+        if (distance2 < max_distance2) {
+            if (static_cast<int>(neighbors.size()) == k) {
+                std::pop_heap(neighbors.begin(), neighbors.end(), farther);
+                neighbors.pop_back();
+            }
+            neighbors.push_back({mid, distance2});
+            std::push_heap(neighbors.begin(), neighbors.end(), farther);
+            if (static_cast<int>(neighbors.size()) == k) {
+                max_distance2 = neighbors.front().distance2;
+            }
+        }
+
+        if (offset * offset < max_distance2) {
+            if (offset < 0) {
+                findNearest(mid + 1, end, point, k, max_distance2, neighbors);
+            } else {
+                findNearest(begin, mid, point, k, max_distance2, neighbors);
+            }
+        }
+    }
+
+    template <typename Func>
+    void forEachInRadius(int begin, int end, const Vec3f& point, float radius2, Func& func) const {
+        if (begin >= end) return;
+        int mid = (begin + end) / 2;
+        float offset = point[axes[mid]] - nodes[mid].position[axes[mid]];
+        if ((nodes[mid].position - point).squaredNorm() < radius2) {
+            func(nodes[mid]);
+        }
+        if (offset < 0 || offset * offset < radius2) {
+            forEachInRadius(begin, mid, point, radius2, func);
+        }
+        if (offset >= 0 || offset * offset < radius2) {
+            forEachInRadius(mid + 1, end, point, radius2, func);
+        }
+    }
+
+    std::vector<T> nodes;
+    // Split axis of every node
+    std::vector<uint8_t> axes;
+};
+
+#endif // KDTREE_HPP_
@@ -4,6 +4,7 @@
 #include "utils.hpp"
 #include "camera.hpp"
 #include "interaction.hpp"
+#include "accel.hpp"
 
 struct VPL {
     VPL(const Vec3f& position, const Vec3f& color, float pdf): position(position), color(color), pdf(pdf) {}
@@ -12,21 +13,51 @@ struct VPL {
     VPL(const Vec3f& position, float pdf): position(position), color(Vec3f(1, 1, 1)), pdf(pdf) {}
     Vec3f position;
     Vec3f color;
+    // Area density of the position
     float pdf;
+    // Surface normal of the light at the position, zero if it has none
+    Vec3f normal {0, 0, 0};
 };
 
 typedef std::vector<VPL> VPLs;
 
+/*
+Where a light (or a cluster of lights) is and where it can emit to, used by
+LightSampler to estimate how much it contributes to a shading point. Emission
+leaves within theta_o + theta_e of `axis`: theta_o bounds the normals,
+theta_e the spread around each normal.
+*/
+struct LightBounds {
+    AABB aabb;
+    Vec3f axis {0, 0, 1};
+    float cos_theta_o {1};
+    float cos_theta_e {0};
+    float power {0};
+
+    static LightBounds merge(const LightBounds& a, const LightBounds& b);
+};
+
+// Concrete type of a Light, for the static dispatch of light::dispatch
+enum class LightType : uint8_t {
+    SquareArea,
+    // Subclasses defined elsewhere, always called through their vtable
+    Custom
+};
+
 class Light {
 public:
     Light(const Vec3f& position, const Vec3f& color): position(position), radiance(color) {}
     Light(const LightConfig& light_config): position(light_config.position), radiance(Vec3f(1, 1, 1)) {}
+    Light(LightType type, const Vec3f& position, const Vec3f& color): position(position), radiance(color), type(type) {}
     virtual ~Light() = default;
 
     [[nodiscard]] virtual Vec3f emmision(const Vec3f& pos, const Vec3f& dir) const = 0;
 
     [[nodiscard]] virtual VPL getVPL(Interaction& interaction, RandomSampler& sampler) const = 0;
     virtual float getPDF(const Interaction& interaction) const = 0;
+    // Total emitted power, the weight used when picking lights
+    [[nodiscard]] virtual float getPower() const = 0;
+    [[nodiscard]] virtual LightBounds getBounds() const = 0;
 
 
     virtual bool intersect(const Ray& ray, Interaction& interaction) const = 0;
@@ -36,12 +67,14 @@ public:
     void setPosition(const Vec3f& pos) { position = pos; }
     [[nodiscard]] Vec3f getColor() const { return radiance; }
     void setColor(const Vec3f& c) { radiance = c; }
+    [[nodiscard]] LightType getType() const { return type; }
 protected:
     Vec3f position;
     Vec3f radiance;
+    LightType type {LightType::Custom};
 };
 
-class SquareAreaLight: public Light {
+class SquareAreaLight final: public Light {
 public:
     SquareAreaLight(
         const Vec3f& position,
@@ -49,10 +82,10 @@ public:
         const Vec2f& size,
         const Vec3f& normal,
         const Vec3f& tangent
-    ): Light(position, color), normal(normal), size(size), tangent(tangent) {}
+    ): Light(LightType::SquareArea, position, color), normal(normal), size(size), tangent(tangent) {}
 
     SquareAreaLight(const LightConfig& light_config):
-        Light(light_config.position, light_config.radiance) {
+        Light(LightType::SquareArea, light_config.position, light_config.radiance) {
         size = light_config.size;
         // TODO (Be Modified in future)
         normal = Vec3f(0, -1, 0);
@@ -62,6 +95,8 @@ public:
     [[nodiscard]] virtual Vec3f emmision(const Vec3f& pos, const Vec3f& dir) const override;
     [[nodiscard]] virtual VPL getVPL(Interaction& interaction,  RandomSampler& sampler) const override;
     virtual float getPDF(const Interaction& interaction) const override;
+    [[nodiscard]] float getPower() const override;
+    [[nodiscard]] LightBounds getBounds() const override;
     
     bool intersect(const Ray& ray, Interaction& interaction) const override;
 
@@ -72,4 +107,24 @@ protected:
 
 };
 
+namespace light {
+// Call `func` with the light cast to its concrete (final) type, Custom lights stay virtual
+template <typename Func>
+decltype(auto) dispatch(const Light& light, Func&& func) {
+    switch (light.getType()) {
+        case LightType::SquareArea: return func(static_cast<const SquareAreaLight&>(light));
+        default: return func(light);
+    }
+}
+
+/*
+Photon leaving `origin`, a point getVPL sampled on `light`: writes a cosine
+distributed direction and returns the power carried along it, emmision() *
+cos over the area and direction densities. Divide by the pmf of the light
+and the photon count to split the light's flux over the photons. Zero for
+points without a normal.
+*/
+Vec3f samplePhoton(const Light& light, const VPL& origin, RandomSampler& sampler, Vec3f& direction);
+}
+
 #endif // LIGHT_HPP_
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef LIGHT_SAMPLER_HPP_
+#define LIGHT_SAMPLER_HPP_
+
+#include "light.hpp"
+
+// Samples indices in proportion to fixed weights in O(1) (Walker / Vose alias method)
+class AliasTable {
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<float>& weights);
+
+    // Index for u in [0, 1), and its probability
+    int sample(float u, float* pmf = nullptr) const;
+    [[nodiscard]] float getPMF(int index) const { return bins[index].pmf; }
+    [[nodiscard]] size_t size() const { return bins.size(); }
+    [[nodiscard]] bool empty() const { return bins.empty(); }
+
+private:
+    struct Bin {
+        // Probability of keeping the bin's own index instead of its alias
+        float q {0};
+        float pmf {0};
+        int alias {-1};
+    };
+    std::vector<Bin> bins;
+};
+
+struct SampledLight {
+    // -1 when no light can reach the shading point
+    int light {-1};
+    float pmf {0};
+};
+
+/*
+Picks the light to sample for a shading point:
+- Uniform: every light equally likely
+- Power: in proportion to emitted power, through an alias table
+- BVH: descends a hierarchy of LightBounds, choosing each child in proportion
+  to its estimated importance for the point, so far away or back facing
+  clusters are rarely picked and a pick costs O(log n)
+*/
+class LightSampler {
+public:
+    LightSampler() = default;
+
+    void build(const std::vector<std::shared_ptr<Light>>& lights, LightSamplerType type);
+
+    [[nodiscard]] SampledLight sample(const Vec3f& position, const Vec3f& normal, float u) const;
+    // Probability that sample(position, normal, ...) returns `light`
+    [[nodiscard]] float getPMF(const Vec3f& position, const Vec3f& normal, int light) const;
+
+    [[nodiscard]] LightSamplerType getType() const { return type; }
+
+private:
+    // LightBounds with what the importance estimate needs precomputed
+    struct LightBVHNode {
+        LightBVHNode() = default;
+        LightBVHNode(const LightBounds& bounds, int offset, bool is_leaf);
+        // Conservative contribution estimate for a point with unit normal n (PBRT v4 style)
+        [[nodiscard]] float importance(const Vec3f& p, const Vec3f& n) const;
+
+        Vec3f center {0, 0, 0};
+        Vec3f axis {0, 0, 1};
+        float radius_squared {0};
+        // Distances below this are clamped, keeping points inside the bounds finite
+        float min_distance_squared {0};
+        float cos_theta_o {1}, sin_theta_o {0};
+        float cos_theta_e {0};
+        float power {0};
+        // Interior: the second child (the first follows the node), leaf: the light
+        int offset {0};
+        bool is_leaf {true};
+    };
+    // Returns the merged bounds of the subtree
+    LightBounds buildRecursive(std::vector<std::pair<int, LightBounds>>& lights, int begin, int end, uint64_t trail, int depth);
+
+    LightSamplerType type {LightSamplerType::BVH};
+    int light_count {0};
+    AliasTable power_table;
+    std::vector<LightBVHNode> nodes;
+    // Per light, the branches from the root to its leaf: bit d set = second child at depth d
+    std::vector<uint64_t> light_trails;
+};
+
+#endif // LIGHT_SAMPLER_HPP_
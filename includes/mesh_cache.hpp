@@ -0,0 +1,97 @@
+#ifndef MESH_CACHE_HPP_
+#define MESH_CACHE_HPP_
+
+#include "utils.hpp"
+#include "configs.hpp"
+#include <string>
+#include <memory>
+
+/*
+Read-only view of a whole file, memory mapped so pages are loaded on first
+use and never copied. POSIX only, like the mkstemp temp files the cache
+and Film::writeRows write.
+*/
+class MappedFile {
+public:
+    // nullptr if the file cannot be opened
+    static std::shared_ptr<MappedFile> open(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] const uint8_t* data() const { return ptr; }
+    [[nodiscard]] size_t size() const { return length; }
+private:
+    MappedFile() = default;
+
+    const uint8_t* ptr {nullptr};
+    size_t length {0};
+};
+
+/*
+Binary cache of a built Mesh: a Header followed by sections aligned to cache
+lines, in the layout the mesh uses at render time, so a mapped file is used
+in place. Files live in the configured cache directory and are named after
+a key hashing the obj file contents and the ObjectConfig settings.
+*/
+namespace mesh_cache {
+    // Bump whenever the layout of a section or of what it stores changes
+    constexpr uint32_t VERSION = 2;
+
+    enum Section {
+        // TriangleSoA float and int blocks
+        TriangleFloats,
+        TriangleInts,
+        Normals,
+        // Build data (leaf ordered), only read to change a cached mesh
+        Vertices,
+        VertexIndices,
+        // WideBVH nodes in the full or the compact format, at most one is not empty
+        BVHNodes,
+        CompactBVHNodes,
+        SECTION_COUNT
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        // sizeof of the nodes, which depends on simd::BOX_WIDTH
+        uint32_t node_size;
+        uint32_t compact_node_size;
+        uint64_t key;
+        uint64_t triangle_count;
+        float aabb_min[3];
+        float aabb_max[3];
+        // Byte offset from the start of the file and byte size of every section
+        uint64_t offsets[SECTION_COUNT];
+        uint64_t sizes[SECTION_COUNT];
+    };
+
+    // 0 if the obj file cannot be read
+    uint64_t computeKey(const ObjectConfig& config);
+    std::string getPath(const std::string& cache_dir, const std::string& obj_path, uint64_t key);
+
+    // Write the header (offsets and sizes are filled in) and the sections, false on failure
+    bool write(const std::string& path, Header header, const utils::Span<const uint8_t>* sections);
+    // Map a cache file, nullptr unless it is complete and was written for `key`
+    std::shared_ptr<MappedFile> open(const std::string& path, uint64_t key);
+
+    [[nodiscard]] inline const Header& getHeader(const MappedFile& file) {
+        return *reinterpret_cast<const Header*>(file.data());
+    }
+    template <typename T>
+    [[nodiscard]] utils::Span<const T> getSection(const MappedFile& file, Section section) {
+        const Header& header = getHeader(file);
+        return { reinterpret_cast<const T*>(file.data() + header.offsets[section]), header.sizes[section] / sizeof(T) };
+    }
+    template <typename T, typename Allocator>
+    [[nodiscard]] utils::Span<const uint8_t> asBytes(const std::vector<T, Allocator>& vector) {
+        return { reinterpret_cast<const uint8_t*>(vector.data()), vector.size() * sizeof(T) };
+    }
+    template <typename T>
+    [[nodiscard]] utils::Span<const uint8_t> asBytes(const T* data, size_t count) {
+        return { reinterpret_cast<const uint8_t*>(data), count * sizeof(T) };
+    }
+}
+
+#endif // MESH_CACHE_HPP_
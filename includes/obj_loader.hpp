@@ -0,0 +1,31 @@
+#ifndef OBJ_LOADER_HPP_
+#define OBJ_LOADER_HPP_
+
+#include "utils.hpp"
+#include <string>
+#include <vector>
+
+/*
+Wavefront OBJ reader for the geometry HypoxRayTracer uses: `v`, `vn` and `f`
+records, with polygons split into triangle fans, negative (relative)
+indices resolved and `#` comments skipped, at the end of records too. The mapped file is cut into chunks at line boundaries; a
+first parallel pass counts the records of every chunk, so the second one
+parses each chunk straight into its place in exactly sized arrays.
+*/
+namespace obj_loader {
+    struct ObjData {
+        std::vector<Vec3f> vertices;
+        std::vector<Vec3f> normals;
+        // Three per triangle, normal indices are -1 for faces without normals
+        std::vector<int> v_indices;
+        std::vector<int> n_indices;
+    };
+
+    // Bytes per parse task, smaller files are read by one thread
+    constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    // Parse the file with up to `threads` threads (0 uses the hardware thread count), false with `error` set on failure
+    bool load(const std::string& path, ObjData& data, int threads, std::string& error);
+}
+
+#endif // OBJ_LOADER_HPP_
@@ -0,0 +1,46 @@
+#ifndef PHOTON_MAP_HPP_
+#define PHOTON_MAP_HPP_
+
+#include "scene.hpp"
+#include "kdtree.hpp"
+
+struct Photon {
+    Vec3f position;
+    // Flux carried to the position
+    Vec3f power;
+    // Towards where the photon came from
+    Vec3f direction;
+};
+
+/*
+Indirect light of the scene as photons: paths traced from the lights, with
+a photon stored at every non-delta hit after the first, so the map holds
+only light that has bounced at least once and adds to explicit light
+sampling without counting direct light twice. estimate() is the density
+estimate of the reflected radiance from the nearest photons.
+
+Each photon path draws from its own RandomSampler stream and is traced in
+chunks whose photons are concatenated in order, so the map only depends on
+the seed and not on the thread count.
+*/
+class PhotonMap {
+public:
+    PhotonMap() = default;
+
+    // Trace config.photons paths of at most max_depth bounces, Russian roulette after rr_depth
+    void build(Scene& scene, const PhotonMapConfig& config, int max_depth, int rr_depth, int threads, SamplerType sampler_type, uint32_t seed);
+    void clear() { tree = KDTree<Photon>(); }
+
+    // Radiance reflected towards interaction.w_o; the normal must face w_o
+    [[nodiscard]] Vec3f estimate(const Interaction& interaction) const;
+
+    [[nodiscard]] size_t size() const { return tree.size(); }
+    [[nodiscard]] bool empty() const { return tree.empty(); }
+
+private:
+    KDTree<Photon> tree;
+    int neighbors {64};
+    float radius {0.1f};
+};
+
+#endif // PHOTON_MAP_HPP_
@@ -0,0 +1,63 @@
+#ifndef RENDER_FARM_HPP_
+#define RENDER_FARM_HPP_
+
+#include "image.hpp"
+#include <string>
+
+/*
+Distributed rendering through a job directory on a filesystem every node
+shares. The coordinator writes job.json: the config path, how the frame is
+sharded into work items and the sampler seed. Workers on any node load the
+scene once, then claim items by creating claims/<item> (directory creation
+is atomic, so each item has one owner), render them and store their partial
+films in films/<item>.film. Fast nodes simply claim more items. Once every
+item is claimed, idle workers take over items whose owner has not delivered
+within straggler_seconds, by claiming claims/<item>.backup<n>; a backup that
+is late in turn, straggler_seconds after its own claim, is backed up by the
+next one. Samples depend only on the seed, the pixel and the
+sample index, so such a duplicate film is identical to the late one. The
+coordinator merges the films in item order, so the image does not depend on
+which node rendered what.
+*/
+namespace render_farm {
+    enum class ShardMode {
+        // Items are strips of tile rows, each rendering all the passes
+        Tiles,
+        // Items are passes of the whole frame, spp * spp samples each
+        Samples
+    };
+
+    struct Job {
+        std::string config_path;
+        ShardMode shard {ShardMode::Tiles};
+        // Tile rows per item in ShardMode::Tiles
+        int rows_per_item {4};
+        // Passes of spp * spp samples per pixel over the frame
+        int passes {1};
+        uint32_t seed {0};
+        // Seconds before an unfinished item is rendered again by an idle worker
+        float straggler_seconds {60};
+
+        // Items are numbered strip-major: item = strip * passes + pass
+        [[nodiscard]] int getStripCount(int tile_rows) const;
+        [[nodiscard]] int getItemCount(int tile_rows) const { return getStripCount(tile_rows) * passes; }
+    };
+
+    // Create the job directory and its job.json, false on failure or if the directory holds claims or films
+    bool submit(const std::string& job_dir, const Job& job);
+    bool readJob(const std::string& job_dir, Job& job);
+    /*
+    Claim and render items until none is left to claim, on `threads` render
+    threads (0 for the hardware thread count). Returns the number of items
+    this worker rendered, -1 if the job or its config cannot be read.
+    */
+    int work(const std::string& job_dir, int threads = 0);
+    /*
+    Wait for the films of every item, polling, and merge them into `film`,
+    which must have the config resolution. Gives up after timeout_seconds
+    (0 waits forever) and returns false then, or if a film is unreadable.
+    */
+    bool merge(const std::string& job_dir, Film& film, float timeout_seconds = 0);
+}
+
+#endif // RENDER_FARM_HPP_
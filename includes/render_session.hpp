@@ -0,0 +1,60 @@
+#ifndef RENDER_SESSION_HPP_
+#define RENDER_SESSION_HPP_
+
+#include "HypoxRayTracer.hpp"
+
+/*
+Interactive rendering of one scene: the meshes, their acceleration
+structures and the accumulated film stay alive between renders. Edits go
+through the session, which notes what they invalidate. The next render
+refits the top level BVH after objects moved, rebuilds only the light
+structures after light edits, retraces a photon map after anything but a
+camera edit, and restarts the progressive accumulation after any edit.
+Nothing is reloaded. Edits must not overlap a render.
+*/
+class RenderSession {
+public:
+    explicit RenderSession(const Config& config);
+
+    /*
+    Add up to `passes` progressive passes to the accumulation and develop it
+    into getImage(). Returns the passes rendered, 0 once every pixel converged.
+    */
+    int render(int passes = 1);
+    // Drop the accumulated samples, the next render starts again from pass 0
+    void restart();
+
+    void setCameraPosition(const Vec3f& position);
+    void lookAt(const Vec3f& look_at, const Vec3f& ref_up = Vec3f(0, 1, 0));
+    void setFov(float fov);
+
+    // By the name in the config, false if there is no such material
+    bool setMaterialColor(const std::string& name, const Vec3f& color);
+    void setMaterialColor(MaterialID material, const Vec3f& color);
+
+    void setLightPosition(int light_id, const Vec3f& position);
+    void setLightRadiance(int light_id, const Vec3f& radiance);
+
+    // Place an Instance object, false for objects of other types
+    bool setObjectTransform(ObjectID object, const Mat4f& transform);
+
+    [[nodiscard]] std::shared_ptr<Image> getImage() const { return image; }
+    [[nodiscard]] const Camera& getCamera() const { return *camera; }
+    [[nodiscard]] const Scene& getScene() const { return *scene; }
+    [[nodiscard]] HypoxRayTracer& getRayTracer() { return tracer; }
+    // Passes accumulated since the last edit
+    [[nodiscard]] int getPassCount() const { return pass_count; }
+
+private:
+    std::shared_ptr<Image> image;
+    std::shared_ptr<Camera> camera;
+    std::shared_ptr<Scene> scene;
+    HypoxRayTracer tracer;
+    Film film;
+    int pass_count {0};
+    // Applied by the next render
+    bool objects_moved {false};
+    bool lights_changed {false};
+};
+
+#endif // RENDER_SESSION_HPP_
@@ -4,7 +4,19 @@
 #include "geometry.hpp"
 #include "light.hpp"
 #include "accel.hpp"
+#include "light_sampler.hpp"
+#include "arena.hpp"
+#include <map>
 
+// Handles of the objects and materials of a scene, indices into its tables
+using ObjectID = uint32_t;
+using MaterialID = uint32_t;
+
+/*
+Objects, their prototypes and the materials are constructed in the scene's
+arena, next to each other in creation order, and referenced by plain
+pointers and 32 bit handles; they are all destroyed with the scene.
+*/
 class Scene{
 public:
     Scene() = default;
@@ -12,39 +24,103 @@ public:
     virtual ~Scene() = default;
 
     bool intersect(const Ray& ray, Interaction& interaction);
-    bool isShadowed(const Ray& ray) {
-        Interaction interaction;
-        return (
-            intersect(ray, interaction) && 
-            interaction.type != Interaction::InterType::LIGHT
-        );
-    };
-
-    void addObject(std::shared_ptr<Geometry> object) {
-        objects.push_back(object);
+    /*
+    Closest hits of up to BVH::PACKET_SIZE coherent rays (e.g. camera rays of
+    neighbouring pixels), traversing the top level BVH once for the packet;
+    the instances below it are intersected ray by ray. interactions[i] is the
+    hit intersect(rays[i], ...) would find, and bit i of the result is what it
+    would return.
+    */
+    uint64_t intersectPacket(const Ray* rays, int count, Interaction* interactions);
+    /*
+    Occlusion-only query for shadow rays: true if any object is hit with
+    t in (t_min, t_max), so t_max should stop just short of the light sample.
+    Lights never occlude.
+    */
+    bool isShadowed(const Ray& ray) const;
+
+    // Construct a T in the scene, traced once buildAccel ran
+    template <typename T, typename... Args>
+    ObjectID addObject(Args&&... args) {
+        objects.push_back(arena.create<T>(std::forward<Args>(args)...));
+        accel_dirty = true;
+        return static_cast<ObjectID>(objects.size() - 1);
+    }
+    [[nodiscard]] Geometry& getObject(ObjectID id) { return *objects[id]; }
+    // Build the top level BVH over the object bounds and the light structures, call after adding objects or lights
+    void buildAccel();
+    // Update the top level bounds after objects moved (e.g. Instance::setTransform), keeping its topology
+    void refitAccel();
+    [[nodiscard]] const std::vector<Geometry*>& getObjects() const { return objects; }
+
+    template <typename T, typename... Args>
+    MaterialID addMaterial(Args&&... args) {
+        materials.push_back(arena.create<T>(std::forward<Args>(args)...));
+        return static_cast<MaterialID>(materials.size() - 1);
+    }
+    [[nodiscard]] const BSDF* getMaterial(MaterialID id) const { return materials[id]; }
+    // For edits between renders, the scene never changes while one runs
+    [[nodiscard]] BSDF* getMaterial(MaterialID id) { return materials[id]; }
+    [[nodiscard]] int getMaterialCount() const { return static_cast<int>(materials.size()); }
+    // Material the config named `name`, -1 if there is none
+    [[nodiscard]] int findMaterial(const std::string& name) const {
+        auto material = material_names.find(name);
+        return material != material_names.end() ? static_cast<int>(material->second) : -1;
     }
-    [[nodiscard]] std::vector<std::shared_ptr<Geometry>> getObjects() const { return objects; }
+    // Bytes of the arena blocks holding the objects, prototypes and materials
+    [[nodiscard]] size_t getArenaSize() const { return arena.getCapacity(); }
 
 
-    // Naive Version
-    [[nodiscard]] std::shared_ptr<Light> getLight() const { return light; }
-    void setLight(std::shared_ptr<Light> l) { light = l; }
+    void addLight(std::shared_ptr<Light> light) {
+        lights.push_back(light);
+        accel_dirty = true;
+    }
+    [[nodiscard]] const std::vector<std::shared_ptr<Light>>& getLights() const { return lights; }
+    [[nodiscard]] const Light& getLight(int light_id) const { return *lights[light_id]; }
+    // Lights edited through it need buildLightAccel before the next render
+    [[nodiscard]] Light& getLight(int light_id) { return *lights[light_id]; }
+    // Rebuild only the light structures, after lights were added, moved or recolored
+    void buildLightAccel();
+    // Chooses the light sampled at each shading point, rebuilt by buildAccel
+    [[nodiscard]] const LightSampler& getLightSampler() const { return light_sampler; }
+    void setLightSamplerType(LightSamplerType type) {
+        light_sampler_type = type;
+        accel_dirty = true;
+    }
+    [[nodiscard]] DispatchType getDispatchType() const { return dispatch_type; }
+    void setDispatchType(DispatchType type) { dispatch_type = type; }
     [[nodiscard]] Vec3f getAmbientLight() const { return ambient_light; }
     void setAmbientLight(const Vec3f& al) { ambient_light = al; }
-    // Many Light Method
-    //[[nodiscard]] std::vector<std::shared_ptr<Light>> getLights() const { return lights; }
-    // void addLight(std::shared_ptr<Light> light) {
-    //     lights.push_back(light);
-    // }
 
 private:
-    std::vector<std::shared_ptr<Geometry>> objects;
-    // Naive Version
-    std::shared_ptr<Light> light;
-    Vec3f ambient_light;
-    // Many Light Method
-    //std::vector<std::shared_ptr<Light>> lights;
+    // Start a closest-hit query: the light hit if any, otherwise a miss at t_max
+    void intersectLight(const Ray& ray, Interaction& itra) const;
+    // Call `func` with object `object_id`, as its concrete type in DispatchType::Static
+    template <typename Func>
+    decltype(auto) visitObject(int object_id, Func&& func) const {
+        const Geometry& object = *objects[object_id];
+        if (dispatch_type == DispatchType::Static) {
+            return geometry::dispatch(object, func);
+        }
+        return func(object);
+    }
 
+    // Declared first so that it outlives every pointer into it
+    Arena arena;
+    std::vector<Geometry*> objects;
+    std::vector<BSDF*> materials;
+    std::map<std::string, MaterialID> material_names;
+    // Top level acceleration structure, falls back to a linear loop while dirty
+    BVH tlas;
+    bool accel_dirty {true};
+    DispatchType dispatch_type {DispatchType::Static};
+
+    std::vector<std::shared_ptr<Light>> lights;
+    // Bounds hierarchy over the lights for ray hits
+    BVH light_accel;
+    LightSampler light_sampler;
+    LightSamplerType light_sampler_type {LightSamplerType::BVH};
+    Vec3f ambient_light;
 };
 
 #endif // SCENE_HPP_
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_HPP_
+#define SCHEDULER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+Work-stealing scheduler for a fixed set of tasks [0, count). Every thread
+starts with a contiguous block of task ids and takes them from the front;
+once its block is empty it steals the back half of another thread's block.
+Blocks are packed (begin, end) pairs updated with a single CAS, so neither
+taking nor stealing a task needs a lock.
+*/
+class TaskScheduler {
+public:
+    using TaskFunc = std::function<void(int task, int thread)>;
+
+    // 0 uses the hardware thread count
+    explicit TaskScheduler(int num_threads = 0);
+
+    // Run func(task, thread) for every task in [0, count) and wait for all of them
+    void parallelFor(int count, const TaskFunc& func);
+
+    [[nodiscard]] int getThreadCount() const { return num_threads; }
+
+private:
+    // Task block of one thread, on its own cache line
+    struct alignas(64) TaskRange {
+        std::atomic<uint64_t> range {0};
+    };
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return (static_cast<uint64_t>(begin) << 32) | end; }
+    static uint32_t rangeBegin(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+    static uint32_t rangeEnd(uint64_t range) { return static_cast<uint32_t>(range); }
+
+    void workerLoop(int thread, const TaskFunc& func);
+    // Take the next task of `thread`'s own block, -1 once it is empty
+    int popTask(int thread);
+    // Move half of another thread's block to `thread`, false once every block is empty
+    bool stealTasks(int thread);
+
+    int num_threads;
+    std::vector<TaskRange> ranges;
+};
+
+/*
+Lock-free progress report: workers add finished work with an atomic
+increment, and at most one of them prints per interval.
+*/
+class ProgressReporter {
+public:
+    ProgressReporter(const char* label, int total, int interval_ms = 100);
+
+    void advance(int amount = 1);
+    // Print 100% and end the line
+    void finish();
+
+private:
+    void print(int done) const;
+
+    const char* label;
+    int total;
+    int64_t interval_ns;
+    std::atomic<int> done {0};
+    std::atomic<int64_t> last_report_ns {0};
+};
+
+#endif // SCHEDULER_HPP_
@@ -0,0 +1,104 @@
+#ifndef SIMD_HPP_
+#define SIMD_HPP_
+
+#include "utils.hpp"
+
+/*
+Vectorized ray kernels. Each kernel has a scalar version and, when the
+target supports it, SSE4.1 / AVX2 (x86) or NEON (AArch64) versions. The
+widest one the CPU supports is picked once at startup; setting the
+environment variable HYPOX_SIMD to "scalar", "sse", "avx2" or "neon"
+forces a narrower one.
+*/
+namespace simd {
+
+    enum class ISA {
+        Scalar,
+        SSE,
+        AVX2,
+        NEON
+    };
+
+    // Children per wide BVH node, tested together by intersectBoxes
+    constexpr int BOX_WIDTH = 8;
+    // Extra elements at the end of kernel inputs, so full-width loads never leave the allocation
+    constexpr int PADDING = 8;
+
+    // Ray with the values the kernels need precomputed
+    struct RayData {
+        RayData(const Vec3f& origin, const Vec3f& direction, float t_min) {
+            for (int i = 0; i < 3; i++) {
+                o[i] = origin[i];
+                d[i] = direction[i];
+                // Avoid inf * 0 = NaN for axis parallel rays
+                float di = std::abs(direction[i]) < 1e-20f ? std::copysign(1e-20f, direction[i]) : direction[i];
+                inv_d[i] = 1.0f / di;
+            }
+            this->t_min = t_min;
+        }
+        float o[3];
+        float d[3];
+        float inv_d[3];
+        float t_min;
+    };
+
+    // Triangles as SoA arrays (first vertex and both edges), padded by PADDING
+    struct TriangleArrays {
+        const float* v0[3];
+        const float* e1[3];
+        const float* e2[3];
+    };
+
+    /*
+    Closest hit among the triangles [first, first + count) with t in [t_min, t_max).
+    Returns the triangle index (and shrinks t_max, writes u, v) or -1.
+    */
+    using IntersectTrianglesFunc = int (*)(
+        const TriangleArrays& triangles, int first, int count, const RayData& ray, float& t_max, float& u, float& v
+    );
+    // Any hit among the triangles [first, first + count) with t in [t_min, t_max)
+    using OccludedTrianglesFunc = bool (*)(
+        const TriangleArrays& triangles, int first, int count, const RayData& ray, float t_max
+    );
+    /*
+    Slab test against BOX_WIDTH boxes stored as bounds[axis][child] for the minimum
+    (axis 0-2) and maximum (axis 3-5) corners. Empty slots use min = +inf, max = -inf.
+    Returns the bit mask of hit children and their entry distances.
+    */
+    using IntersectBoxesFunc = int (*)(
+        const float (*bounds)[BOX_WIDTH], const RayData& ray, float t_max, float* t_near
+    );
+
+    /*
+    BOX_WIDTH boxes with 8 bit planes on a per axis grid, plane = origin[axis] +
+    planes[axis][child] * step[axis] in the layout of the float bounds. Only the
+    children with their bit set in `valid` exist.
+    */
+    struct QuantizedBoxes {
+        const uint8_t (*planes)[BOX_WIDTH];
+        float origin[3];
+        float step[3];
+        int valid;
+    };
+    // Slab test of intersectBoxes against quantized boxes, evaluated on the grid without decoding the planes
+    using IntersectQuantizedBoxesFunc = int (*)(
+        const QuantizedBoxes& boxes, const RayData& ray, float t_max, float* t_near
+    );
+
+    struct Kernels {
+        ISA isa;
+        IntersectTrianglesFunc intersectTriangles;
+        OccludedTrianglesFunc occludedTriangles;
+        IntersectBoxesFunc intersectBoxes;
+        IntersectQuantizedBoxesFunc intersectQuantizedBoxes;
+    };
+
+    // Kernels for the widest supported ISA, detected on first use
+    const Kernels& getKernels();
+    const Kernels& getKernels(ISA isa);
+    bool isSupported(ISA isa);
+    const char* getName(ISA isa);
+
+}
+
+#endif // SIMD_HPP_
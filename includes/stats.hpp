@@ -0,0 +1,90 @@
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <chrono>
+#include <cstdint>
+
+/*
+Render statistics, compiled in when HYPOX_STATS is defined (the benchmark
+target) and reduced to empty inline functions otherwise. Every thread counts
+into its own cache line aligned block, so counting never contends; blocks are
+summed by collect() and folded into the totals when their thread exits.
+*/
+namespace stats {
+    enum Counter {
+        PrimaryRays,
+        BounceRays,
+        ShadowRays,
+        // Nodes whose children were box tested, in every BVH level
+        NodeTests,
+        TriangleTests,
+        // Calls of the hot paths, Scene::isShadowed being counted by ShadowRays
+        SceneIntersects,
+        MeshIntersects,
+        MeshOcclusionTests,
+        BSDFSamples,
+        BSDFEvaluations,
+        LightSamples,
+        // Nanoseconds reading meshes and building their acceleration structures, summed over threads
+        LoadTime,
+        BuildTime,
+        COUNTER_COUNT
+    };
+
+    struct Counters {
+        uint64_t values[COUNTER_COUNT] {};
+
+        uint64_t operator[](Counter counter) const { return values[counter]; }
+    };
+
+#ifdef HYPOX_STATS
+    constexpr bool ENABLED = true;
+
+    // Counters of one thread, trivial so that reaching them needs no initialization check
+    struct alignas(64) ThreadCounters {
+        uint64_t values[COUNTER_COUNT];
+        bool registered;
+    };
+    inline thread_local ThreadCounters thread_counters {};
+
+    // Make collect() see the counters of the calling thread until it exits
+    void registerThread();
+
+    inline void add(Counter counter, uint64_t n = 1) {
+        if (!thread_counters.registered) registerThread();
+        thread_counters.values[counter] += n;
+    }
+#else
+    constexpr bool ENABLED = false;
+
+    inline void add(Counter counter, uint64_t n = 1) {}
+#endif
+
+    // Totals over all threads, exact once the counting threads are idle
+    Counters collect();
+    // Zero every counter, while no thread is counting
+    void reset();
+    const char* getName(Counter counter);
+    // One line per counter, times in milliseconds
+    void print(const Counters& counters);
+
+    // Adds its lifetime in nanoseconds to a time counter
+    class ScopedTimer {
+    public:
+#ifdef HYPOX_STATS
+        explicit ScopedTimer(Counter counter): counter(counter), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            add(counter, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start
+            ).count()));
+        }
+    private:
+        Counter counter;
+        std::chrono::steady_clock::time_point start;
+#else
+        explicit ScopedTimer(Counter counter) {}
+#endif
+    };
+}
+
+#endif // STATS_HPP_
@@ -0,0 +1,64 @@
+#ifndef TILE_TRACE_HPP_
+#define TILE_TRACE_HPP_
+
+#include "configs.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*
+Timeline of the tiles of a render: when each tile started and finished, on
+which scheduler thread and in which pass. Every thread appends to its own
+event list, so recording takes no lock. The timeline is written as a Chrome
+trace (chrome://tracing, Perfetto), where the gaps between the tiles of a
+thread show scheduler stalls, or as a heatmap with the time spent in each
+tile, laid out like the rendered image.
+*/
+class TileTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        int tile;
+        int pass;
+        // Nanoseconds since start()
+        int64_t begin_ns;
+        int64_t end_ns;
+    };
+
+    // Drop the previous events and take the time base of a new render
+    void start(int threads, const Vec2i& resolution, int tile_size);
+    void record(int thread, int tile, int pass, Clock::time_point begin, Clock::time_point end) {
+        thread_events[thread].events.push_back({ tile, pass, nanosecondsSince(begin), nanosecondsSince(end) });
+    }
+
+    [[nodiscard]] bool empty() const;
+
+    bool writeChromeTrace(const std::string& path) const;
+    bool writeHeatmap(const std::string& path) const;
+    /*
+    Write the outputs `output` selects next to the image at `image_path`:
+    output.png gets output_trace.json and output_heatmap.png. Prints the
+    tile time spread and the slowest tile.
+    */
+    void write(const std::string& image_path, TileTraceOutput output) const;
+
+private:
+    // Events of one thread, on its own cache line
+    struct alignas(64) ThreadEvents {
+        std::vector<Event> events;
+    };
+
+    [[nodiscard]] int64_t nanosecondsSince(Clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count();
+    }
+    // Render time of each tile, summed over the passes
+    [[nodiscard]] std::vector<int64_t> getTileTimes() const;
+
+    std::vector<ThreadEvents> thread_events;
+    Clock::time_point epoch;
+    Vec2i resolution {0, 0};
+    int tile_size {1};
+};
+
+#endif // TILE_TRACE_HPP_
@@ -2,6 +2,12 @@
 #define UTILS_HPP_
 
 #include <memory>
+#include <vector>
+#include <array>
+#include <type_traits>
+#include <algorithm>
+#include <new>
+#include <cstddef>
 
 
 #ifdef DEBUG
@@ -77,27 +83,227 @@ namespace utils {
 		return max(max(a, b), c);
 	}
 
+	// Multiple importance sampling weight of a sample with pdf f against another strategy with pdf g
+	static inline float powerHeuristic(float f, float g) {
+		if (std::isinf(f * f)) return 1;
+		float f2 = f * f, g2 = g * g;
+		return f2 + g2 > 0 ? f2 / (f2 + g2) : 0;
+	}
+
+	// Allocator for std::vector whose storage starts on an `Alignment` boundary
+	template <typename T, size_t Alignment>
+	struct AlignedAllocator {
+		using value_type = T;
+		template <typename U>
+		struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+		AlignedAllocator() = default;
+		template <typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+		T* allocate(size_t n) {
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+		}
+		void deallocate(T* p, size_t) {
+			::operator delete(p, std::align_val_t(Alignment));
+		}
+		template <typename U>
+		bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+		template <typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+	};
+
+	constexpr size_t CACHE_LINE_SIZE = 64;
+	template <typename T>
+	using AlignedVector = std::vector<T, AlignedAllocator<T, CACHE_LINE_SIZE>>;
+
+	// Non-owning view of contiguous elements (std::span is C++20)
+	template <typename T>
+	class Span {
+	public:
+		constexpr Span() = default;
+		constexpr Span(T* data, size_t size): ptr(data), count(size) {}
+		template <size_t N>
+		constexpr Span(const std::array<std::remove_const_t<T>, N>& array): ptr(array.data()), count(N) {}
+		Span(const std::vector<std::remove_const_t<T>>& vector): ptr(vector.data()), count(vector.size()) {}
+
+		[[nodiscard]] constexpr T* data() const { return ptr; }
+		[[nodiscard]] constexpr size_t size() const { return count; }
+		[[nodiscard]] constexpr bool empty() const { return count == 0; }
+		constexpr T& operator[](size_t i) const { return ptr[i]; }
+		constexpr T* begin() const { return ptr; }
+		constexpr T* end() const { return ptr + count; }
+	private:
+		T* ptr {nullptr};
+		size_t count {0};
+	};
+
+	// Taylor series, for angles known at compile time (|x| <= PI)
+	constexpr double constexprSin(double x) {
+		double term = x, sum = x;
+		for (int i = 1; i < 12; i++) {
+			term *= -x * x / ((2 * i) * (2 * i + 1));
+			sum += term;
+		}
+		return sum;
+	}
+	constexpr double constexprCos(double x) {
+		double term = 1, sum = 1;
+		for (int i = 1; i < 12; i++) {
+			term *= -x * x / ((2 * i - 1) * (2 * i));
+			sum += term;
+		}
+		return sum;
+	}
+
 }
 
 // Random Sampler Part
-#include <random>
+#include <cstdint>
+
+// Sequence RandomSampler draws from
+enum class SamplerType {
+	// Independent hashed values
+	Random,
+	// Owen-scrambled Sobol (0, 2) pairs, shuffled per dimension pair
+	Sobol,
+	// Halton with a per-pixel Cranley-Patterson rotation
+	Halton
+};
+
+namespace utils {
+
+	// 64 bit finalizer (splitmix64)
+	static inline uint64_t mixBits(uint64_t v) {
+		v ^= v >> 31;
+		v *= 0x7fb5d329728ea185ull;
+		v ^= v >> 27;
+		v *= 0x81dadef4bc2dd44dull;
+		v ^= v >> 33;
+		return v;
+	}
+	static inline uint64_t hash(uint64_t a, uint64_t b) {
+		return mixBits(a ^ mixBits(b + 0x9e3779b97f4a7c15ull));
+	}
+	static inline uint64_t hash(uint64_t a, uint64_t b, uint64_t c) {
+		return hash(hash(a, b), c);
+	}
+	// Largest float below 1
+	constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+	static inline float toUnitFloat(uint32_t bits) {
+		return std::min(static_cast<float>(bits >> 8) * 0x1p-24f, ONE_MINUS_EPSILON);
+	}
+	static inline uint32_t reverseBits(uint32_t v) {
+		v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+		v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+		v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+		v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+		return (v >> 16) | (v << 16);
+	}
+	/*
+	Owen scrambling of a bit reversed value: hash based nested uniform
+	scramble (Burley 2020, after Laine and Karras).
+	*/
+	static inline uint32_t owenScramble(uint32_t v, uint32_t seed) {
+		v = reverseBits(v);
+		v += seed;
+		v ^= v * 0x6c50b47cu;
+		v ^= v * 0xb82f1e52u;
+		v ^= v * 0xc7afe638u;
+		v ^= v * 0x8d22f6e6u;
+		return reverseBits(v);
+	}
+	// First two Sobol dimensions: van der Corput and the x + 1 polynomial
+	static inline uint32_t sobol(uint32_t index, int dimension) {
+		if (dimension == 0) {
+			return reverseBits(index);
+		}
+		uint32_t result = 0;
+		for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+			if (index & 1) result ^= v;
+		}
+		return result;
+	}
+	static inline float radicalInverse(int base, uint64_t index) {
+		const double inv_base = 1.0 / base;
+		double inv_base_n = 1, result = 0;
+		while (index) {
+			uint64_t next = index / base;
+			result += static_cast<double>(index - next * base) * inv_base_n;
+			inv_base_n *= inv_base;
+			index = next;
+		}
+		return static_cast<float>(result * inv_base);
+	}
+
+}
+
+/*
+Counter based sampler: every value is a pure function of (pixel, sample
+index, dimension), so nothing needs seeding, any thread may render any
+pixel and the image does not depend on the thread count. Call startSample
+before each sample; get1D / get2D then walk the dimensions. 
+*/
 class RandomSampler {
 public:
 	RandomSampler() = default;
-	float get1D() { 
-        return dis(engine); 
-    }
-	Vec2f get2D() { 
-        return { 
-            dis(engine), dis(engine) 
-        }; 
-    }
-	void setSeed(int i) { 
-        engine.seed(i); 
-    }
+	RandomSampler(SamplerType type, uint32_t seed = 0): type(type), seed(seed) {}
+
+	void startSample(uint32_t pixel, uint32_t sample_index) {
+		this->pixel = pixel;
+		this->sample_index = sample_index;
+		dimension = 0;
+	}
+	float get1D() {
+		uint32_t dim = dimension++;
+		if (type == SamplerType::Sobol) {
+			uint64_t h = utils::hash(pixel, dim, seed);
+			uint32_t index = utils::owenScramble(sample_index, static_cast<uint32_t>(h));
+			return utils::toUnitFloat(utils::owenScramble(utils::sobol(index, 0), static_cast<uint32_t>(h >> 32)));
+		}
+		if (type == SamplerType::Halton && dim < HALTON_DIMENSIONS) {
+			return rotate(utils::radicalInverse(HALTON_PRIMES[dim], sample_index), dim);
+		}
+		return utils::toUnitFloat(static_cast<uint32_t>(utils::hash(pixel, sample_index, (static_cast<uint64_t>(seed) << 32) | dim)));
+	}
+	Vec2f get2D() {
+		if (type == SamplerType::Sobol) {
+			// Both values come from the same Sobol point, keeping the pair stratified in 2D
+			uint32_t dim = dimension;
+			dimension += 2;
+			uint64_t h = utils::hash(pixel, dim, seed);
+			uint64_t h2 = utils::mixBits(h);
+			uint32_t index = utils::owenScramble(sample_index, static_cast<uint32_t>(h));
+			return {
+				utils::toUnitFloat(utils::owenScramble(utils::sobol(index, 0), static_cast<uint32_t>(h >> 32))),
+				utils::toUnitFloat(utils::owenScramble(utils::sobol(index, 1), static_cast<uint32_t>(h2)))
+			};
+		}
+		float x = get1D();
+		float y = get1D();
+		return { x, y };
+	}
+	// Start an independent stream: same as startSample(i, 0)
+	void setSeed(int i) {
+		startSample(static_cast<uint32_t>(i), 0);
+	}
+
+	[[nodiscard]] SamplerType getType() const { return type; }
 private:
-	std::default_random_engine engine;
-	std::uniform_real_distribution<float> dis;
+	static constexpr uint32_t HALTON_DIMENSIONS = 16;
+	static constexpr int HALTON_PRIMES[HALTON_DIMENSIONS] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+	float rotate(float value, uint32_t dim) const {
+		float offset = utils::toUnitFloat(static_cast<uint32_t>(utils::hash(pixel, dim, seed)));
+		value += offset;
+		return value >= 1 ? value - 1 : value;
+	}
+
+	SamplerType type {SamplerType::Random};
+	uint32_t seed {0};
+	uint32_t pixel {0};
+	uint32_t sample_index {0};
+	uint32_t dimension {0};
 };
 
 // Declare the class
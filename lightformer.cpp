@@ -1,5 +1,38 @@
 #include <iostream>
+#include <chrono>
 
-int main() {
+#include "LightFormerFrontEnd.hpp"
+
+/*
+    LightFormerFrontEnd [config.json]
+
+Generates the LightFormer inputs of the view in ./configs/small.json, or of
+the given config, and writes them to the "output" of its "lightformer" block.
+*/
+int main(int argc, char** argv) {
     puts("========== LightFormerFrontEnd ==========");
-}
\ No newline at end of file
+    std::string config_path = argc > 1 ? argv[1] : "./configs/small.json";
+    Config config(config_path);
+
+    std::shared_ptr<Image> image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y(), config.framebuffer);
+    std::shared_ptr<Camera> camera = std::make_shared<Camera>(config.getCameraConfig(0), image);
+    std::shared_ptr<Scene> scene = std::make_shared<Scene>(config);
+    puts("==========  Scene  Constructed  ==========");
+
+    LightFormerFrontEnd front_end(camera, scene, config);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t rays = front_end.generate();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    const auto& buffers = front_end.getBuffers();
+    printf("%zu pixels, %zu direct and %zu indirect VPLs in %.2f ms (%.2f Mrays/s).\n",
+        buffers.gbuffer_position.size(), buffers.direct_position.size(), buffers.indirect_position.size(),
+        seconds * 1000, seconds > 0 ? rays / seconds * 1e-6 : 0.0);
+
+    const std::string& output = config.lightformer_config.output;
+    if (!front_end.write(output)) {
+        printf("Failed to write %s\n", output.c_str());
+        return 1;
+    }
+    printf("Buffers written to %s\n", output.c_str());
+}
@@ -1,32 +1,120 @@
 #include <iostream>
 #include <chrono>
+#include <future>
 
 #include "HypoxRayTracer.hpp"
+#include "stats.hpp"
 
-int main() {
+/*
+    HypoxRayTracer [config.json ...]
+
+Renders ./configs/small.json when no config is given. One config without a
+camera path renders output.<ext>; a list of configs, or a config with a
+camera path, is a batch whose frames are numbered output_0000.<ext> on. A
+batch loads a scene once for all consecutive configs describing it, along
+with its photon map, and encodes each frame while the next one renders.
+*/
+int main(int argc, char** argv) {
     puts("==========    HypoxRayTracer    ==========");
-    
-    // Config
-    Config config("./configs/small.json");
-    
-    // Camera
-    std::shared_ptr<Image> image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y());
-    std::shared_ptr<Camera> camera = std::make_shared<Camera>(config.camera_config, image);
+    std::vector<std::string> config_paths(argv + 1, argv + argc);
+    if (config_paths.empty()) {
+        config_paths.push_back("./configs/small.json");
+    }
+
+    std::shared_ptr<Scene> scene;
+    std::string scene_key;
+    // Kept for the frames of one scene, so its photon map is traced once
+    std::unique_ptr<HypoxRayTracer> RayTracer;
+    // Encoding of the previous frame, overlapping the render of the current one
+    std::future<void> pending_write;
+    int frame_index = 0;
+    auto batch_start = std::chrono::steady_clock::now();
+    for (const auto& config_path: config_paths) {
+        // Config
+        Config config(config_path);
+        bool batch = config_paths.size() > 1 || config.frame_count > 1;
+
+        // Scene
+        if (scene == nullptr || config.scene_key != scene_key) {
+            scene = std::make_shared<Scene>(config);
+            scene_key = config.scene_key;
+            RayTracer.reset();
+            puts("==========  Scene  Constructed  ==========");
+        } else if (RayTracer != nullptr) {
+            RayTracer->configure(config);
+        }
+
+        for (int frame = 0; frame < config.frame_count; frame++, frame_index++) {
+            // Camera, with its own image so the previous one can still be written
+            std::shared_ptr<Image> image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y(), config.framebuffer);
+            std::shared_ptr<Camera> camera = std::make_shared<Camera>(config.getCameraConfig(frame), image);
+            puts("==========   Camera Generated   ==========");
 
-    puts("==========   Camera Generated   ==========");
-    // Scene
-    std::shared_ptr<Scene> scene = std::make_shared<Scene>(config);
-    puts("==========  Scene  Constructed  ==========");
-    // Render
-    std::unique_ptr<HypoxRayTracer> RayTracer = std::make_unique<HypoxRayTracer>(camera, scene, config);
-    // Time the rendering process
-    puts("==========  Rendering  Started  ==========");
-    auto start = std::chrono::steady_clock::now();
-    RayTracer->render();
-    auto end = std::chrono::steady_clock::now();
-    printf("Time elapsed: %.2f ms.\n", std::chrono::duration<double, std::milli>(end - start).count());
-    puts("==========  Rendering Finished  ==========");
-    // Save image
-    image->writeImage("output.png");
+            // Render
+            if (RayTracer == nullptr) {
+                RayTracer = std::make_unique<HypoxRayTracer>(camera, scene, config);
+            } else {
+                RayTracer->setCamera(camera);
+            }
+            // The callbacks of the previous frame refer to its output
+            RayTracer->setTileCallback(nullptr);
+            RayTracer->setPassCallback(nullptr);
+            std::string output = "output";
+            if (batch) {
+                char number[16];
+                snprintf(number, sizeof(number), "_%04d", frame_index);
+                output += number;
+            }
+            output += std::string(".") + getExtension(config.output_format);
+            RasterFile stream;
+            if (config.stream_tiles && stream.open(output, config.output_format, config.image_resolution, config.framebuffer == PixelFormat::Half)) {
+                // Finished tiles go straight to the file, which stays current through progressive passes
+                RayTracer->setTileCallback([&](const Film& film, int x0, int y0, int x1, int y1) {
+                    std::vector<Vec3f> pixels;
+                    pixels.reserve((x1 - x0) * (y1 - y0));
+                    for (int y = y0; y < y1; y++) {
+                        for (int x = x0; x < x1; x++) pixels.push_back(film.getColor(x, y));
+                    }
+                    stream.writeRegion(x0, y0, x1, y1, pixels.data());
+                });
+            } else if (config.render_mode == RenderMode::Progressive) {
+                // Keep the output current while the passes refine it
+                RayTracer->setPassCallback([&](int pass) { image->writeImage(output); });
+            }
+            // Time the rendering process
+            puts("==========  Rendering  Started  ==========");
+            auto start = std::chrono::steady_clock::now();
+            RayTracer->render();
+            auto end = std::chrono::steady_clock::now();
+            printf("Time elapsed: %.2f ms.\n", std::chrono::duration<double, std::milli>(end - start).count());
+            puts("==========  Rendering Finished  ==========");
+            // Save image, in the background while the next frame renders
+            if (pending_write.valid()) {
+                pending_write.get();
+            }
+            if (stream.isOpen()) {
+                stream.close();
+            } else {
+                pending_write = std::async(std::launch::async, [image, output]() {
+                    auto start = std::chrono::steady_clock::now();
+                    image->writeImage(output);
+                    auto end = std::chrono::steady_clock::now();
+                    printf("%s written in %.2f ms.\n", output.c_str(), std::chrono::duration<double, std::milli>(end - start).count());
+                });
+            }
+            RayTracer->getTileTrace().write(output, config.tile_trace);
+        }
+    }
+    if (pending_write.valid()) {
+        pending_write.get();
+    }
     puts("==========     Image  Saved     ==========");
-}
\ No newline at end of file
+    if (frame_index > 1) {
+        auto batch_end = std::chrono::steady_clock::now();
+        printf("%d frames in %.2f ms.\n", frame_index, std::chrono::duration<double, std::milli>(batch_end - batch_start).count());
+    }
+    if (stats::ENABLED) {
+        puts("==========  Render  Statistics  ==========");
+        stats::print(stats::collect());
+    }
+}
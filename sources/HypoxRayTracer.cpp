@@ -1,103 +1,495 @@
 #include "HypoxRayTracer.hpp"
 #include <iostream>
 #include <iomanip>
-// OpenMP
-#include <omp.h>
+#include <algorithm>
+#include <chrono>
 #include "bsdf.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+
+bool HypoxRayTracer::sampleDirectLighting(Interaction& interaction, RandomSampler& sampler, Ray& shadow_ray, Vec3f& contribution) const {
+    // A light sample never lies on the single direction a delta BSDF reflects to
+    if (bsdf::isDelta(*interaction.material)) {
+        return false;
+    }
+    stats::add(stats::LightSamples);
+    // Pick one light, weighting its estimate by the probability of the pick
+    SampledLight sampled = scene->getLightSampler().sample(interaction.position, interaction.normal, sampler.get1D());
+    if (sampled.light < 0 || sampled.pmf <= 0) {
+        return false;
+    }
+    const Light& light = scene->getLight(sampled.light);
+
+    auto vpl = light::dispatch(light, [&](const auto& emitter) { return emitter.getVPL(interaction, sampler); });
+    Vec3f pos = vpl.position;
+    float distance = (pos - interaction.position).norm();
+
+    // Shadow Ray, stopping just before the light sample
+    shadow_ray = Ray(interaction.position, (pos - interaction.position).normalized());
+    shadow_ray.setTMax(distance - EPS);
+
+    interaction.w_i = shadow_ray.getDirection();
+    float cos_theta = interaction.normal.dot(interaction.w_i);
+    float cos_light = vpl.normal.isZero() ? 1.0f : vpl.normal.dot(-1 * interaction.w_i);
+    if (cos_theta <= 0 || cos_light <= 0) {
+        return false;
+    }
+    // Area density of the light sample converted to solid angle
+    float light_pdf = sampled.pmf * vpl.pdf * distance * distance / cos_light;
+    // A photon map ends the path here, so no BSDF sampled ray shares the light's direct term
+    float weight = indirect_type == IndirectType::PhotonMap ?
+        1.0f : utils::powerHeuristic(light_pdf, bsdf::getPDF(*interaction.material, interaction));
+
+    stats::add(stats::BSDFEvaluations);
+    Vec3f obj_color = bsdf::evaluate(*interaction.material, interaction),
+        light_color = light::dispatch(light, [&](const auto& emitter) { return emitter.emmision(pos, -1 * interaction.w_i); });
+    contribution = obj_color.cwiseProduct(light_color) * cos_theta * weight / light_pdf;
+    return !contribution.isZero();
+}
 
 Vec3f HypoxRayTracer::evalDirectLighting(const Ray& ray, Interaction& interaction, RandomSampler& sampler) const {
     Vec3f color(0, 0, 0);
     if (interaction.material != nullptr) {
-        auto vpl = scene->getLight()->getVPL(interaction, sampler);
-        Vec3f pos = vpl.position;
-        float pdf = vpl.pdf;
-        float distance = (pos - interaction.position).norm();
-    
-        // Shadow Ray
-        Ray shadow_ray(interaction.position, (pos - interaction.position).normalized());
-        if (scene->isShadowed(shadow_ray) || interaction.material == nullptr) {
-            return color;
-        }
-        else {
-            float cos_theta = interaction.normal.dot(shadow_ray.getDirection());
-            Vec3f obj_color = interaction.material->evaluate(interaction),
-                light_color = scene->getLight()->emmision(pos, -1 * shadow_ray.getDirection());
-            color += obj_color.cwiseProduct(light_color) * cos_theta / (
-                scene->getLight()->getPDF(interaction) * 2 * distance * distance
-            );
+        Ray shadow_ray;
+        Vec3f contribution;
+        if (sampleDirectLighting(interaction, sampler, shadow_ray, contribution) && !scene->isShadowed(shadow_ray)) {
+            color += contribution;
         }
     }
 
     return color;
 }
 
+Vec3f HypoxRayTracer::evalEmission(const Interaction& light_hit, const PathVertex& vertex) const {
+    const Light& light = scene->getLight(light_hit.light_id);
+    Vec3f emission = light::dispatch(light, [&](const auto& emitter) { return emitter.emmision(light_hit.position, light_hit.w_o); });
+    if (vertex.specular) {
+        return emission;
+    }
+    // Density with which sampleDirectLighting would have picked the same point
+    float distance2 = (light_hit.position - vertex.position).squaredNorm();
+    float cos_light = std::abs(light_hit.normal.dot(light_hit.w_o));
+    if (cos_light <= 0) {
+        return Vec3f(0, 0, 0);
+    }
+    float light_pdf = scene->getLightSampler().getPMF(vertex.position, vertex.normal, light_hit.light_id) *
+        light::dispatch(light, [&](const auto& emitter) { return emitter.getPDF(light_hit); }) * distance2 / cos_light;
+    return emission * utils::powerHeuristic(vertex.pdf, light_pdf);
+}
+
+bool HypoxRayTracer::sampleBSDF(Interaction& interaction, RandomSampler& sampler, Vec3f& beta, PathVertex& vertex, Ray& next_ray) const {
+    stats::add(stats::BSDFSamples);
+    float pdf = bsdf::sample(*interaction.material, interaction, sampler);
+    bool delta = bsdf::isDelta(*interaction.material);
+    if (delta) {
+        // Delta BSDFs already return the weight of their direction
+        stats::add(stats::BSDFEvaluations);
+        beta = beta.cwiseProduct(bsdf::evaluate(*interaction.material, interaction));
+    } else {
+        float cos_theta = interaction.normal.dot(interaction.w_i);
+        if (pdf <= 0 || cos_theta <= 0) {
+            return false;
+        }
+        stats::add(stats::BSDFEvaluations);
+        beta = beta.cwiseProduct(bsdf::evaluate(*interaction.material, interaction) * cos_theta / pdf);
+    }
+    if (beta.isZero()) {
+        return false;
+    }
+
+    vertex = { interaction.position, interaction.normal, pdf, delta };
+    next_ray = Ray(interaction.position, interaction.w_i);
+    return true;
+}
+
+bool HypoxRayTracer::russianRoulette(int depth, Vec3f& beta, RandomSampler& sampler) const {
+    if (depth < rr_depth) {
+        return true;
+    }
+    // Survive with a probability following the throughput, and reweight the survivors
+    float survive = std::min(1.0f, beta.maxCoeff());
+    if (sampler.get1D() >= survive) {
+        return false;
+    }
+    beta /= survive;
+    return true;
+}
+
+template <int MAX_DEPTH>
 Vec3f HypoxRayTracer::evalRadiance(const Ray& ray, Interaction& interaction, RandomSampler& sampler) const {
+    const int depth_limit = MAX_DEPTH == DYNAMIC ? max_depth : MAX_DEPTH;
     Vec3f color(0, 0, 0);
     Vec3f beta(1, 1, 1);
+    PathVertex vertex;
 
     Ray ray_for_iteration = std::move(ray);
 
-    for (int i = 0; i < max_depth; i++) {
+    // The ray leaving the last vertex can still hit a light
+    for (int i = 0; i <= depth_limit; i++) {
+        // The first iteration retraces the camera ray, counted by renderTile
+        if (i > 0) stats::add(stats::BounceRays);
         Interaction itra;
         if (!scene->intersect(ray_for_iteration, itra) || itra.type == Interaction::InterType::NONE) {
             break;
         }
         itra.w_o = -1 * ray_for_iteration.getDirection();
         if (itra.type == Interaction::InterType::LIGHT) {
-            if (i == 0) {
-                color += beta.cwiseProduct(scene->getLight()->emmision(itra.position, itra.w_o));
-            }
+            color += beta.cwiseProduct(evalEmission(itra, vertex));
+            break;
+        }
+        if (i == depth_limit || itra.material == nullptr) {
             break;
         }
+        // Shade the side the ray arrives from
+        if (itra.normal.dot(itra.w_o) < 0) {
+            itra.normal = -1 * itra.normal;
+        }
 
         // Direct Lighting
         Vec3f direct_lighting = evalDirectLighting(ray_for_iteration, itra, sampler);
         color += beta.cwiseProduct(direct_lighting);
 
-        // Indirect Lighting
-        float pdf = itra.material->sample(itra, sampler);
-        Ray next_ray(itra.position, itra.w_i);
-        ray_for_iteration = next_ray;
-        beta = beta.cwiseProduct(
-            itra.material->evaluate(itra) * 
-            itra.normal.dot(itra.w_i) * PI / pdf
-        );
+        // Indirect Lighting, from the photon map at the first diffuse hit
+        if (indirect_type == IndirectType::PhotonMap && !bsdf::isDelta(*itra.material)) {
+            color += beta.cwiseProduct(photon_map.estimate(itra));
+            break;
+        }
+        if (!sampleBSDF(itra, sampler, beta, vertex, ray_for_iteration) || !russianRoulette(i, beta, sampler)) {
+            break;
+        }
     }
 
 
     return color;
 }
 
+void HypoxRayTracer::configure(const Config& config) {
+    // Everything PhotonMap::build reads besides the scene and the thread count
+    bool same_photons = indirect_type == config.indirect_type && max_depth == config.max_depth && rr_depth == config.rr_depth
+        && sampler_type == config.sampler_type && seed == config.seed && photon_map_config.photons == config.photon_map_config.photons
+        && photon_map_config.neighbors == config.photon_map_config.neighbors && photon_map_config.radius == config.photon_map_config.radius;
+    if (!same_photons) photon_map_built = false;
+
+    spp = config.spp;
+    max_depth = config.max_depth;
+    rr_depth = config.rr_depth;
+    threads = config.threads;
+    sampler_type = config.sampler_type;
+    seed = config.seed;
+    integrator_type = config.integrator_type;
+    indirect_type = config.indirect_type;
+    photon_map_config = config.photon_map_config;
+    render_mode = config.render_mode;
+    noise_threshold = config.noise_threshold;
+    max_passes = config.max_passes;
+    time_budget = config.time_budget;
+    trace_tiles = config.tile_trace != TileTraceOutput::None;
+    tile_kernel = selectTileKernel(spp, max_depth);
+}
+
 void HypoxRayTracer::render() {
+    // Only progressive rendering looks at the noise estimates
+    Film film(camera->getImage()->getResolution(), render_mode == RenderMode::Progressive);
+    renderPasses(film, 0, render_mode == RenderMode::Final ? 1 : max_passes);
+}
+
+void HypoxRayTracer::preparePhotonMap() {
+    if (indirect_type != IndirectType::PhotonMap || photon_map_built) return;
+    auto start = std::chrono::steady_clock::now();
+    photon_map.build(*scene, photon_map_config, max_depth, rr_depth, threads, sampler_type, seed);
+    photon_map_built = true;
+    if (stats::ENABLED) {
+        auto end = std::chrono::steady_clock::now();
+        printf("Photon map: %zu photons in %.2f ms.\n", photon_map.size(), std::chrono::duration<double, std::milli>(end - start).count());
+    }
+}
+
+int HypoxRayTracer::renderPasses(Film& film, int first_pass, int pass_count) {
+    preparePhotonMap();
+    Vec2i resolution = camera->getImage()->getResolution();
+    int tiles_x = (resolution.x() + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (resolution.y() + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count = tiles_x * tiles_y;
+
+    // Same sub-pixel pattern for every pixel
+    auto sample_pattern = camera->getSamplePattern(spp);
+
+    TaskScheduler scheduler(threads);
+    tile_trace.start(trace_tiles ? scheduler.getThreadCount() : 0, resolution, TILE_SIZE);
+    // Wavefront buffers are reused by all the tiles of a thread
+    std::vector<WavefrontQueues> queues(scheduler.getThreadCount());
+    auto render_tile = [&](int tile, int thread, int pass) {
+        auto tile_start = trace_tiles ? TileTrace::Clock::now() : TileTrace::Clock::time_point();
+        renderTileIndex(tile, sample_pattern, pass, film, queues[thread]);
+        if (tile_callback) {
+            int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+            int x1 = std::min(x0 + TILE_SIZE, resolution.x()), y1 = std::min(y0 + TILE_SIZE, resolution.y());
+            tile_callback(film, x0, y0, x1, y1);
+        }
+        if (trace_tiles) {
+            tile_trace.record(thread, tile, pass, tile_start, TileTrace::Clock::now());
+        }
+    };
+
+    if (render_mode == RenderMode::Final) {
+        ProgressReporter progress("Rendering", tile_count);
+        scheduler.parallelFor(tile_count, [&](int tile, int thread) {
+            render_tile(tile, thread, first_pass);
+            progress.advance();
+        });
+        progress.finish();
+        film.develop(*camera->getImage());
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto out_of_time = [&]() {
+        return time_budget > 0 &&
+            std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() >= time_budget;
+    };
+    // Whether no pixel of the tile is sampled by pass `pass`
+    auto converged = [&](int tile, int pass) {
+        int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, resolution.x()), y1 = std::min(y0 + TILE_SIZE, resolution.y());
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                if (needsSamples(film, x, y, pass)) return false;
+            }
+        }
+        return true;
+    };
+    std::vector<int> active_tiles;
+    for (int tile = 0; tile < tile_count; tile++) {
+        if (first_pass == 0 || !converged(tile, first_pass)) active_tiles.push_back(tile);
+    }
+
+    ProgressReporter progress("Rendering", pass_count);
+    int pass = first_pass;
+    for (; pass < first_pass + pass_count && !active_tiles.empty(); pass++) {
+        // The first pass always completes so every pixel has a value
+        scheduler.parallelFor(static_cast<int>(active_tiles.size()), [&](int i, int thread) {
+            if (pass > 0 && out_of_time()) return;
+            render_tile(active_tiles[i], thread, pass);
+        });
+        film.develop(*camera->getImage());
+        progress.advance();
+        if (pass_callback) pass_callback(pass);
+        if (out_of_time()) {
+            pass++;
+            break;
+        }
+
+        // Keep the tiles with a pixel the next pass still samples
+        active_tiles.erase(std::remove_if(active_tiles.begin(), active_tiles.end(), [&](int tile) {
+            return converged(tile, pass + 1);
+        }), active_tiles.end());
+    }
+    progress.finish();
+    if (stats::ENABLED) printf("Progressive: %d passes, %zu of %d tiles unconverged\n", pass, active_tiles.size(), tile_count);
+    return pass - first_pass;
+}
+
+void HypoxRayTracer::renderTileRows(Film& film, int row0, int row1, int pass) {
+    Vec2i resolution = camera->getImage()->getResolution();
+    int tiles_x = (resolution.x() + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (resolution.y() + TILE_SIZE - 1) / TILE_SIZE;
+    row0 = std::max(row0, 0);
+    row1 = std::min(row1, tiles_y);
+    if (row0 >= row1) return;
+
+    preparePhotonMap();
+    auto sample_pattern = camera->getSamplePattern(spp);
+    TaskScheduler scheduler(threads);
+    std::vector<WavefrontQueues> queues(scheduler.getThreadCount());
+    scheduler.parallelFor((row1 - row0) * tiles_x, [&](int i, int thread) {
+        renderTileIndex(row0 * tiles_x + i, sample_pattern, pass, film, queues[thread]);
+    });
+}
+
+void HypoxRayTracer::renderTileIndex(int tile, Camera::SamplePattern sample_pattern, int pass, Film& film, WavefrontQueues& queues) {
+    Vec2i resolution = camera->getImage()->getResolution();
+    int tiles_x = (resolution.x() + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, resolution.x()), y1 = std::min(y0 + TILE_SIZE, resolution.y());
+    if (integrator_type == IntegratorType::Wavefront) {
+        renderTileWavefront(x0, y0, x1, y1, sample_pattern, pass, film, queues);
+    } else {
+        (this->*tile_kernel)(x0, y0, x1, y1, sample_pattern, pass, film);
+    }
+}
+
+HypoxRayTracer::TileKernel HypoxRayTracer::selectTileKernel(int spp, int max_depth) {
+    // The spp and max_depth of the configs in configs/ and of the default constructor
+    auto with_depth = [max_depth](auto samples) -> TileKernel {
+        constexpr int SAMPLES = decltype(samples)::value;
+        switch (max_depth) {
+            case 3: return &HypoxRayTracer::renderTile<3, SAMPLES>;
+            case 4: return &HypoxRayTracer::renderTile<4, SAMPLES>;
+            case 10: return &HypoxRayTracer::renderTile<10, SAMPLES>;
+            default: return &HypoxRayTracer::renderTile<DYNAMIC, SAMPLES>;
+        }
+    };
+    switch (spp) {
+        case 1: return with_depth(std::integral_constant<int, 1>());
+        case 2: return with_depth(std::integral_constant<int, 4>());
+        case 4: return with_depth(std::integral_constant<int, 16>());
+        default: return &HypoxRayTracer::renderTile<DYNAMIC, DYNAMIC>;
+    }
+}
+
+bool HypoxRayTracer::needsSamples(const Film& film, int x, int y, int pass) const {
+    if (render_mode == RenderMode::Final || pass < MIN_PASSES || noise_threshold <= 0) {
+        return true;
+    }
+    return !film.isConverged(x, y, noise_threshold);
+}
+
+template <int MAX_DEPTH, int SAMPLES>
+void HypoxRayTracer::renderTile(int x0, int y0, int x1, int y1, Camera::SamplePattern sample_pattern, int pass, Film& film) {
     Vec2i resolution = camera->getImage()->getResolution();
-    int cnt = 0;
-    printf("Rendering: %.2f\%", 100.0 * cnt / resolution.x());
-    #pragma omp parallel for  schedule(guided, 2), shared(cnt), num_threads(48)
-    for(int dx = 0; dx < resolution.x(); dx++) {
-        printf("\rRendering: %.2f%%", 100.0 * cnt / resolution.x());
-        std::cout << std::flush;
-        
-        #pragma omp atomic
-        cnt++;
-
-        RandomSampler sampler;
-        for(int dy = 0; dy < resolution.y(); dy++) {
-            Vec3f color(0, 0, 0);
-            sampler.setSeed(omp_get_thread_num());
+    RandomSampler sampler(sampler_type, seed);
+    const int samples = SAMPLES == DYNAMIC ? static_cast<int>(sample_pattern.size()) : SAMPLES;
+    auto first_sample = static_cast<uint32_t>(pass * samples);
+    for (int dy = y0; dy < y1; dy++) {
+        for (int dx = x0; dx < x1; dx++) {
+            if (!needsSamples(film, dx, dy, pass)) continue;
+            auto pixel = static_cast<uint32_t>(dy * resolution.x() + dx);
 
             // Super Sampling
-            auto sample_points = camera->generateSuperSamplingPoint(dx, dy, spp);
-            
-            for (const auto& sample_point: sample_points) {
-                Ray ray = camera->generateRay(sample_point.x(), sample_point.y());
+            for (int i = 0; i < samples; i++) {
+                const auto& offset = sample_pattern[i];
+                // Random numbers depend only on the pixel and sample, not on the thread
+                sampler.startSample(pixel, first_sample + static_cast<uint32_t>(i));
+                Ray ray = camera->generateRay(dx, dy, offset);
+                Vec3f color(0, 0, 0);
                 Interaction interaction;
+                stats::add(stats::PrimaryRays);
                 if (scene->intersect(ray, interaction)) {
-                    color += evalRadiance(ray, interaction, sampler);
+                    color = evalRadiance<MAX_DEPTH>(ray, interaction, sampler);
+                }
+                film.addSample(dx, dy, color);
+            }
+        }
+    }
+}
+
+void HypoxRayTracer::renderTileWavefront(int x0, int y0, int x1, int y1, Camera::SamplePattern sample_pattern, int pass, Film& film, WavefrontQueues& queues) {
+    Vec2i resolution = camera->getImage()->getResolution();
+    auto& pixels = queues.pixels;
+    auto& paths = queues.paths;
+    auto& active = queues.active;
+    auto& next = queues.next;
+    auto& hits = queues.hits;
+    auto& shadow_rays = queues.shadow_rays;
+
+    // Camera rays of the tile, samples of a pixel next to each other so packets stay coherent
+    pixels.clear();
+    paths.clear();
+    active.clear();
+    const auto samples = static_cast<int>(sample_pattern.size());
+    auto first_sample = static_cast<uint32_t>(pass * samples);
+    for (int dy = y0; dy < y1; dy++) {
+        for (int dx = x0; dx < x1; dx++) {
+            if (!needsSamples(film, dx, dy, pass)) continue;
+            pixels.emplace_back(dx, dy);
+            auto pixel = static_cast<uint32_t>(dy * resolution.x() + dx);
+            for (int i = 0; i < samples; i++) {
+                PathState path { camera->generateRay(dx, dy, sample_pattern[i]), Vec3f(1, 1, 1), Vec3f(0, 0, 0), RandomSampler(sampler_type, seed), PathVertex() };
+                path.sampler.startSample(pixel, first_sample + static_cast<uint32_t>(i));
+                active.push_back(static_cast<int>(paths.size()));
+                paths.push_back(path);
+            }
+        }
+    }
+
+    // As in evalRadiance, the last pass only looks for light hits
+    for (int depth = 0; depth <= max_depth && !active.empty(); depth++) {
+        // Intersect: camera rays in packets, bounces one by one
+        hits.clear();
+        stats::add(depth == 0 ? stats::PrimaryRays : stats::BounceRays, active.size());
+        if (depth == 0) {
+            Ray packet_rays[BVH::PACKET_SIZE];
+            Interaction packet_hits[BVH::PACKET_SIZE];
+            for (size_t begin = 0; begin < active.size(); begin += BVH::PACKET_SIZE) {
+                int count = static_cast<int>(std::min(active.size() - begin, static_cast<size_t>(BVH::PACKET_SIZE)));
+                for (int i = 0; i < count; i++) {
+                    packet_rays[i] = paths[active[begin + i]].ray;
+                }
+                uint64_t mask = scene->intersectPacket(packet_rays, count, packet_hits);
+                for (int i = 0; i < count; i++) {
+                    if (mask & (1ull << i)) {
+                        hits.push_back({ active[begin + i], 0, packet_hits[i] });
+                    }
                 }
             }
+        } else {
+            for (int path_id: active) {
+                Interaction itra;
+                if (scene->intersect(paths[path_id].ray, itra)) {
+                    hits.push_back({ path_id, 0, itra });
+                }
+            }
+        }
+
+        // Drop misses and light hits, then sort by material and direction octant so
+        // the BSDF dispatch and the rays of the next stages stay coherent
+        size_t surface_hits = 0;
+        for (auto& hit: hits) {
+            PathState& path = paths[hit.path];
+            if (hit.interaction.type == Interaction::InterType::NONE) continue;
+            hit.interaction.w_o = -1 * path.ray.getDirection();
+            if (hit.interaction.type == Interaction::InterType::LIGHT) {
+                path.radiance += path.beta.cwiseProduct(evalEmission(hit.interaction, path.vertex));
+                continue;
+            }
+            if (depth == max_depth || hit.interaction.material == nullptr) continue;
+            if (hit.interaction.normal.dot(hit.interaction.w_o) < 0) {
+                hit.interaction.normal = -1 * hit.interaction.normal;
+            }
+            Vec3f direction = path.ray.getDirection();
+            int octant = (direction.x() < 0) | ((direction.y() < 0) << 1) | ((direction.z() < 0) << 2);
+            hit.sort_key = (reinterpret_cast<uintptr_t>(hit.interaction.material) << 3) | static_cast<uintptr_t>(octant);
+            hits[surface_hits++] = std::move(hit);
+        }
+        hits.resize(surface_hits);
+        std::sort(hits.begin(), hits.end(), [](const WavefrontHit& a, const WavefrontHit& b) { return a.sort_key < b.sort_key; });
+
+        // Shade: light sample and BSDF sample per hit
+        shadow_rays.clear();
+        next.clear();
+        for (auto& hit: hits) {
+            PathState& path = paths[hit.path];
+            Interaction& itra = hit.interaction;
+            ShadowRay shadow { Ray(), Vec3f(0, 0, 0), hit.path };
+            if (sampleDirectLighting(itra, path.sampler, shadow.ray, shadow.contribution)) {
+                shadow.contribution = path.beta.cwiseProduct(shadow.contribution);
+                shadow_rays.push_back(shadow);
+            }
 
-            camera->getImage()->setPixel(dx, dy, color / static_cast<float>(spp * spp));
+            if (indirect_type == IndirectType::PhotonMap && !bsdf::isDelta(*itra.material)) {
+                path.radiance += path.beta.cwiseProduct(photon_map.estimate(itra));
+                continue;
+            }
+            if (sampleBSDF(itra, path.sampler, path.beta, path.vertex, path.ray) && russianRoulette(depth, path.beta, path.sampler)) {
+                next.push_back(hit.path);
+            }
+        }
+
+        // Trace shadow rays
+        for (const auto& shadow: shadow_rays) {
+            if (!scene->isShadowed(shadow.ray)) {
+                paths[shadow.path].radiance += shadow.contribution;
+            }
+        }
+
+        std::swap(active, next);
+    }
+
+    // Resolve, adding the samples of a pixel in the same order as renderTile
+    size_t path_id = 0;
+    for (const auto& pixel: pixels) {
+        for (int i = 0; i < samples; i++) {
+            film.addSample(pixel.x(), pixel.y(), paths[path_id++].radiance);
         }
     }
-    printf("\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,286 @@
+#include "LightFormerFrontEnd.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    constexpr char MAGIC[8] = "HRTLFFE";
+    // Stream of the pixel samplers after the last VPL stream, so the two never share one
+    constexpr uint32_t PIXEL_STREAM = 1u << 31;
+
+    // Surface terms of a primary hit: diffuse albedo, specular color and roughness
+    void getSurface(const BSDF* material, Vec3f& albedo, Vec3f& specular, float& roughness) {
+        albedo = specular = Vec3f(0, 0, 0);
+        roughness = 1;
+        if (material == nullptr) return;
+        if (material->getType() == MaterialType::Specular) {
+            specular = material->getColor();
+            roughness = 0;
+        } else {
+            albedo = material->getColor();
+        }
+    }
+
+    struct ChannelSource {
+        const char* name;
+        uint32_t components;
+        uint64_t count;
+        const float* data;
+    };
+
+    ChannelSource channel(const char* name, const std::vector<Vec3f>& values) {
+        return {name, 3, values.size(), values.empty() ? nullptr : values[0].data()};
+    }
+
+    ChannelSource channel(const char* name, const std::vector<float>& values) {
+        return {name, 1, values.size(), values.data()};
+    }
+}
+
+LightFormerFrontEnd::LightFormerFrontEnd(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, const Config& render_config):
+    camera(std::move(cam)), scene(std::move(scene)), config(render_config.lightformer_config),
+    threads(render_config.threads), sampler_type(render_config.sampler_type), seed(render_config.seed),
+    width(render_config.image_resolution.x()), height(render_config.image_resolution.y()) {
+    std::vector<float> powers;
+    for (const auto& light: this->scene->getLights()) {
+        powers.push_back(light->getPower());
+    }
+    if (!powers.empty()) {
+        light_table = AliasTable(powers);
+        key_light = static_cast<int>(std::max_element(powers.begin(), powers.end()) - powers.begin());
+    }
+}
+
+uint64_t LightFormerFrontEnd::generate() {
+    int pixel_count = width * height;
+    buffers.gbuffer_position.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.gbuffer_normal.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.gbuffer_albedo.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.gbuffer_specular.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.gbuffer_roughness.assign(pixel_count, 0);
+    buffers.gbuffer_mask.assign(pixel_count, 0);
+    buffers.light_directions.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.half_vectors.assign(pixel_count, Vec3f(0, 0, 0));
+    buffers.shadow_d_sub_df.assign(pixel_count, 0);
+    buffers.shadow_d_div_df.assign(pixel_count, 1);
+    buffers.shadow_c_e.assign(pixel_count, 0);
+    buffers.shadow_c_c.assign(pixel_count, 0);
+    buffers.shadow_position.assign(pixel_count, Vec3f(0, 0, 0));
+
+    int direct_count = key_light < 0 ? 0 : config.direct_vpls;
+    int indirect_count = direct_count * config.indirect_per_direct;
+    buffers.direct_position.assign(direct_count, Vec3f(0, 0, 0));
+    buffers.direct_normal.assign(direct_count, Vec3f(0, 0, 0));
+    buffers.direct_power.assign(direct_count, Vec3f(0, 0, 0));
+    buffers.indirect_position.assign(indirect_count, Vec3f(0, 0, 0));
+    buffers.indirect_normal.assign(indirect_count, Vec3f(0, 0, 0));
+    buffers.indirect_flux.assign(indirect_count, Vec3f(0, 0, 0));
+
+    // One task per row and one per VPL; each slot of the buffers has a single writer
+    TaskScheduler scheduler(threads);
+    std::vector<uint64_t> rays(scheduler.getThreadCount(), 0);
+    scheduler.parallelFor(height, [&](int y, int thread) {
+        RandomSampler sampler(sampler_type, seed);
+        rays[thread] += generatePixels(y, sampler);
+    });
+    scheduler.parallelFor(direct_count, [&](int index, int thread) {
+        RandomSampler sampler(sampler_type, seed);
+        rays[thread] += generateVPLs(index, sampler);
+    });
+
+    uint64_t total = 0;
+    for (uint64_t count: rays) total += count;
+    return total;
+}
+
+uint64_t LightFormerFrontEnd::generatePixels(int y, RandomSampler& sampler) {
+    uint64_t rays = 0;
+    for (int x = 0; x < width; x++) {
+        int pixel = y * width + x;
+        Ray ray = camera->generateRay(static_cast<float>(x), static_cast<float>(y));
+        Interaction interaction;
+        rays++;
+        if (!scene->intersect(ray, interaction) || interaction.type != Interaction::InterType::GEOMETRY) continue;
+
+        Vec3f w_o = -1 * ray.getDirection().normalized();
+        Vec3f normal = interaction.normal.normalized();
+        if (normal.dot(w_o) < 0) {
+            normal = -1 * normal;
+        }
+        buffers.gbuffer_position[pixel] = interaction.position;
+        buffers.gbuffer_normal[pixel] = normal;
+        getSurface(interaction.material, buffers.gbuffer_albedo[pixel], buffers.gbuffer_specular[pixel], buffers.gbuffer_roughness[pixel]);
+        buffers.gbuffer_mask[pixel] = 1;
+        buffers.shadow_position[pixel] = interaction.position;
+        if (key_light < 0) continue;
+
+        // Key light direction and the blocker along it
+        const Light& light = scene->getLight(key_light);
+        Vec3f to_light = light.getPosition() - interaction.position;
+        float d = to_light.norm();
+        Vec3f light_direction = to_light / d;
+        buffers.light_directions[pixel] = light_direction;
+        buffers.half_vectors[pixel] = (light_direction + w_o).normalized();
+
+        Ray center_ray(interaction.position, light_direction);
+        center_ray.setTMax(d - EPS);
+        Interaction blocker;
+        rays++;
+        if (scene->intersect(center_ray, blocker) && blocker.type == Interaction::InterType::GEOMETRY) {
+            float d_f = d - blocker.distance;
+            buffers.shadow_d_sub_df[pixel] = d - d_f;
+            buffers.shadow_d_div_df[pixel] = d / std::max(d_f, EPS);
+            buffers.shadow_position[pixel] = blocker.position;
+        } else {
+            buffers.shadow_c_c[pixel] = 1;
+        }
+
+        // Visible fraction of the light
+        sampler.startSample(PIXEL_STREAM + pixel, 0);
+        int visible = 0;
+        for (int i = 0; i < config.shadow_samples; i++) {
+            auto vpl = light::dispatch(light, [&](const auto& emitter) { return emitter.getVPL(interaction, sampler); });
+            Vec3f to_sample = vpl.position - interaction.position;
+            float distance = to_sample.norm();
+            Ray shadow_ray(interaction.position, to_sample / distance);
+            shadow_ray.setTMax(distance - EPS);
+            rays++;
+            if (!scene->isShadowed(shadow_ray)) visible++;
+        }
+        buffers.shadow_c_e[pixel] = static_cast<float>(visible) / config.shadow_samples;
+    }
+    return rays;
+}
+
+uint64_t LightFormerFrontEnd::generateVPLs(int index, RandomSampler& sampler) {
+    sampler.startSample(index, 0);
+    float pmf;
+    int light_id = light_table.sample(sampler.get1D(), &pmf);
+    const Light& light = scene->getLight(light_id);
+    Interaction origin;
+    auto vpl = light::dispatch(light, [&](const auto& emitter) { return emitter.getVPL(origin, sampler); });
+    buffers.direct_position[index] = vpl.position;
+    buffers.direct_normal[index] = vpl.normal;
+
+    // The direct VPL carries the mean power of the photons it emits, at least one
+    int photons = std::max(1, config.indirect_per_direct);
+    Vec3f direct_power(0, 0, 0);
+    uint64_t rays = 0;
+    for (int i = 0; i < photons; i++) {
+        Vec3f direction;
+        Vec3f power = light::samplePhoton(light, vpl, sampler, direction) / (pmf * config.direct_vpls);
+        direct_power += power;
+        if (i >= config.indirect_per_direct || power.isZero()) continue;
+
+        int slot = index * config.indirect_per_direct + i;
+        Ray ray(vpl.position, direction);
+        Interaction hit;
+        rays++;
+        if (!scene->intersect(ray, hit) || hit.type != Interaction::InterType::GEOMETRY) continue;
+
+        Vec3f normal = hit.normal.normalized();
+        if (normal.dot(direction) > 0) {
+            normal = -1 * normal;
+        }
+        Vec3f albedo, specular;
+        float roughness;
+        getSurface(hit.material, albedo, specular, roughness);
+        buffers.indirect_position[slot] = hit.position;
+        buffers.indirect_normal[slot] = normal;
+        buffers.indirect_flux[slot] = power.cwiseProduct(albedo) / static_cast<float>(config.indirect_per_direct);
+    }
+    buffers.direct_power[index] = direct_power / static_cast<float>(photons);
+    return rays;
+}
+
+GBufferEntry LightFormerFrontEnd::getGBufferEntry(int pixel) const {
+    return {buffers.gbuffer_position[pixel], buffers.gbuffer_normal[pixel], buffers.gbuffer_albedo[pixel],
+        buffers.gbuffer_specular[pixel], buffers.gbuffer_roughness[pixel]};
+}
+
+ShadowData LightFormerFrontEnd::getShadowData(int pixel) const {
+    return {buffers.shadow_d_sub_df[pixel], buffers.shadow_d_div_df[pixel], buffers.shadow_c_e[pixel],
+        buffers.shadow_c_c[pixel], buffers.shadow_position[pixel]};
+}
+
+DirectVPLsData LightFormerFrontEnd::getDirectVPL(int index) const {
+    return {buffers.direct_position[index], buffers.direct_normal[index], buffers.direct_power[index]};
+}
+
+IndirectVPLsData LightFormerFrontEnd::getIndirectVPL(int index) const {
+    return {buffers.indirect_position[index], buffers.indirect_normal[index], buffers.indirect_flux[index]};
+}
+
+bool LightFormerFrontEnd::write(const std::string& path) const {
+    static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Vec3f channels are written as packed floats");
+    const ChannelSource sources[] = {
+        channel("gbuffer_position", buffers.gbuffer_position),
+        channel("gbuffer_normal", buffers.gbuffer_normal),
+        channel("gbuffer_albedo", buffers.gbuffer_albedo),
+        channel("gbuffer_specular", buffers.gbuffer_specular),
+        channel("gbuffer_roughness", buffers.gbuffer_roughness),
+        channel("gbuffer_mask", buffers.gbuffer_mask),
+        channel("light_directions", buffers.light_directions),
+        channel("half_vectors", buffers.half_vectors),
+        channel("shadow_d_sub_df", buffers.shadow_d_sub_df),
+        channel("shadow_d_div_df", buffers.shadow_d_div_df),
+        channel("shadow_c_e", buffers.shadow_c_e),
+        channel("shadow_c_c", buffers.shadow_c_c),
+        channel("shadow_position", buffers.shadow_position),
+        channel("direct_position", buffers.direct_position),
+        channel("direct_normal", buffers.direct_normal),
+        channel("direct_power", buffers.direct_power),
+        channel("indirect_position", buffers.indirect_position),
+        channel("indirect_normal", buffers.indirect_normal),
+        channel("indirect_flux", buffers.indirect_flux),
+    };
+    constexpr int channel_count = sizeof(sources) / sizeof(sources[0]);
+
+    Header header {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.channel_count = channel_count;
+    header.width = width;
+    header.height = height;
+    header.direct_count = static_cast<uint32_t>(buffers.direct_position.size());
+    header.indirect_count = static_cast<uint32_t>(buffers.indirect_position.size());
+    auto align = [](uint64_t offset) {
+        return (offset + utils::CACHE_LINE_SIZE - 1) / utils::CACHE_LINE_SIZE * utils::CACHE_LINE_SIZE;
+    };
+    std::vector<Channel> channels(channel_count);
+    uint64_t offset = align(sizeof(Header) + channel_count * sizeof(Channel));
+    for (int i = 0; i < channel_count; i++) {
+        std::strncpy(channels[i].name, sources[i].name, CHANNEL_NAME_SIZE - 1);
+        channels[i].components = sources[i].components;
+        channels[i].count = sources[i].count;
+        channels[i].offset = offset;
+        offset = align(offset + sources[i].count * sources[i].components * sizeof(float));
+    }
+
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, error);
+    // Written next to the final name and renamed, so a reader never maps a partial file
+    std::string temp_path = path + ".tmp";
+    std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+    if (!stream) return false;
+    const char zeros[utils::CACHE_LINE_SIZE] = {};
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    stream.write(reinterpret_cast<const char*>(channels.data()), static_cast<std::streamsize>(channels.size() * sizeof(Channel)));
+    uint64_t written = sizeof(Header) + channel_count * sizeof(Channel);
+    for (int i = 0; i < channel_count; i++) {
+        uint64_t size = sources[i].count * sources[i].components * sizeof(float);
+        stream.write(zeros, static_cast<std::streamsize>(channels[i].offset - written));
+        stream.write(reinterpret_cast<const char*>(sources[i].data), static_cast<std::streamsize>(size));
+        written = channels[i].offset + size;
+    }
+    stream.close();
+    if (!stream) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    return !error;
+}
@@ -1,5 +1,10 @@
 #include "accel.hpp"
 #include "geometry.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 
 bool AABB::intersect(const Ray& ray) const{
     float t1 = (xyz_min.x() - ray.getOrigin().x()) / ray.getDirection().x();
@@ -36,29 +41,715 @@ bool AABB::intersect(const Ray& ray, float* t_in, float* t_out) const{
     return tmax > tmin;
 }
 
-bool OccupancyGrid::intersect(const Ray& ray, Interaction& interaction) const {
-    if (!aabb.intersect(ray)) {
+void OccupancyGrid::build(const std::vector<AABB>& prim_aabbs) {
+    cell_offsets.clear();
+    cell_prims.clear();
+    if (prim_aabbs.empty()) return;
+
+    aabb = AABB(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+    for (const auto& prim_aabb: prim_aabbs) {
+        aabb.merge_with(prim_aabb);
+    }
+
+    Vec3f extent = aabb.getMax() - aabb.getMin();
+    if (grid_resolution.minCoeff() <= 0) {
+        // cbrt(density * N) cells along the longest axis, with roughly cubic cells
+        constexpr float density = 3.0f;
+        constexpr int max_resolution = 128;
+        float cells_per_unit = std::cbrt(density * prim_aabbs.size()) / extent.maxCoeff();
+        for (int axis = 0; axis < 3; axis++) {
+            grid_resolution[axis] = std::max(1, std::min(max_resolution, static_cast<int>(extent[axis] * cells_per_unit)));
+        }
+    }
+    cell_size = extent.cwiseQuotient(grid_resolution.cast<float>());
+
+    // Bin every primitive into all the cells its bounds overlap (counting pass, then filling pass)
+    int cell_count = grid_resolution.prod();
+    Vec3f inv_cell_size = cell_size.cwiseInverse();
+    auto cellRange = [&](const AABB& prim_aabb, Vec3i& lo, Vec3i& hi) {
+        for (int axis = 0; axis < 3; axis++) {
+            lo[axis] = static_cast<int>((prim_aabb.getMin()[axis] - aabb.getMin()[axis]) * inv_cell_size[axis]);
+            hi[axis] = static_cast<int>((prim_aabb.getMax()[axis] - aabb.getMin()[axis]) * inv_cell_size[axis]);
+            lo[axis] = std::max(0, std::min(grid_resolution[axis] - 1, lo[axis]));
+            hi[axis] = std::max(0, std::min(grid_resolution[axis] - 1, hi[axis]));
+        }
+    };
+    cell_offsets.assign(cell_count + 1, 0);
+    for (const auto& prim_aabb: prim_aabbs) {
+        Vec3i lo, hi;
+        cellRange(prim_aabb, lo, hi);
+        for (int z = lo.z(); z <= hi.z(); z++)
+            for (int y = lo.y(); y <= hi.y(); y++)
+                for (int x = lo.x(); x <= hi.x(); x++)
+                    cell_offsets[x + grid_resolution.x() * (y + grid_resolution.y() * z) + 1]++;
+    }
+    for (int i = 0; i < cell_count; i++) {
+        cell_offsets[i + 1] += cell_offsets[i];
+    }
+    cell_prims.resize(cell_offsets[cell_count]);
+    std::vector<int> cursor(cell_offsets.begin(), cell_offsets.end() - 1);
+    for (size_t prim = 0; prim < prim_aabbs.size(); prim++) {
+        Vec3i lo, hi;
+        cellRange(prim_aabbs[prim], lo, hi);
+        for (int z = lo.z(); z <= hi.z(); z++)
+            for (int y = lo.y(); y <= hi.y(); y++)
+                for (int x = lo.x(); x <= hi.x(); x++)
+                    cell_prims[cursor[x + grid_resolution.x() * (y + grid_resolution.y() * z)]++] = static_cast<int>(prim);
+    }
+}
+
+bool OccupancyGrid::setupDDA(const Ray& ray, float t_max, DDAState& state) const {
+    Vec3f origin = ray.getOrigin(), direction = ray.getDirection();
+    float t_enter;
+    if (!aabb.intersect(origin, direction.cwiseInverse(), ray.getTMin(), t_max, &t_enter)) {
         return false;
     }
 
+    Vec3f entry = origin + t_enter * direction;
+    for (int axis = 0; axis < 3; axis++) {
+        int cell = static_cast<int>((entry[axis] - aabb.getMin()[axis]) / cell_size[axis]);
+        state.cell[axis] = std::max(0, std::min(grid_resolution[axis] - 1, cell));
+        if (direction[axis] > 0) {
+            float boundary = aabb.getMin()[axis] + (state.cell[axis] + 1) * cell_size[axis];
+            state.next_t[axis] = t_enter + (boundary - entry[axis]) / direction[axis];
+            state.delta_t[axis] = cell_size[axis] / direction[axis];
+            state.step[axis] = 1;
+            state.out[axis] = grid_resolution[axis];
+        }
+        else if (direction[axis] < 0) {
+            float boundary = aabb.getMin()[axis] + state.cell[axis] * cell_size[axis];
+            state.next_t[axis] = t_enter + (boundary - entry[axis]) / direction[axis];
+            state.delta_t[axis] = -cell_size[axis] / direction[axis];
+            state.step[axis] = -1;
+            state.out[axis] = -1;
+        }
+        else {
+            state.next_t[axis] = std::numeric_limits<float>::infinity();
+            state.delta_t[axis] = 0;
+            state.step[axis] = 0;
+            state.out[axis] = -1;
+        }
+    }
+    return true;
+}
+
+namespace {
+    AABB emptyBounds() {
+        return AABB(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+    }
+
+    // Run func(chunk_begin, chunk_end, chunk) over [begin, end) cut into `chunks` pieces, in parallel if there are several
+    template <typename Func>
+    void forChunks(int begin, int end, int chunks, Func&& func) {
+        if (chunks <= 1) {
+            func(begin, end, 0);
+            return;
+        }
+        TaskScheduler scheduler(chunks);
+        scheduler.parallelFor(chunks, [&](int chunk, int thread) {
+            int64_t n = end - begin;
+            func(begin + static_cast<int>(n * chunk / chunks), begin + static_cast<int>(n * (chunk + 1) / chunks), chunk);
+        });
+    }
+
+    // Threads worth using for a pass over n primitives
+    int chunkCount(int n, int threads) {
+        return std::max(1, std::min(threads, n / BVH::MIN_TASK_PRIMS));
+    }
+
+    // Spread the low 10 bits of x so that two zero bits follow each of them
+    uint32_t expandBits(uint32_t x) {
+        x = (x | (x << 16)) & 0x030000ffu;
+        x = (x | (x << 8)) & 0x0300f00fu;
+        x = (x | (x << 4)) & 0x030c30c3u;
+        x = (x | (x << 2)) & 0x09249249u;
+        return x;
+    }
+}
+
+void BVH::build(const std::vector<AABB>& prim_aabbs, int max_leaf_size, BVHBuildType type, int threads) {
+    nodes.clear();
+    prim_indices.clear();
+    if (prim_aabbs.empty()) return;
+    if (threads <= 0) {
+        threads = TaskScheduler().getThreadCount();
+    }
+
+    std::vector<BuildPrim> prims(prim_aabbs.size());
+    auto prim_count = static_cast<int>(prims.size());
+    forChunks(0, prim_count, chunkCount(prim_count, threads), [&](int begin, int end, int chunk) {
+        for (int i = begin; i < end; i++) {
+            prims[i] = { prim_aabbs[i], prim_aabbs[i].getCenter(), i, 0 };
+        }
+    });
+    nodes.reserve(2 * prims.size());
+    prim_indices.reserve(prims.size());
+
+    if (type == BVHBuildType::Sweep) {
+        buildRecursive(prims, 0, prim_count, 0, max_leaf_size);
+    }
+    else if (type == BVHBuildType::Binned) {
+        buildTopDown(prims, max_leaf_size, threads, [max_leaf_size](
+            std::vector<BuildPrim>& prims, int begin, int end, const AABB& bounds, int& axis, int threads
+        ) {
+            return splitBinned(prims, begin, end, bounds, axis, threads, max_leaf_size);
+        });
+    }
+    else {
+        // Morton codes of the centroids, quantized to 10 bits per axis in the centroid bounds
+        AABB centroid_bounds = emptyBounds();
+        for (const auto& prim: prims) {
+            centroid_bounds.merge_with(AABB(prim.centroid, prim.centroid));
+        }
+        Vec3f origin = centroid_bounds.getMin(), extent = centroid_bounds.getMax() - origin;
+        Vec3f scale = extent.unaryExpr([](float e) { return e > 0 ? 1024.0f / e : 0.0f; });
+        std::vector<uint64_t> keys(prims.size()), sorted(prims.size());
+        forChunks(0, prim_count, chunkCount(prim_count, threads), [&](int begin, int end, int chunk) {
+            for (int i = begin; i < end; i++) {
+                Vec3f q = (prims[i].centroid - origin).cwiseProduct(scale);
+                uint32_t code = 0;
+                for (int axis = 0; axis < 3; axis++) {
+                    auto cell = static_cast<uint32_t>(utils::clamp(q[axis], 0, 1023));
+                    code |= expandBits(cell) << (2 - axis);
+                }
+                prims[i].morton = code;
+                keys[i] = (static_cast<uint64_t>(code) << 32) | static_cast<uint32_t>(i);
+            }
+        });
+        // LSD radix sort of the 30 code bits, 10 at a time
+        for (int shift = 32; shift < 62; shift += 10) {
+            std::vector<int> counts(1025, 0);
+            for (uint64_t key: keys) counts[((key >> shift) & 1023) + 1]++;
+            for (int b = 0; b < 1024; b++) counts[b + 1] += counts[b];
+            for (uint64_t key: keys) sorted[counts[(key >> shift) & 1023]++] = key;
+            keys.swap(sorted);
+        }
+        std::vector<BuildPrim> ordered(prims.size());
+        for (int i = 0; i < prim_count; i++) {
+            ordered[i] = prims[static_cast<uint32_t>(keys[i])];
+        }
+        prims = std::move(ordered);
+
+        buildTopDown(prims, max_leaf_size, threads, [max_leaf_size](
+            std::vector<BuildPrim>& prims, int begin, int end, const AABB& bounds, int& axis, int threads
+        ) {
+            if (end - begin <= max_leaf_size) return -1;
+            int mid = splitMorton(prims, begin, end, axis);
+            if (mid < 0) {
+                // Equal codes: halve the range along the widest axis of its bounds
+                Vec3f extent = bounds.getMax() - bounds.getMin();
+                extent.maxCoeff(&axis);
+                mid = begin + (end - begin) / 2;
+            }
+            return mid;
+        });
+    }
+    nodes.shrink_to_fit();
+}
+
+void BVH::refit(const std::vector<AABB>& prim_aabbs) {
+    // Children follow their parent in the flattened order, so a reverse sweep sees them first
+    for (int node_id = static_cast<int>(nodes.size()) - 1; node_id >= 0; node_id--) {
+        BVHNode& node = nodes[node_id];
+        if (node.count > 0) {
+            AABB bounds = emptyBounds();
+            for (int i = 0; i < node.count; i++) {
+                bounds.merge_with(prim_aabbs[prim_indices[node.offset + i]]);
+            }
+            node.aabb = bounds;
+        }
+        else {
+            node.aabb = AABB(nodes[node_id + 1].aabb, nodes[node.offset].aabb);
+        }
+    }
+}
+
+void BVH::buildTopDown(std::vector<BuildPrim>& prims, int max_leaf_size, int threads, const SplitFunc& split) {
+    auto prim_count = static_cast<int>(prims.size());
+    // Top levels: enough tasks to keep every thread busy while some subtrees are deeper than others
+    std::vector<BuildNode> top;
+    std::vector<BuildTask> tasks;
+    int task_size = threads > 1 ? std::max(MIN_TASK_PRIMS, prim_count / (4 * threads)) : 0;
+    buildTaskNode(prims, top, tasks, 0, prim_count, 0, max_leaf_size, threads, task_size, split);
+
+    // Subtrees touch disjoint ranges of prims, so tasks need no synchronization
+    TaskScheduler scheduler(std::max(1, std::min(threads, static_cast<int>(tasks.size()))));
+    scheduler.parallelFor(static_cast<int>(tasks.size()), [&](int task_id, int thread) {
+        BuildTask& task = tasks[task_id];
+        std::vector<BuildTask> no_tasks;
+        task.nodes.reserve(2 * (task.end - task.begin) / std::max(1, max_leaf_size) + 1);
+        buildTaskNode(prims, task.nodes, no_tasks, task.begin, task.end, task.depth, max_leaf_size, 1, 0, split);
+    });
+
+    // Leaves are flattened in range order, so slots are the positions in prims
+    prim_indices.resize(prims.size());
+    for (int i = 0; i < prim_count; i++) {
+        prim_indices[i] = prims[i].index;
+    }
+    flatten(tasks, top, 0);
+}
+
+int BVH::buildTaskNode(std::vector<BuildPrim>& prims, std::vector<BuildNode>& pool, std::vector<BuildTask>& tasks,
+    int begin, int end, int depth, int max_leaf_size, int threads, int task_size, const SplitFunc& split) {
+    int n = end - begin;
+    auto node_id = static_cast<int>(pool.size());
+    pool.push_back(BuildNode());
+    if (task_size > 0 && n <= task_size) {
+        pool[node_id].task = static_cast<int>(tasks.size());
+        tasks.push_back({ begin, end, depth, {} });
+        return node_id;
+    }
+
+    int chunks = chunkCount(n, threads);
+    std::vector<std::pair<Vec3f, Vec3f>> chunk_bounds(chunks);
+    forChunks(begin, end, chunks, [&](int chunk_begin, int chunk_end, int chunk) {
+        Vec3f low = prims[chunk_begin].aabb.getMin(), high = prims[chunk_begin].aabb.getMax();
+        for (int i = chunk_begin; i < chunk_end; i++) {
+            low = low.cwiseMin(prims[i].aabb.getMin());
+            high = high.cwiseMax(prims[i].aabb.getMax());
+        }
+        chunk_bounds[chunk] = { low, high };
+    });
+    Vec3f low = chunk_bounds[0].first, high = chunk_bounds[0].second;
+    for (int chunk = 1; chunk < chunks; chunk++) {
+        low = low.cwiseMin(chunk_bounds[chunk].first);
+        high = high.cwiseMax(chunk_bounds[chunk].second);
+    }
+    AABB bounds(low, high);
+
+    int axis = 0;
+    int mid = (n == 1 || depth >= BVH_MAX_DEPTH) ? -1 : split(prims, begin, end, bounds, axis, threads);
+    if (mid < 0) {
+        pool[node_id].aabb = bounds;
+        pool[node_id].begin = begin;
+        pool[node_id].end = end;
+        return node_id;
+    }
+    int left = buildTaskNode(prims, pool, tasks, begin, mid, depth + 1, max_leaf_size, threads, task_size, split);
+    int right = buildTaskNode(prims, pool, tasks, mid, end, depth + 1, max_leaf_size, threads, task_size, split);
+    BuildNode& node = pool[node_id];
+    node.aabb = bounds;
+    node.left = left;
+    node.right = right;
+    node.begin = begin;
+    node.end = end;
+    node.axis = axis;
+    return node_id;
+}
+
+int BVH::flatten(const std::vector<BuildTask>& tasks, const std::vector<BuildNode>& pool, int node) {
+    const BuildNode& build_node = pool[node];
+    if (build_node.task >= 0) {
+        return flatten(tasks, tasks[build_node.task].nodes, 0);
+    }
+    auto node_id = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode());
+    if (build_node.left < 0) {
+        nodes[node_id] = { build_node.aabb, build_node.begin, build_node.end - build_node.begin, 0 };
+        return node_id;
+    }
+    flatten(tasks, pool, build_node.left);
+    int right_id = flatten(tasks, pool, build_node.right);
+    nodes[node_id] = { build_node.aabb, right_id, 0, build_node.axis };
+    return node_id;
+}
+
+int BVH::splitBinned(std::vector<BuildPrim>& prims, int begin, int end, const AABB& bounds, int& axis, int threads, int max_leaf_size) {
+    // Cost of traversing one node relative to one primitive test
+    constexpr float traversal_cost = 1.0f;
+    // Plain corners rather than an AABB, binning is the hot loop of the build
+    struct Bin {
+        Vec3f low = Vec3f::Constant(std::numeric_limits<float>::infinity());
+        Vec3f high = Vec3f::Constant(-std::numeric_limits<float>::infinity());
+        int count = 0;
+
+        void grow(const Vec3f& min, const Vec3f& max, int n) {
+            low = low.cwiseMin(min);
+            high = high.cwiseMax(max);
+            count += n;
+        }
+        [[nodiscard]] float getSurfaceArea() const {
+            Vec3f d = high - low;
+            return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+        }
+    };
+    int n = end - begin;
+    int chunks = chunkCount(n, threads);
+
+    // Centroid bounds pick the bins
+    std::vector<std::pair<Vec3f, Vec3f>> chunk_centroids(chunks);
+    forChunks(begin, end, chunks, [&](int chunk_begin, int chunk_end, int chunk) {
+        Vec3f low = prims[chunk_begin].centroid, high = low;
+        for (int i = chunk_begin; i < chunk_end; i++) {
+            low = low.cwiseMin(prims[i].centroid);
+            high = high.cwiseMax(prims[i].centroid);
+        }
+        chunk_centroids[chunk] = { low, high };
+    });
+    Vec3f low = chunk_centroids[0].first, high = chunk_centroids[0].second;
+    for (int chunk = 1; chunk < chunks; chunk++) {
+        low = low.cwiseMin(chunk_centroids[chunk].first);
+        high = high.cwiseMax(chunk_centroids[chunk].second);
+    }
+    Vec3f extent = high - low;
+    if (extent.maxCoeff() <= 0) {
+        if (n <= max_leaf_size) return -1;
+        (bounds.getMax() - bounds.getMin()).maxCoeff(&axis);
+        return begin + n / 2;
+    }
+    Vec3f scale = extent.unaryExpr([](float e) { return e > 0 ? SAH_BINS / e : 0.0f; });
+    auto binOf = [&](const BuildPrim& prim, int bin_axis) {
+        return std::min(SAH_BINS - 1, static_cast<int>((prim.centroid[bin_axis] - low[bin_axis]) * scale[bin_axis]));
+    };
+
+    std::vector<std::array<std::array<Bin, SAH_BINS>, 3>> chunk_bins(chunks);
+    forChunks(begin, end, chunks, [&](int chunk_begin, int chunk_end, int chunk) {
+        auto& bins = chunk_bins[chunk];
+        for (int i = chunk_begin; i < chunk_end; i++) {
+            for (int bin_axis = 0; bin_axis < 3; bin_axis++) {
+                if (extent[bin_axis] <= 0) continue;
+                bins[bin_axis][binOf(prims[i], bin_axis)].grow(prims[i].aabb.getMin(), prims[i].aabb.getMax(), 1);
+            }
+        }
+    });
+    auto& bins = chunk_bins[0];
+    for (int chunk = 1; chunk < chunks; chunk++) {
+        for (int bin_axis = 0; bin_axis < 3; bin_axis++) {
+            for (int b = 0; b < SAH_BINS; b++) {
+                const Bin& other = chunk_bins[chunk][bin_axis][b];
+                bins[bin_axis][b].grow(other.low, other.high, other.count);
+            }
+        }
+    }
+
+    // Sweep the bin boundaries like the full sweep does the primitives
+    float best_cost = 1e30f;
+    int best_axis = -1, best_split = -1;
+    for (int bin_axis = 0; bin_axis < 3; bin_axis++) {
+        if (extent[bin_axis] <= 0) continue;
+        float right_cost[SAH_BINS];
+        Bin right;
+        for (int b = SAH_BINS - 1; b > 0; b--) {
+            const Bin& bin = bins[bin_axis][b];
+            right.grow(bin.low, bin.high, bin.count);
+            right_cost[b] = right.count > 0 ? right.getSurfaceArea() * right.count : 0;
+        }
+        Bin left;
+        for (int b = 1; b < SAH_BINS; b++) {
+            const Bin& bin = bins[bin_axis][b - 1];
+            left.grow(bin.low, bin.high, bin.count);
+            int left_count = left.count;
+            if (left_count == 0 || left_count == n) continue;
+            float cost = left.getSurfaceArea() * static_cast<float>(left_count) + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = bin_axis;
+                best_split = b;
+            }
+        }
+    }
+    if (best_axis < 0) {
+        // Every centroid landed in one bin of each axis
+        if (n <= max_leaf_size) return -1;
+        extent.maxCoeff(&axis);
+        auto middle = prims.begin() + begin + n / 2;
+        std::nth_element(prims.begin() + begin, middle, prims.begin() + end, [axis](const BuildPrim& a, const BuildPrim& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+        return begin + n / 2;
+    }
+    best_cost = traversal_cost + best_cost / bounds.getSurfaceArea();
+    if (n <= max_leaf_size && static_cast<float>(n) <= best_cost) {
+        return -1;
+    }
+
+    axis = best_axis;
+    auto mid = std::partition(prims.begin() + begin, prims.begin() + end, [&](const BuildPrim& prim) {
+        return binOf(prim, best_axis) < best_split;
+    });
+    return static_cast<int>(mid - prims.begin());
+}
+
+int BVH::splitMorton(std::vector<BuildPrim>& prims, int begin, int end, int& axis) {
+    uint32_t first = prims[begin].morton, last = prims[end - 1].morton;
+    if (first == last) return -1;
+    // The range is sorted and agrees above the highest differing bit, so that bit splits it in two runs
+    int bit = 31 - __builtin_clz(first ^ last);
+    auto mid = std::partition_point(prims.begin() + begin, prims.begin() + end, [bit](const BuildPrim& prim) {
+        return ((prim.morton >> bit) & 1) == 0;
+    });
+    // Bits are interleaved as ... x y z, x in the highest of every three
+    axis = 2 - bit % 3;
+    return static_cast<int>(mid - prims.begin());
+}
+
+int BVH::buildRecursive(std::vector<BuildPrim>& prims, int begin, int end, int depth, int max_leaf_size) {
+    // Cost of traversing one node relative to one primitive test
+    constexpr float traversal_cost = 1.0f;
+
+    int node_id = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode());
+
+    AABB bounds(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+    for (int i = begin; i < end; i++) {
+        bounds.merge_with(prims[i].aabb);
+    }
+    int n = end - begin;
+
+    auto makeLeaf = [&]() {
+        nodes[node_id].aabb = bounds;
+        nodes[node_id].offset = static_cast<int>(prim_indices.size());
+        nodes[node_id].count = n;
+        nodes[node_id].axis = 0;
+        for (int i = begin; i < end; i++) {
+            prim_indices.push_back(prims[i].index);
+        }
+        return node_id;
+    };
+    if (n == 1 || depth >= BVH_MAX_DEPTH) {
+        return makeLeaf();
+    }
+
+    // Sweep SAH: sort along each axis and evaluate every split position
+    float best_cost = 1e30f;
+    int best_axis = -1, best_split = -1;
+    std::vector<float> right_area(n);
+    for (int axis = 0; axis < 3; axis++) {
+        std::sort(prims.begin() + begin, prims.begin() + end, [axis](const BuildPrim& a, const BuildPrim& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+        AABB right(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+        for (int i = n - 1; i > 0; i--) {
+            right.merge_with(prims[begin + i].aabb);
+            right_area[i] = right.getSurfaceArea();
+        }
+        AABB left(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+        for (int i = 1; i < n; i++) {
+            left.merge_with(prims[begin + i - 1].aabb);
+            float cost = left.getSurfaceArea() * i + right_area[i] * (n - i);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+            }
+        }
+    }
+    best_cost = traversal_cost + best_cost / bounds.getSurfaceArea();
 
-    bool geometry_hit = false;
-    Interaction itra;
+    if (n <= max_leaf_size && static_cast<float>(n) <= best_cost) {
+        return makeLeaf();
+    }
 
-    for (auto gridcell: occupancy_grid) {
-        if (!gridcell.aabb.intersect(ray)) continue;
-        //printf("gridcell counts: %d\n", gridcell.objects.size());
-        for (auto object: gridcell.objects) {
-            if (object->intersect(ray, itra) && itra.distance < interaction.distance) {
-                interaction = itra;
-                geometry_hit = true;
-                //printf("Hit %s\n", object->getType().c_str());
-                //printf("Distance: %f\n", interaction.distance);
-                //printf("POS: %f %f %f\n", interaction.position.x(), interaction.position.y(), interaction.position.z());
+    if (best_axis != 2) {
+        std::sort(prims.begin() + begin, prims.begin() + end, [best_axis](const BuildPrim& a, const BuildPrim& b) {
+            return a.centroid[best_axis] < b.centroid[best_axis];
+        });
+    }
+    int mid = begin + best_split;
+    buildRecursive(prims, begin, mid, depth + 1, max_leaf_size);
+    int right_id = buildRecursive(prims, mid, end, depth + 1, max_leaf_size);
+
+    nodes[node_id].aabb = bounds;
+    nodes[node_id].offset = right_id;
+    nodes[node_id].count = 0;
+    nodes[node_id].axis = best_axis;
+    return node_id;
+}
+
+
+void WideBVH::build(const BVH& bvh) {
+    clear();
+    const auto& binary_nodes = bvh.getNodes();
+    if (binary_nodes.empty()) return;
+
+    if (binary_nodes[0].count > 0) {
+        // A single leaf still needs a root to hold it
+        built_nodes.push_back(WideBVHNode());
+        WideBVHNode& root = built_nodes[0];
+        for (int c = 0; c < simd::BOX_WIDTH; c++) {
+            for (int axis = 0; axis < 3; axis++) {
+                root.bounds[axis][c] = std::numeric_limits<float>::infinity();
+                root.bounds[axis + 3][c] = -std::numeric_limits<float>::infinity();
             }
+            root.child[c] = 0;
+            root.count[c] = -1;
         }
+        for (int axis = 0; axis < 3; axis++) {
+            root.bounds[axis][0] = binary_nodes[0].aabb.getMin()[axis];
+            root.bounds[axis + 3][0] = binary_nodes[0].aabb.getMax()[axis];
+        }
+        root.child[0] = binary_nodes[0].offset;
+        root.count[0] = binary_nodes[0].count;
+        return;
     }
+    built_nodes.reserve(binary_nodes.size() / 4 + 1);
+    collapse(bvh, 0);
+}
 
-    return (interaction.distance > ray.getTMin() && geometry_hit);
+int WideBVH::collapse(const BVH& bvh, int binary_node) {
+    const auto& binary_nodes = bvh.getNodes();
+    int node_id = static_cast<int>(built_nodes.size());
+    built_nodes.push_back(WideBVHNode());
 
-}
\ No newline at end of file
+    // Open the interior child with the largest surface area until the node is full
+    std::vector<int> children = { binary_node + 1, binary_nodes[binary_node].offset };
+    while (static_cast<int>(children.size()) < simd::BOX_WIDTH) {
+        int best = -1;
+        float best_area = -1;
+        for (int k = 0; k < static_cast<int>(children.size()); k++) {
+            const BVHNode& child = binary_nodes[children[k]];
+            if (child.count == 0 && child.aabb.getSurfaceArea() > best_area) {
+                best_area = child.aabb.getSurfaceArea();
+                best = k;
+            }
+        }
+        if (best < 0) break;
+        int opened = children[best];
+        children[best] = opened + 1;
+        children.push_back(binary_nodes[opened].offset);
+    }
+
+    int child_ids[simd::BOX_WIDTH], child_counts[simd::BOX_WIDTH];
+    for (int c = 0; c < simd::BOX_WIDTH; c++) {
+        if (c < static_cast<int>(children.size())) {
+            const BVHNode& child = binary_nodes[children[c]];
+            child_counts[c] = child.count;
+            // Recursion appends nodes, so only write through the index afterwards
+            child_ids[c] = child.count > 0 ? child.offset : collapse(bvh, children[c]);
+        }
+        else {
+            child_ids[c] = 0;
+            child_counts[c] = -1;
+        }
+    }
+
+    WideBVHNode& node = built_nodes[node_id];
+    for (int c = 0; c < simd::BOX_WIDTH; c++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (child_counts[c] < 0) {
+                node.bounds[axis][c] = std::numeric_limits<float>::infinity();
+                node.bounds[axis + 3][c] = -std::numeric_limits<float>::infinity();
+            }
+            else {
+                node.bounds[axis][c] = binary_nodes[children[c]].aabb.getMin()[axis];
+                node.bounds[axis + 3][c] = binary_nodes[children[c]].aabb.getMax()[axis];
+            }
+        }
+        node.child[c] = child_ids[c];
+        node.count[c] = child_counts[c];
+    }
+    return node_id;
+}
+
+void WideBVH::refit(const std::vector<AABB>& slot_aabbs) {
+    ownNodes();
+    bool compact = !compact_nodes.empty();
+    if (compact) {
+        // Only the structure is needed, every non-empty bound is recomputed below
+        built_nodes.resize(compact_nodes.size());
+        for (size_t node_id = 0; node_id < compact_nodes.size(); node_id++) {
+            for (int c = 0; c < simd::BOX_WIDTH; c++) {
+                built_nodes[node_id].child[c] = compact_nodes[node_id].child[c];
+                built_nodes[node_id].count[c] = compact_nodes[node_id].count[c];
+                for (int axis = 0; axis < 3; axis++) {
+                    built_nodes[node_id].bounds[axis][c] = std::numeric_limits<float>::infinity();
+                    built_nodes[node_id].bounds[axis + 3][c] = -std::numeric_limits<float>::infinity();
+                }
+            }
+        }
+    }
+    // Children are appended after their parent, so a reverse sweep sees them first
+    for (int node_id = static_cast<int>(built_nodes.size()) - 1; node_id >= 0; node_id--) {
+        WideBVHNode& node = built_nodes[node_id];
+        for (int c = 0; c < simd::BOX_WIDTH; c++) {
+            if (node.count[c] < 0) continue;
+            Vec3f low = Vec3f::Constant(std::numeric_limits<float>::infinity()), high = -low;
+            if (node.count[c] > 0) {
+                for (int slot = node.child[c]; slot < node.child[c] + node.count[c]; slot++) {
+                    low = low.cwiseMin(slot_aabbs[slot].getMin());
+                    high = high.cwiseMax(slot_aabbs[slot].getMax());
+                }
+            }
+            else {
+                const WideBVHNode& child = built_nodes[node.child[c]];
+                for (int k = 0; k < simd::BOX_WIDTH; k++) {
+                    if (child.count[k] < 0) continue;
+                    for (int axis = 0; axis < 3; axis++) {
+                        low[axis] = std::min(low[axis], child.bounds[axis][k]);
+                        high[axis] = std::max(high[axis], child.bounds[axis + 3][k]);
+                    }
+                }
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds[axis][c] = low[axis];
+                node.bounds[axis + 3][c] = high[axis];
+            }
+        }
+    }
+    if (compact) {
+        compress();
+    }
+}
+
+bool WideBVH::compress() {
+    ownNodes();
+    if (built_nodes.empty()) return isCompact();
+    utils::AlignedVector<CompactWideBVHNode> nodes(built_nodes.size());
+    for (size_t node_id = 0; node_id < built_nodes.size(); node_id++) {
+        if (!nodes[node_id].encode(built_nodes[node_id])) return false;
+    }
+    compact_nodes = std::move(nodes);
+    utils::AlignedVector<WideBVHNode>().swap(built_nodes);
+    return true;
+}
+
+bool CompactWideBVHNode::encode(const WideBVHNode& node) {
+    for (int c = 0; c < simd::BOX_WIDTH; c++) {
+        if (node.count[c] > MAX_LEAF_COUNT) return false;
+        child[c] = node.child[c];
+        count[c] = static_cast<int8_t>(node.count[c]);
+    }
+    valid = 0;
+    for (int c = 0; c < simd::BOX_WIDTH; c++) {
+        if (node.count[c] >= 0) valid |= 1 << c;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        float low = std::numeric_limits<float>::infinity(), high = -low;
+        for (int c = 0; c < simd::BOX_WIDTH; c++) {
+            if (node.count[c] < 0) continue;
+            low = std::min(low, node.bounds[axis][c]);
+            high = std::max(high, node.bounds[axis + 3][c]);
+        }
+        if (low > high) {
+            low = high = 0;
+        }
+        // Smallest power of two step covering [low, high] with 255 steps
+        int step_exponent = -126;
+        if (high > low) {
+            step_exponent = std::max(-126, static_cast<int>(std::ceil(std::log2((high - low) / 255.0f))));
+        }
+        float step = std::ldexp(1.0f, step_exponent);
+        while (low + 255 * step < high) {
+            step_exponent++;
+            step *= 2;
+        }
+        origin[axis] = low;
+        exponent[axis] = static_cast<int8_t>(step_exponent);
+
+        for (int c = 0; c < simd::BOX_WIDTH; c++) {
+            if (node.count[c] < 0) {
+                bounds[axis][c] = bounds[axis + 3][c] = 0;
+                continue;
+            }
+            // Round outwards, checked against the decoded plane since adding the origin rounds too
+            float min = node.bounds[axis][c], max = node.bounds[axis + 3][c];
+            int q_min = std::clamp(static_cast<int>(std::floor((min - low) / step)), 0, 255);
+            int q_max = std::clamp(static_cast<int>(std::ceil((max - low) / step)), 0, 255);
+            while (q_min > 0 && low + q_min * step > min) q_min--;
+            while (q_max < 255 && low + q_max * step < max) q_max++;
+            bounds[axis][c] = static_cast<uint8_t>(q_min);
+            bounds[axis + 3][c] = static_cast<uint8_t>(q_max);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdint>
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    auto address = reinterpret_cast<uintptr_t>(head);
+    uintptr_t aligned = (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    if (head == nullptr || aligned + size > reinterpret_cast<uintptr_t>(end)) {
+        // Oversized requests are placed alone, so the current block keeps its free space
+        size_t alloc_size = std::max(size + alignment, block_size);
+        auto* block = static_cast<std::byte*>(::operator new(alloc_size, std::align_val_t(BLOCK_ALIGNMENT)));
+        blocks.emplace_back(block);
+        capacity += alloc_size;
+        if (alloc_size > block_size) {
+            used += size;
+            auto start = reinterpret_cast<uintptr_t>(block);
+            return reinterpret_cast<void*>((start + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+        }
+        head = block;
+        end = block + alloc_size;
+        address = reinterpret_cast<uintptr_t>(head);
+        aligned = (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    }
+    head = reinterpret_cast<std::byte*>(aligned + size);
+    used += size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void Arena::clear() {
+    for (auto destructor = destructors.rbegin(); destructor != destructors.rend(); destructor++) {
+        destructor->destroy(destructor->objects, destructor->count);
+    }
+    destructors.clear();
+    blocks.clear();
+    head = end = nullptr;
+    capacity = used = 0;
+}
@@ -2,7 +2,8 @@
 
 float IdealDiffuseBSDF::sample(Interaction& interaction, RandomSampler& sampler) const {
     // Generate a random direction
-    float theta = sampler.get1D(), phi = sampler.get1D();
+    Vec2f u = sampler.get2D();
+    float theta = u.x(), phi = u.y();
     float x = cosf(2 * PI * theta) * sqrtf(phi),
         y = sinf(2 * PI * theta) * sqrtf(phi),
         z = sqrtf(1 - phi);
@@ -12,8 +13,8 @@ float IdealDiffuseBSDF::sample(Interaction& interaction, RandomSampler& sampler)
 
     interaction.w_i = new_wi;
 
-    // Return the probability
-    float pdf = sqrtf(1 - phi) / PI;
+    // Return the probability: cos(theta) / PI, matching getPDF
+    float pdf = sqrtf(1 - phi) * INV_PI;
     return pdf;
 }
 
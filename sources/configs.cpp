@@ -1,5 +1,6 @@
 #include "configs.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include "nlohmann/json.hpp"
@@ -24,6 +25,105 @@ void Config::loadConfig(std::string config_file_path) {
     // Basic Configs
     raw["spp"].get_to(spp);
     raw["max_depth"].get_to(max_depth);
+    rr_depth = raw.value("rr_depth", 2);
+    threads = raw.value("threads", 0);
+    std::string sampler = raw.value("sampler", "random");
+    if (sampler == "random") {
+        sampler_type = SamplerType::Random;
+    } else if (sampler == "sobol") {
+        sampler_type = SamplerType::Sobol;
+    } else if (sampler == "halton") {
+        sampler_type = SamplerType::Halton;
+    } else {
+        printf("Unknown sampler: %s, use random\n", sampler.c_str());
+    }
+    seed = raw.value("seed", 0u);
+    std::string integrator = raw.value("integrator", "path");
+    if (integrator == "path") {
+        integrator_type = IntegratorType::Path;
+    } else if (integrator == "wavefront") {
+        integrator_type = IntegratorType::Wavefront;
+    } else {
+        printf("Unknown integrator: %s, use path\n", integrator.c_str());
+    }
+    std::string indirect = raw.value("indirect", "path");
+    if (indirect == "path") {
+        indirect_type = IndirectType::Path;
+    } else if (indirect == "photon_map") {
+        indirect_type = IndirectType::PhotonMap;
+    } else {
+        printf("Unknown indirect: %s, use path\n", indirect.c_str());
+    }
+    if (raw.contains("photon_map")) {
+        auto photon_map = raw["photon_map"];
+        photon_map_config.photons = std::max(1, photon_map.value("photons", photon_map_config.photons));
+        photon_map_config.neighbors = std::max(1, photon_map.value("neighbors", photon_map_config.neighbors));
+        photon_map_config.radius = std::max(EPS, photon_map.value("radius", photon_map_config.radius));
+    }
+    std::string light_sampler = raw.value("light_sampler", "bvh");
+    if (light_sampler == "uniform") {
+        light_sampler_type = LightSamplerType::Uniform;
+    } else if (light_sampler == "power") {
+        light_sampler_type = LightSamplerType::Power;
+    } else if (light_sampler == "bvh") {
+        light_sampler_type = LightSamplerType::BVH;
+    } else {
+        printf("Unknown light sampler: %s, use bvh\n", light_sampler.c_str());
+    }
+    std::string dispatch = raw.value("dispatch", "static");
+    if (dispatch == "static") {
+        dispatch_type = DispatchType::Static;
+    } else if (dispatch == "virtual") {
+        dispatch_type = DispatchType::Virtual;
+    } else {
+        printf("Unknown dispatch: %s, use static\n", dispatch.c_str());
+    }
+    std::string mode = raw.value("render_mode", "final");
+    if (mode == "final") {
+        render_mode = RenderMode::Final;
+    } else if (mode == "progressive") {
+        render_mode = RenderMode::Progressive;
+    } else {
+        printf("Unknown render mode: %s, use final\n", mode.c_str());
+    }
+    noise_threshold = raw.value("noise_threshold", 0.01f);
+    max_passes = std::max(1, raw.value("max_passes", 64));
+    time_budget = raw.value("time_budget", 0.0f);
+    std::string tile_trace_output = raw.value("tile_trace", "none");
+    if (tile_trace_output == "none") {
+        tile_trace = TileTraceOutput::None;
+    } else if (tile_trace_output == "chrome") {
+        tile_trace = TileTraceOutput::Chrome;
+    } else if (tile_trace_output == "heatmap") {
+        tile_trace = TileTraceOutput::Heatmap;
+    } else if (tile_trace_output == "both") {
+        tile_trace = TileTraceOutput::Both;
+    } else {
+        printf("Unknown tile trace: %s, use none\n", tile_trace_output.c_str());
+    }
+    std::string pixel_format = raw.value("framebuffer", "float");
+    if (pixel_format == "float") {
+        framebuffer = PixelFormat::Float;
+    } else if (pixel_format == "half") {
+        framebuffer = PixelFormat::Half;
+    } else if (pixel_format == "rgbe") {
+        framebuffer = PixelFormat::RGBE;
+    } else {
+        printf("Unknown framebuffer: %s, use float\n", pixel_format.c_str());
+    }
+    std::string image_format = raw.value("output_format", "png");
+    if (image_format == "png") {
+        output_format = ImageFormat::PNG;
+    } else if (image_format == "exr") {
+        output_format = ImageFormat::EXR;
+    } else if (image_format == "pfm") {
+        output_format = ImageFormat::PFM;
+    } else if (image_format == "ppm") {
+        output_format = ImageFormat::PPM;
+    } else {
+        printf("Unknown output format: %s, use png\n", image_format.c_str());
+    }
+    stream_tiles = raw.value("stream_tiles", false);
     int img_w, img_h;
     raw["image_resolution"][0].get_to(img_w);
     raw["image_resolution"][1].get_to(img_h);
@@ -44,6 +144,37 @@ void Config::loadConfig(std::string config_file_path) {
 
     camera["focal_length"].get_to(camera_config.focal_length);
 
+    // Camera path: keyframes override the keys of cam_config they set
+    if (raw.contains("camera_path")) {
+        auto path = raw["camera_path"];
+        for (auto key : path["keyframes"]) {
+            CameraKeyframe keyframe { key.value("frame", 0), camera_config };
+            auto read_vec3 = [&](const char* name, Vec3f& value) {
+                if (!key.contains(name)) return;
+                for (int i = 0; i < 3; i++) key[name][i].get_to(value[i]);
+            };
+            read_vec3("position", keyframe.camera.position);
+            read_vec3("look_at", keyframe.camera.look_at);
+            read_vec3("ref_up", keyframe.camera.ref_up);
+            keyframe.camera.fov = key.value("vertical_fov", keyframe.camera.fov);
+            keyframe.camera.focal_length = key.value("focal_length", keyframe.camera.focal_length);
+            camera_path.push_back(keyframe);
+        }
+        std::sort(camera_path.begin(), camera_path.end(), [](const CameraKeyframe& a, const CameraKeyframe& b) {
+            return a.frame < b.frame;
+        });
+        int last_frame = camera_path.empty() ? 0 : camera_path.back().frame;
+        frame_count = std::max(1, path.value("frames", last_frame + 1));
+    }
+
+    if (raw.contains("lightformer")) {
+        auto lightformer = raw["lightformer"];
+        lightformer_config.direct_vpls = std::max(1, lightformer.value("direct_vpls", lightformer_config.direct_vpls));
+        lightformer_config.indirect_per_direct = std::max(0, lightformer.value("indirect_per_direct", lightformer_config.indirect_per_direct));
+        lightformer_config.shadow_samples = std::max(1, lightformer.value("shadow_samples", lightformer_config.shadow_samples));
+        lightformer_config.output = lightformer.value("output", lightformer_config.output);
+    }
+
     printf("Camera Config - ");
     // Light Configs
     for (auto light : raw["light_config"]) {
@@ -76,6 +207,7 @@ void Config::loadConfig(std::string config_file_path) {
     }
     printf("Material Config - ");
     // Object Configs
+    std::string mesh_cache = raw.value("mesh_cache", "");
     for (auto object : raw["objects"]) {
         ObjectConfig object_config;
         object_config.path = object["obj_file_path"];
@@ -84,7 +216,58 @@ void Config::loadConfig(std::string config_file_path) {
         object["translate"][1].get_to(object_config.translate.y());
         object["translate"][2].get_to(object_config.translate.z());
         object["scale"].get_to(object_config.scale);
+        object_config.has_accel = object.value("has_acc", 0);
+        std::string accel = object.value("accel", "bvh");
+        if (accel == "bvh") {
+            object_config.accel_type = AccelType::BVH;
+        } else if (accel == "grid") {
+            object_config.accel_type = AccelType::Grid;
+        } else {
+            printf("Unknown accel type: %s, use bvh\n", accel.c_str());
+        }
+        std::string bvh_build = object.value("bvh_build", "sweep");
+        if (bvh_build == "sweep") {
+            object_config.bvh_build = BVHBuildType::Sweep;
+        } else if (bvh_build == "binned") {
+            object_config.bvh_build = BVHBuildType::Binned;
+        } else if (bvh_build == "lbvh") {
+            object_config.bvh_build = BVHBuildType::LBVH;
+        } else {
+            printf("Unknown bvh build: %s, use sweep\n", bvh_build.c_str());
+        }
+        object_config.compact_bvh = object.value("compact_bvh", false);
+        object_config.grid_resolution = object.value("grid_resolution", 0);
+        object_config.cache_dir = mesh_cache;
         objects_config.push_back(object_config);
     }
     printf("Object Config -\n");
+
+    nlohmann::json scene;
+    for (const char* key: { "light_config", "materials", "objects", "mesh_cache", "light_sampler", "dispatch" }) {
+        if (raw.contains(key)) scene[key] = raw[key];
+    }
+    scene_key = scene.dump();
+}
+
+CameraConfig Config::getCameraConfig(int frame) const {
+    if (camera_path.empty()) {
+        return camera_config;
+    }
+    if (frame <= camera_path.front().frame) {
+        return camera_path.front().camera;
+    }
+    for (size_t i = 1; i < camera_path.size(); i++) {
+        const auto& next = camera_path[i];
+        if (frame > next.frame) continue;
+        const auto& prev = camera_path[i - 1];
+        float t = next.frame > prev.frame ? static_cast<float>(frame - prev.frame) / static_cast<float>(next.frame - prev.frame) : 1.0f;
+        CameraConfig camera = prev.camera;
+        camera.position = (1 - t) * prev.camera.position + t * next.camera.position;
+        camera.look_at = (1 - t) * prev.camera.look_at + t * next.camera.look_at;
+        camera.ref_up = ((1 - t) * prev.camera.ref_up + t * next.camera.ref_up).normalized();
+        camera.fov = (1 - t) * prev.camera.fov + t * next.camera.fov;
+        camera.focal_length = (1 - t) * prev.camera.focal_length + t * next.camera.focal_length;
+        return camera;
+    }
+    return camera_path.back().camera;
 }
\ No newline at end of file
@@ -1,32 +1,50 @@
 #include "geometry.hpp"
 #include <iostream>
-// Tiny obj loader
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include <algorithm>
+#include "obj_loader.hpp"
 
-bool Triangle::intersect(const Ray& ray, Interaction& interaction) const {
+bool Triangle::intersect(const Ray& ray, HitRecord& hit) const {
     // Moller Trumbore Algorithm
     Vec3f o = ray.getOrigin(), d = ray.getDirection();
-    float tmin = ray.getTMin(), tmax = ray.getTMax();
+    float tmin = ray.getTMin();
 
     Vec3f e1 = v1 - v0, e2 = v2 - v0;
     Vec3f s = o - v0, s1 = d.cross(e2), s2 = s.cross(e1);
     Vec3f ans = (1 / s1.dot(e1)) * Vec3f(s2.dot(e2), s1.dot(s), s2.dot(d));
     float t = ans.x(), u = ans.y(), v = ans.z();
 
-    if (t >= tmin && u >= 0 && v >= 0 && u + v <= 1) {
-        interaction.distance = t;
-        interaction.position = ray(t);
-        interaction.normal = normal.normalized();
-        interaction.type = Interaction::InterType::GEOMETRY;
-        interaction.material = material;
+    if (t >= tmin && t < hit.t && u >= 0 && v >= 0 && u + v <= 1) {
+        hit.t = t;
+        hit.prim_id = 0;
+        hit.u = u;
+        hit.v = v;
 
         return true;
     }
     return false;
 }
 
-bool Rectangle::intersect(const Ray& ray, Interaction& interaction) const {
+void Triangle::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    interaction.distance = hit.t;
+    interaction.position = ray(hit.t);
+    interaction.normal = normal.normalized();
+    interaction.type = Interaction::InterType::GEOMETRY;
+    interaction.uv = Vec2f(hit.u, hit.v);
+    interaction.material = material;
+}
+
+bool Triangle::occluded(const Ray& ray) const {
+    Vec3f o = ray.getOrigin(), d = ray.getDirection();
+
+    Vec3f e1 = v1 - v0, e2 = v2 - v0;
+    Vec3f s = o - v0, s1 = d.cross(e2), s2 = s.cross(e1);
+    Vec3f ans = (1 / s1.dot(e1)) * Vec3f(s2.dot(e2), s1.dot(s), s2.dot(d));
+    float t = ans.x(), u = ans.y(), v = ans.z();
+
+    return t > ray.getTMin() && t < ray.getTMax() && u >= 0 && v >= 0 && u + v <= 1;
+}
+
+bool Rectangle::intersect(const Ray& ray, HitRecord& hit) const {
     Vec3f o = ray.getOrigin(), d = ray.getDirection();
     float width = size.x(), height = size.y();
 
@@ -41,50 +59,80 @@ bool Rectangle::intersect(const Ray& ray, Interaction& interaction) const {
     Vec3f y_tangent = normal.cross(tangent);
     float dw = delta_vec.dot(tangent.normalized()), dh = delta_vec.dot(y_tangent.normalized());
 
-    if (t >= 0 && -width/2 <= dw && dw <= width/2 && -height/2 <= dh && dh <= height/2) {
-        interaction.distance = t;
-        interaction.position = intersect_point;
-        interaction.normal = normal.normalized();
-        interaction.type = Interaction::InterType::GEOMETRY;
-        interaction.material = material;
-
+    if (t >= 0 && t > ray.getTMin() && t < hit.t && -width/2 <= dw && dw <= width/2 && -height/2 <= dh && dh <= height/2) {
+        hit.t = t;
+        hit.prim_id = 0;
+        hit.u = dw / width + 0.5f;
+        hit.v = dh / height + 0.5f;
 
         return true;
     }
     return false;
 }
 
+void Rectangle::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    interaction.distance = hit.t;
+    interaction.position = ray(hit.t);
+    interaction.normal = normal.normalized();
+    interaction.type = Interaction::InterType::GEOMETRY;
+    interaction.uv = Vec2f(hit.u, hit.v);
+    interaction.material = material;
+}
 
-bool Ellipsoid::intersect(const Ray& ray, Interaction& interaction) const {
-    // Transform to unit sphere
-    Mat4f T, R, S;
-    T << 1, 0, 0, p.x(),
-         0, 1, 0, p.y(),
-         0, 0, 1, p.z(),
-         0, 0, 0, 1;
-    Vec3f normalized_a = a.normalized(), normalized_b = b.normalized(), normalized_c = c.normalized();
-    R << normalized_a.x(), normalized_b.x(), normalized_c.x(), 0,
-         normalized_a.y(), normalized_b.y(), normalized_c.y(), 0,
-         normalized_a.z(), normalized_b.z(), normalized_c.z(), 0,
-         0, 0, 0, 1;
-    S << a.norm(), 0, 0, 0,
-            0, b.norm(), 0, 0,
-            0, 0, c.norm(), 0,
-            0, 0, 0, 1;
-    Mat4f M = T * R * S;
-    Mat4f M_inv = M.inverse();
-
-    Vec4f origin_4d = Vec4f(ray.getOrigin().x(), ray.getOrigin().y(), ray.getOrigin().z(), 1),
-            direction_4d = Vec4f(ray.getDirection().x(), ray.getDirection().y(), ray.getDirection().z(), 0);
-    
-    Vec4f origin_4d_transformed = M_inv * origin_4d, direction_4d_transformed = M_inv * direction_4d;
 
-    Vec3f origin_transformed = Vec3f(origin_4d_transformed.x(), origin_4d_transformed.y(), origin_4d_transformed.z()),
-            direction_transformed = Vec3f(direction_4d_transformed.x(), direction_4d_transformed.y(), direction_4d_transformed.z());
-    
+void Ellipsoid::precompute() {
+    // The linear part of T * R * S maps the unit sphere onto the ellipsoid: its columns are a, b, c
+    Mat3f M;
+    M.col(0) = a;
+    M.col(1) = b;
+    M.col(2) = c;
+    world_to_object = M.inverse();
+    normal_matrix = world_to_object.transpose();
+
+    // Exact bounds: the half extent along each axis is the norm of the matching row of M
+    Vec3f half_extent = M.rowwise().norm();
+    aabb = AABB(p - half_extent, p + half_extent);
+
+    float ab = a.dot(b), bc = b.dot(c), ca = c.dot(a);
+    float tolerance = EPS * std::max({ a.squaredNorm(), b.squaredNorm(), c.squaredNorm() });
+    bool orthogonal = std::abs(ab) <= tolerance && std::abs(bc) <= tolerance && std::abs(ca) <= tolerance;
+    bool equal_radii = std::abs(a.norm() - b.norm()) <= EPS && std::abs(b.norm() - c.norm()) <= EPS;
+    bool axis_aligned = (M - Mat3f(M.diagonal().asDiagonal())).cwiseAbs().maxCoeff() <= EPS;
+
+    radius = a.norm();
+    inv_radii = M.diagonal().cwiseInverse();
+    if (orthogonal && equal_radii) {
+        shape = Shape::Sphere;
+    }
+    else if (axis_aligned) {
+        shape = Shape::AxisAligned;
+    }
+    else {
+        shape = Shape::General;
+    }
+}
 
-    // Solve the quadratic equation
+bool Ellipsoid::intersect(const Ray& ray, HitRecord& hit) const {
+    // Transform to unit sphere (for spheres, scale to radius instead)
+    Vec3f origin_transformed, direction_transformed;
     float radius = 1;
+    switch (shape) {
+    case Shape::Sphere:
+        origin_transformed = ray.getOrigin() - p;
+        direction_transformed = ray.getDirection();
+        radius = this->radius;
+        break;
+    case Shape::AxisAligned:
+        origin_transformed = (ray.getOrigin() - p).cwiseProduct(inv_radii);
+        direction_transformed = ray.getDirection().cwiseProduct(inv_radii);
+        break;
+    default:
+        origin_transformed = world_to_object * (ray.getOrigin() - p);
+        direction_transformed = world_to_object * ray.getDirection();
+        break;
+    }
+
+    // Solve the quadratic equation
     float a = direction_transformed.dot(direction_transformed), 
             b = 2 * origin_transformed.dot(direction_transformed), 
             c = origin_transformed.dot(origin_transformed) - radius * radius;
@@ -106,52 +154,176 @@ bool Ellipsoid::intersect(const Ray& ray, Interaction& interaction) const {
             return false;
         }
 
-        if (t < ray.getTMin()){// || t > ray.getTMax()) {
+        if (t < ray.getTMin() || t >= hit.t) {
             return false;
         }
 
-        //Mat3f M_inv_transpose = M_inv.block<3, 3>(0, 0).transpose();
-        Mat3f M_3 = M.block(0, 0, 3, 3);
-        Mat3f M_inv_transpose = M_3.inverse().transpose();
-        
-        //Vec3f position = ray(t);
-        //Vec3f normal = M_inv_transpose * (position - p);
-
-        Vec3f position = origin_transformed + t * direction_transformed;
-        Vec3f normal = M_inv_transpose * position;
-
-
-        interaction.distance = t;
-        interaction.position = ray(t);
-        interaction.normal = normal.normalized();
-        interaction.type = Interaction::InterType::GEOMETRY;
-        interaction.material = material;
-
+        hit.t = t;
+        hit.prim_id = 0;
         return true;
     }
     return false;
 }
 
-bool Ground::intersect(const Ray& ray, Interaction& interaction) const {
+void Ellipsoid::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    // Gradient of the implicit surface at the hit, from its offset to the center
+    Vec3f offset = ray(hit.t) - p;
+    Vec3f normal;
+    switch (shape) {
+    case Shape::Sphere:
+        normal = offset;
+        break;
+    case Shape::AxisAligned:
+        normal = offset.cwiseProduct(inv_radii).cwiseProduct(inv_radii);
+        break;
+    default:
+        normal = normal_matrix * (world_to_object * offset);
+        break;
+    }
+
+    interaction.distance = hit.t;
+    interaction.position = ray(hit.t);
+    interaction.normal = normal.normalized();
+    interaction.type = Interaction::InterType::GEOMETRY;
+    interaction.material = material;
+}
+
+bool Ground::intersect(const Ray& ray, HitRecord& hit) const {
     float t = (z - ray.getOrigin().z()) / ray.getDirection().z();
-    if (t < ray.getTMin()){// || t > ray.getTMax()) {
+    if (t < ray.getTMin() || t >= hit.t) {
         return false;
     }
-    
-    interaction.distance = t;
-    interaction.position = ray(t);  
+
+    hit.t = t;
+    hit.prim_id = 0;
+    return true;
+}
+
+void Ground::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    interaction.distance = hit.t;
+    interaction.position = ray(hit.t);
     interaction.normal = Vec3f(0, 0, 1);
     interaction.type = Interaction::InterType::GEOMETRY;
     interaction.material = material;
+}
+
+Mesh::Mesh(const ObjectConfig& object_config, int load_threads, int build_threads):
+    Geometry(GeometryType::Mesh), has_accel(object_config.has_accel), accel_type(object_config.accel_type),
+    grid_resolution(object_config.grid_resolution), bvh_build(object_config.bvh_build), compact_bvh(object_config.compact_bvh),
+    build_threads(build_threads) {
+    // Grids are not serialized, so only BVH and plain meshes are cached
+    bool use_cache = !object_config.cache_dir.empty() && !(has_accel && accel_type == AccelType::Grid);
+    uint64_t key = use_cache ? mesh_cache::computeKey(object_config) : 0;
+    std::string cache_path = key != 0 ? mesh_cache::getPath(object_config.cache_dir, object_config.path, key) : "";
+    {
+        stats::ScopedTimer timer(stats::LoadTime);
+        if (key != 0 && loadCache(cache_path, key)) {
+            if (stats::ENABLED) std::cout << "Mesh Cache: " << cache_path << std::endl;
+            return;
+        }
+        // Load obj file
+        loadObj(object_config.path, load_threads);
+        transformObj(object_config.translate, object_config.scale);
+        updateAABB();
+    }
+    {
+        stats::ScopedTimer timer(stats::BuildTime);
+        buildTriangleAccel();
+    }
+    if (key != 0) {
+        saveCache(cache_path, key);
+    }
+}
 
+bool Mesh::loadCache(const std::string& path, uint64_t key) {
+    auto file = mesh_cache::open(path, key);
+    if (file == nullptr) {
+        return false;
+    }
+    const auto& header = mesh_cache::getHeader(*file);
+    auto floats = mesh_cache::getSection<float>(*file, mesh_cache::TriangleFloats);
+    auto ints = mesh_cache::getSection<int>(*file, mesh_cache::TriangleInts);
+    auto nodes = mesh_cache::getSection<WideBVHNode>(*file, mesh_cache::BVHNodes);
+    auto compact_nodes = mesh_cache::getSection<CompactWideBVHNode>(*file, mesh_cache::CompactBVHNodes);
+    size_t triangle_count = header.triangle_count;
+    if (floats.size() != TriangleSoA::getFloatCount(triangle_count) || ints.size() != TriangleSoA::getIntCount(triangle_count) ||
+        (has_accel && nodes.empty() && compact_nodes.empty())) {
+        return false;
+    }
+
+    vertices.clear();
+    normals.clear();
+    v_indices.clear();
+    n_indices.clear();
+    cache = file;
+    cached_normals = mesh_cache::getSection<Vec3f>(*file, mesh_cache::Normals);
+    triangles.setExternal(triangle_count, floats.data(), ints.data());
+    if (has_accel && !compact_nodes.empty()) {
+        bvh.setNodes(compact_nodes);
+    }
+    else if (has_accel) {
+        bvh.setNodes(nodes);
+    }
+    aabb = AABB(
+        Vec3f(header.aabb_min[0], header.aabb_min[1], header.aabb_min[2]),
+        Vec3f(header.aabb_max[0], header.aabb_max[1], header.aabb_max[2])
+    );
     return true;
 }
 
-Mesh::Mesh(const ObjectConfig& object_config) {
-    // Load obj file
-    loadObj(object_config.path);
-    transformObj(object_config.translate, object_config.scale);
+void Mesh::saveCache(const std::string& path, uint64_t key) const {
+    static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Vec3f sections are stored as packed floats");
+    size_t triangle_count = triangles.size();
+    mesh_cache::Header header {};
+    header.node_size = sizeof(WideBVHNode);
+    header.compact_node_size = sizeof(CompactWideBVHNode);
+    header.key = key;
+    header.triangle_count = triangle_count;
+    for (int axis = 0; axis < 3; axis++) {
+        header.aabb_min[axis] = aabb.getMin()[axis];
+        header.aabb_max[axis] = aabb.getMax()[axis];
+    }
+    utils::Span<const WideBVHNode> nodes = bvh.getNodes();
+    utils::Span<const CompactWideBVHNode> compact_nodes = bvh.getCompactNodes();
+    utils::Span<const uint8_t> sections[mesh_cache::SECTION_COUNT] = {};
+    sections[mesh_cache::TriangleFloats] = mesh_cache::asBytes(triangles.getFloats(), TriangleSoA::getFloatCount(triangle_count));
+    sections[mesh_cache::TriangleInts] = mesh_cache::asBytes(triangles.getInts(), TriangleSoA::getIntCount(triangle_count));
+    sections[mesh_cache::Normals] = mesh_cache::asBytes(normals);
+    sections[mesh_cache::Vertices] = mesh_cache::asBytes(vertices);
+    sections[mesh_cache::VertexIndices] = mesh_cache::asBytes(v_indices);
+    sections[mesh_cache::BVHNodes] = mesh_cache::asBytes(nodes.data(), has_accel ? nodes.size() : 0);
+    sections[mesh_cache::CompactBVHNodes] = mesh_cache::asBytes(compact_nodes.data(), has_accel ? compact_nodes.size() : 0);
+    if (!mesh_cache::write(path, header, sections)) {
+        std::cerr << "Failed to write mesh cache: " << path << std::endl;
+    }
+}
+
+void Mesh::loadBuildData() {
+    if (cache == nullptr) {
+        return;
+    }
+    auto cached_vertices = mesh_cache::getSection<Vec3f>(*cache, mesh_cache::Vertices);
+    auto cached_indices = mesh_cache::getSection<int>(*cache, mesh_cache::VertexIndices);
+    vertices.assign(cached_vertices.begin(), cached_vertices.end());
+    normals.assign(cached_normals.begin(), cached_normals.end());
+    v_indices.assign(cached_indices.begin(), cached_indices.end());
+    int triangle_count = getTriangleCount();
+    const int* normal_indices[3] = { triangles.get(TriangleSoA::N0), triangles.get(TriangleSoA::N1), triangles.get(TriangleSoA::N2) };
+    n_indices.resize(3 * triangle_count);
+    for (int i = 0; i < triangle_count; i++) {
+        for (int k = 0; k < 3; k++) {
+            n_indices[3 * i + k] = normal_indices[k][i];
+        }
+    }
+
+    // Own every array before the mapping goes away
+    buildTriangles();
+    bvh.ownNodes();
+    cached_normals = {};
+    cache = nullptr;
+}
 
+void Mesh::updateAABB() {
     aabb = AABB(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
     for (size_t i = 0; i < v_indices.size(); i += 3) {
         Vec3f v0 = vertices[v_indices[i]];
@@ -162,99 +334,316 @@ Mesh::Mesh(const ObjectConfig& object_config) {
     aabb.Update();
 }
 
-void Mesh::loadObj(const std::string& path) {
+void Mesh::loadObj(const std::string& path, int threads) {
     /* 
     Load Object filename(end with `.obj`) to this Mesh Object.
     Noticed that this object file have no materials.
     */
-    
-    // Load obj file
-    tinyobj::ObjReaderConfig readerConfig;
-    tinyobj::ObjReader reader;
-    if (!reader.ParseFromFile(path, readerConfig)) {
-        if (!reader.Error().empty()) {
-            std::cerr << "TinyObjReader: " << reader.Error();
-        }
+    obj_loader::ObjData data;
+    std::string error;
+    if (!obj_loader::load(path, data, threads, error)) {
+        std::cerr << "ObjLoader: " << error << std::endl;
         exit(1);
     }
-    if (!reader.Warning().empty()) {
-        std::cout << "TinyObjReader: " << reader.Warning();
-    }
-
-    auto &attrib = reader.GetAttrib();
-    auto &shapes = reader.GetShapes();
-    auto &materials = reader.GetMaterials();
-
-    // Generate vertices and normals
-    std::vector<Vec3f> vertices, normals;
-    std::vector<int> v_indices, n_indices;
-
-    for(size_t i = 0; i < attrib.vertices.size(); i += 3) {
-        vertices.push_back(Vec3f(attrib.vertices[i], attrib.vertices[i + 1], attrib.vertices[i + 2]));
-    }
-    for(size_t i = 0; i < attrib.normals.size(); i += 3) {
-        normals.push_back(Vec3f(attrib.normals[i], attrib.normals[i + 1], attrib.normals[i + 2]));
-    }
-    for(size_t shape_id = 0; shape_id < shapes.size(); shape_id++) {
-        size_t index_offset = 0;
-        for (size_t face_id = 0; face_id < shapes[shape_id].mesh.num_face_vertices.size(); face_id++) {
-            int fv = shapes[shape_id].mesh.num_face_vertices[face_id];
-            for (size_t v_id = 0; v_id < fv; v_id++) {
-                tinyobj::index_t idx = shapes[shape_id].mesh.indices[index_offset + v_id];
-                v_indices.push_back(idx.vertex_index);
-                n_indices.push_back(idx.normal_index);
-            }
-            index_offset += fv;
-        }
-    }
 
     // Assign to this object
-    this->vertices = vertices;
-    this->normals = normals;
-    this->v_indices = v_indices;
-    this->n_indices = n_indices;
+    cache = nullptr;
+    cached_normals = {};
+    vertices = std::move(data.vertices);
+    normals = std::move(data.normals);
+    v_indices = std::move(data.v_indices);
+    n_indices = std::move(data.n_indices);
 
     std::cout << "Vertices: " << vertices.size() << std::endl;
     std::cout << "Normals: " << normals.size() << std::endl;
 }
 
 void Mesh::transformObj(Vec3f translation, float scale) {
+    loadBuildData();
     // Transform the object
     for (auto& vertex: vertices) {
         vertex = scale * vertex + translation;
     }
+    if (!triangles.empty()) {
+        updateAABB();
+        // The triangles keep their leaf order, so the BVH only needs new bounds
+        if (has_accel && accel_type == AccelType::BVH && !bvh.empty()) {
+            refitBVH();
+            buildTriangles();
+        }
+        else {
+            buildTriangleAccel();
+        }
+    }
 }
 
-bool Mesh::intersectTriangle(const Ray& ray, Interaction& interaction,  const Vec3i& v_index, const Vec3i& n_index) const {
-    Vec3f v0 = vertices[v_index.x()], v1 = vertices[v_index.y()], v2 = vertices[v_index.z()];
-    Vec3f n0 = normals[n_index.x()], n1 = normals[n_index.y()], n2 = normals[n_index.z()];
+void Mesh::buildTriangleAccel() {
+    if (has_accel) {
+        if (accel_type == AccelType::Grid) {
+            buildGrid(grid_resolution);
+        }
+        else {
+            buildBVH();
+        }
+    }
+    buildTriangles();
+}
 
-    Vec3f e1 = v1 - v0, e2 = v2 - v0;
-    Vec3f s = ray.getOrigin() - v0, s1 = ray.getDirection().cross(e2), s2 = s.cross(e1);
-    Vec3f ans = (1 / s1.dot(e1)) * Vec3f(s2.dot(e2), s1.dot(s), s2.dot(ray.getDirection()));
-    float t = ans.x(), u = ans.y(), v = ans.z();
+void Mesh::buildTriangles() {
+    int triangle_count = static_cast<int>(v_indices.size() / 3);
+    triangles.resize(triangle_count);
+    float* v0x = triangles.getOwned(TriangleSoA::V0X), * v0y = triangles.getOwned(TriangleSoA::V0Y), * v0z = triangles.getOwned(TriangleSoA::V0Z);
+    float* e1x = triangles.getOwned(TriangleSoA::E1X), * e1y = triangles.getOwned(TriangleSoA::E1Y), * e1z = triangles.getOwned(TriangleSoA::E1Z);
+    float* e2x = triangles.getOwned(TriangleSoA::E2X), * e2y = triangles.getOwned(TriangleSoA::E2Y), * e2z = triangles.getOwned(TriangleSoA::E2Z);
+    int* n0 = triangles.getOwned(TriangleSoA::N0), * n1 = triangles.getOwned(TriangleSoA::N1), * n2 = triangles.getOwned(TriangleSoA::N2);
+    for (int i = 0; i < triangle_count; i++) {
+        Vec3f v0 = vertices[v_indices[3 * i]], v1 = vertices[v_indices[3 * i + 1]], v2 = vertices[v_indices[3 * i + 2]];
+        Vec3f e1 = v1 - v0, e2 = v2 - v0;
+        v0x[i] = v0.x(); v0y[i] = v0.y(); v0z[i] = v0.z();
+        e1x[i] = e1.x(); e1y[i] = e1.y(); e1z[i] = e1.z();
+        e2x[i] = e2.x(); e2y[i] = e2.y(); e2z[i] = e2.z();
+        n0[i] = n_indices[3 * i];
+        n1[i] = n_indices[3 * i + 1];
+        n2[i] = n_indices[3 * i + 2];
+    }
+}
 
+bool Mesh::intersectTriangle(const Ray& ray, int triangle_id, float t_max, float& t, float& u, float& v) const {
+    const Vec3f& o = ray.getOrigin();
+    const Vec3f& d = ray.getDirection();
+    simd::TriangleArrays arrays = triangles.getArrays();
+    Vec3f e1(arrays.e1[0][triangle_id], arrays.e1[1][triangle_id], arrays.e1[2][triangle_id]),
+        e2(arrays.e2[0][triangle_id], arrays.e2[1][triangle_id], arrays.e2[2][triangle_id]);
+    Vec3f s = o - Vec3f(arrays.v0[0][triangle_id], arrays.v0[1][triangle_id], arrays.v0[2][triangle_id]);
+    Vec3f s1 = d.cross(e2), s2 = s.cross(e1);
+
+    // Compare the unnormalized barycentrics against det, and divide only for an accepted hit
+    float det = s1.dot(e1);
+    float sign = det < 0 ? -1.0f : 1.0f;
+    float abs_det = std::abs(det);
+    float t_scaled = sign * s2.dot(e2), u_scaled = sign * s1.dot(s), v_scaled = sign * s2.dot(d);
+    if (
+        abs_det <= 0 || u_scaled < 0 || v_scaled < 0 || u_scaled + v_scaled > abs_det ||
+        t_scaled < ray.getTMin() * abs_det || t_scaled >= t_max * abs_det
+    ) {
+        return false;
+    }
+    float inv_det = 1 / abs_det;
+    t = t_scaled * inv_det;
+    u = u_scaled * inv_det;
+    v = v_scaled * inv_det;
+    return true;
+}
 
-    if (t >= ray.getTMin() && u >= 0 && v >= 0 && u + v <= 1) {
-        interaction.distance = t;
-        interaction.position = ray(t);
-        interaction.normal = ((1 - u - v) * n0 + u * n1 + v * n2).normalized();
-        interaction.type = Interaction::InterType::GEOMETRY;
-        interaction.material = material;
+void Mesh::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    int triangle_id = hit.prim_id;
+    utils::Span<const Vec3f> shading_normals = getNormals();
+    Vec3f n0 = shading_normals[triangles.get(TriangleSoA::N0)[triangle_id]],
+        n1 = shading_normals[triangles.get(TriangleSoA::N1)[triangle_id]],
+        n2 = shading_normals[triangles.get(TriangleSoA::N2)[triangle_id]];
 
-        return true;
+    interaction.distance = hit.t;
+    interaction.position = ray(hit.t);
+    interaction.normal = ((1 - hit.u - hit.v) * n0 + hit.u * n1 + hit.v * n2).normalized();
+    interaction.type = Interaction::InterType::GEOMETRY;
+    interaction.uv = Vec2f(hit.u, hit.v);
+    interaction.material = material;
+}
+
+void Mesh::buildBVH() {
+    int triangle_count = static_cast<int>(v_indices.size() / 3);
+    std::vector<AABB> triangle_aabbs(triangle_count);
+    for (int i = 0; i < triangle_count; i++) {
+        triangle_aabbs[i] = AABB(
+            vertices[v_indices[3 * i]], vertices[v_indices[3 * i + 1]], vertices[v_indices[3 * i + 2]]
+        );
+    }
+    // Leaf triangles are tested together by the SIMD kernels
+    BVH binary_bvh;
+    binary_bvh.build(triangle_aabbs, 4, bvh_build, build_threads);
+    bvh.build(binary_bvh);
+    if (compact_bvh && !bvh.compress()) {
+        std::cerr << "Compact BVH: a leaf holds more than " << CompactWideBVHNode::MAX_LEAF_COUNT
+            << " triangles, keeping full nodes" << std::endl;
+    }
+
+    // Store triangles in leaf order, so a leaf slot is the triangle id
+    std::vector<int> ordered_v_indices(v_indices.size()), ordered_n_indices(n_indices.size());
+    const auto& prim_indices = binary_bvh.getPrimIndices();
+    for (int slot = 0; slot < triangle_count; slot++) {
+        for (int k = 0; k < 3; k++) {
+            ordered_v_indices[3 * slot + k] = v_indices[3 * prim_indices[slot] + k];
+            ordered_n_indices[3 * slot + k] = n_indices[3 * prim_indices[slot] + k];
+        }
+    }
+    v_indices = std::move(ordered_v_indices);
+    n_indices = std::move(ordered_n_indices);
+
+    if (stats::ENABLED) {
+        std::cout << "BVH Nodes: " << bvh.getNodeCount() << " (" << bvh.getMemorySize() / 1024 << " KB)" << std::endl;
     }
-    return false;
 }
 
-bool Mesh::intersect(const Ray& ray, Interaction& interaction) const {
-    for(int i = 0; i < v_indices.size() / 3; i++) {
-        Vec3i v_index(v_indices[3 * i], v_indices[3 * i + 1], v_indices[3 * i + 2]),
-                n_index(n_indices[3 * i], n_indices[3 * i + 1], n_indices[3 * i + 2]);
-        Interaction itra;
-        if (intersectTriangle(ray, itra, v_index, n_index) && itra.distance < interaction.distance) {
-            interaction = itra;
+void Mesh::refitBVH() {
+    // Triangles are stored in leaf order, so triangle i is slot i
+    int triangle_count = static_cast<int>(v_indices.size() / 3);
+    std::vector<AABB> slot_aabbs(triangle_count);
+    for (int i = 0; i < triangle_count; i++) {
+        slot_aabbs[i] = AABB(
+            vertices[v_indices[3 * i]], vertices[v_indices[3 * i + 1]], vertices[v_indices[3 * i + 2]]
+        );
+    }
+    bvh.refit(slot_aabbs);
+}
+
+void Mesh::buildGrid(int resolution) {
+    int triangle_count = static_cast<int>(v_indices.size() / 3);
+    std::vector<AABB> triangle_aabbs(triangle_count);
+    for (int i = 0; i < triangle_count; i++) {
+        triangle_aabbs[i] = AABB(
+            vertices[v_indices[3 * i]], vertices[v_indices[3 * i + 1]], vertices[v_indices[3 * i + 2]]
+        );
+    }
+    grid = OccupancyGrid(resolution);
+    grid.build(triangle_aabbs);
+
+    if (stats::ENABLED) {
+        Vec3i cells = grid.getResolution();
+        std::cout << "Grid Resolution: " << cells.x() << " x " << cells.y() << " x " << cells.z() << std::endl;
+    }
+}
+
+bool Mesh::occluded(const Ray& ray) const {
+    stats::add(stats::MeshOcclusionTests);
+    if (has_accel && accel_type == AccelType::Grid && !grid.empty()) {
+        return grid.occluded(ray, [&](int triangle_id) {
+            stats::add(stats::TriangleTests);
+            float t, u, v;
+            return intersectTriangle(ray, triangle_id, ray.getTMax(), t, u, v);
+        });
+    }
+
+    const simd::Kernels& kernels = simd::getKernels();
+    simd::RayData ray_data(ray.getOrigin(), ray.getDirection(), ray.getTMin());
+    simd::TriangleArrays arrays = triangles.getArrays();
+    auto occluded_triangles = [&](int first, int count) {
+        stats::add(stats::TriangleTests, count);
+        return kernels.occludedTriangles(arrays, first, count, ray_data, ray.getTMax());
+    };
+    if (has_accel && !bvh.empty()) {
+        return bvh.occluded(ray_data, ray.getTMax(), occluded_triangles);
+    }
+    return occluded_triangles(0, getTriangleCount());
+}
+
+bool Mesh::intersect(const Ray& ray, HitRecord& hit) const {
+    stats::add(stats::MeshIntersects);
+    float t_max = std::min(ray.getTMax(), hit.t);
+    int hit_triangle = -1;
+    float hit_u = 0, hit_v = 0;
+
+    if (has_accel && accel_type == AccelType::Grid && !grid.empty()) {
+        grid.intersect(ray, t_max, [&](int triangle_id, float& t_closest) {
+            stats::add(stats::TriangleTests);
+            float t, u, v;
+            if (intersectTriangle(ray, triangle_id, t_closest, t, u, v)) {
+                t_closest = t;
+                hit_triangle = triangle_id;
+                hit_u = u;
+                hit_v = v;
+                return true;
+            }
+            return false;
+        });
+    }
+    else {
+        const simd::Kernels& kernels = simd::getKernels();
+        simd::RayData ray_data(ray.getOrigin(), ray.getDirection(), ray.getTMin());
+        simd::TriangleArrays arrays = triangles.getArrays();
+        auto intersect_triangles = [&](int first, int count, float& t_closest) {
+            stats::add(stats::TriangleTests, count);
+            float u, v;
+            int triangle_id = kernels.intersectTriangles(arrays, first, count, ray_data, t_closest, u, v);
+            if (triangle_id < 0) return false;
+            hit_triangle = triangle_id;
+            hit_u = u;
+            hit_v = v;
+            return true;
+        };
+        if (has_accel && !bvh.empty()) {
+            bvh.intersect(ray_data, t_max, intersect_triangles);
         }
+        else {
+            intersect_triangles(0, getTriangleCount(), t_max);
+        }
+    }
+
+    if (hit_triangle < 0) {
+        return false;
+    }
+    hit.t = t_max;
+    hit.prim_id = hit_triangle;
+    hit.u = hit_u;
+    hit.v = hit_v;
+    return true;
+}
+
+Instance::Instance(const Geometry* prototype, const Mat4f& object_to_world): Geometry(GeometryType::Instance), prototype(prototype) {
+    material = prototype->getMaterial();
+    setTransform(object_to_world);
+}
+
+void Instance::setTransform(const Mat4f& transform) {
+    object_to_world = transform;
+    world_to_object = object_to_world.inverse();
+    normal_matrix = world_to_object.block<3, 3>(0, 0).transpose();
+
+    // World bounds from the eight transformed corners of the prototype bounds
+    AABB local = prototype->getAABB();
+    aabb = AABB(Vec3f(1e8, 1e8, 1e8), Vec3f(-1e8, -1e8, -1e8));
+    for (int corner = 0; corner < 8; corner++) {
+        Vec3f p(
+            (corner & 1) ? local.getMax().x() : local.getMin().x(),
+            (corner & 2) ? local.getMax().y() : local.getMin().y(),
+            (corner & 4) ? local.getMax().z() : local.getMin().z()
+        );
+        Vec3f world = object_to_world.block<3, 3>(0, 0) * p + object_to_world.block<3, 1>(0, 3);
+        aabb.merge_with(AABB(world, world));
     }
-    return interaction.type != Interaction::InterType::NONE;
+}
+
+static Mat4f placementTransform(const Vec3f& translation, float scale) {
+    Mat4f transform = Mat4f::Identity();
+    transform.block<3, 3>(0, 0) *= scale;
+    transform.block<3, 1>(0, 3) = translation;
+    return transform;
+}
+
+Instance::Instance(const Geometry* prototype, const Vec3f& translation, float scale):
+    Instance(prototype, placementTransform(translation, scale)) {}
+
+Ray Instance::toObjectSpace(const Ray& ray) const {
+    // The direction is not renormalized, so the ray parameter t is the same in both spaces
+    Vec3f origin = world_to_object.block<3, 3>(0, 0) * ray.getOrigin() + world_to_object.block<3, 1>(0, 3),
+        direction = world_to_object.block<3, 3>(0, 0) * ray.getDirection();
+    return Ray(origin, direction, ray.getTMin(), ray.getTMax());
+}
+
+// The prototype is nearly always a Mesh, so its calls are dispatched statically
+bool Instance::occluded(const Ray& ray) const {
+    Ray local = toObjectSpace(ray);
+    return geometry::dispatch(*prototype, [&](const auto& geometry) { return geometry.occluded(local); });
+}
+
+bool Instance::intersect(const Ray& ray, HitRecord& hit) const {
+    Ray local = toObjectSpace(ray);
+    return geometry::dispatch(*prototype, [&](const auto& geometry) { return geometry.intersect(local, hit); });
+}
+
+void Instance::fillInteraction(const Ray& ray, const HitRecord& hit, Interaction& interaction) const {
+    Ray local = toObjectSpace(ray);
+    geometry::dispatch(*prototype, [&](const auto& geometry) { geometry.fillInteraction(local, hit, interaction); });
+    interaction.position = ray(hit.t);
+    interaction.normal = (normal_matrix * interaction.normal).normalized();
+    interaction.material = material;
 }
\ No newline at end of file
@@ -2,7 +2,163 @@
 #include <stb_image_write.h>
 
 #include "image.hpp"
+#include "scheduler.hpp"
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    // Rows converted per write task
+    constexpr int WRITE_STRIP_ROWS = 32;
+
+    /*
+    utils::gammaCorrection is monotonic, so its value at x is the number of
+    its steps below x. The table keeps the value at the bottom of every
+    bucket of 2^16 float bit patterns in [0, 1], and the step thresholds
+    correct it inside the buckets that a step crosses. A bucket spans 2^-7
+    of its value, and so less than one step of 255 x^(1 / 2.2).
+    */
+    class GammaTable {
+    public:
+        GammaTable() {
+            thresholds[0] = 0;
+            for (int level = 1; level < 256; level++) {
+                // Smallest float in [0, 1] that encodes to `level` or more
+                uint32_t low = 0, high = ONE_BITS;
+                while (low < high) {
+                    uint32_t mid = low + (high - low) / 2;
+                    if (utils::gammaCorrection(fromBits(mid)) >= level) high = mid;
+                    else low = mid + 1;
+                }
+                thresholds[level] = fromBits(low);
+            }
+            thresholds[256] = std::numeric_limits<float>::infinity();
+            for (uint32_t bucket = 0; bucket < BUCKETS; bucket++) {
+                starts[bucket] = utils::gammaCorrection(fromBits(bucket << 16));
+            }
+        }
+
+        [[nodiscard]] uint8_t encode(float radiance) const {
+            uint32_t bits;
+            std::memcpy(&bits, &radiance, sizeof(bits));
+            // Negative numbers and NaNs with the sign bit set
+            if (bits >= 0x80000000u) return 0;
+            if (bits >= ONE_BITS) return 255;
+            int level = starts[bits >> 16];
+            return static_cast<uint8_t>(level + (radiance >= thresholds[level + 1]));
+        }
+
+    private:
+        static constexpr uint32_t ONE_BITS = 0x3f800000u;
+        static constexpr uint32_t BUCKETS = (ONE_BITS >> 16) + 1;
+
+        static float fromBits(uint32_t bits) {
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        float thresholds[257];
+        uint8_t starts[BUCKETS];
+    };
+
+    const GammaTable& getGammaTable() {
+        static const GammaTable table;
+        return table;
+    }
+
+    template <typename T>
+    void append(std::string& bytes, T value) {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Header of a single part, uncompressed scanline OpenEXR file with B, G and R channels
+    std::string exrHeader(const Vec2i& resolution, bool half) {
+        std::string header;
+        auto attribute = [&](const char* name, const char* type, int32_t size) {
+            header.append(name, std::strlen(name) + 1);
+            header.append(type, std::strlen(type) + 1);
+            append(header, size);
+        };
+        append<uint32_t>(header, 20000630);
+        append<uint32_t>(header, 2);
+
+        attribute("channels", "chlist", 3 * 18 + 1);
+        for (const char* channel: { "B", "G", "R" }) {
+            header.append(channel, 2);
+            append<int32_t>(header, half ? 1 : 2);
+            // pLinear and reserved bytes, then the sampling rates
+            header.append(4, '\0');
+            append<int32_t>(header, 1);
+            append<int32_t>(header, 1);
+        }
+        header += '\0';
+        attribute("compression", "compression", 1);
+        header += '\0';
+        for (const char* window: { "dataWindow", "displayWindow" }) {
+            attribute(window, "box2i", 16);
+            append<int32_t>(header, 0);
+            append<int32_t>(header, 0);
+            append<int32_t>(header, resolution.x() - 1);
+            append<int32_t>(header, resolution.y() - 1);
+        }
+        attribute("lineOrder", "lineOrder", 1);
+        header += '\0';
+        attribute("pixelAspectRatio", "float", 4);
+        append(header, 1.0f);
+        attribute("screenWindowCenter", "v2f", 8);
+        append(header, 0.0f);
+        append(header, 0.0f);
+        attribute("screenWindowWidth", "float", 4);
+        append(header, 1.0f);
+        header += '\0';
+        return header;
+    }
+}
+
+uint8_t pixel::encodeGamma(float radiance) {
+    return getGammaTable().encode(radiance);
+}
+
+ImageFormat getImageFormat(const std::string& filename) {
+    std::string extension = std::filesystem::path(filename).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (extension == ".exr") return ImageFormat::EXR;
+    if (extension == ".pfm") return ImageFormat::PFM;
+    if (extension == ".ppm") return ImageFormat::PPM;
+    return ImageFormat::PNG;
+}
+
+const char* getExtension(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::EXR: return "exr";
+    case ImageFormat::PFM: return "pfm";
+    case ImageFormat::PPM: return "ppm";
+    default: return "png";
+    }
+}
+
+Image::Image(int weight, int height, PixelFormat format): resolution(weight, height), format(format) {
+    size_t pixels = static_cast<size_t>(resolution.x()) * resolution.y();
+    switch (format) {
+    case PixelFormat::Half:
+        half_data.resize(3 * pixels);
+        break;
+    case PixelFormat::RGBE:
+        rgbe_data.resize(pixels);
+        break;
+    default:
+        data.resize(pixels);
+    }
+}
+
+size_t Image::getMemorySize() const {
+    return data.size() * sizeof(Vec3f) + half_data.size() * sizeof(uint16_t) + rgbe_data.size() * sizeof(uint32_t);
+}
 
 void Image::showImage() {
     for(int y = 0; y < resolution.y(); y++) {
@@ -13,15 +169,271 @@ void Image::showImage() {
     }
 }
 
-void Image::writeImage(const std::string& filename) {
-    std::vector<uint8_t> rgb_data(resolution.x() * resolution.y() * 3);
-    for (int i = 0; i < resolution.x() * resolution.y(); i++) {
-        Vec3f color = data[i];
-        rgb_data[i * 3] = utils::gammaCorrection(color.x());
-        rgb_data[i * 3 + 1] = utils::gammaCorrection(color.y());
-        rgb_data[i * 3 + 2] = utils::gammaCorrection(color.z());
+void Image::writeImage(const std::string& filename, int threads) const {
+    ImageFormat image_format = getImageFormat(filename);
+    int width = resolution.x(), height = resolution.y();
+    int strips = (height + WRITE_STRIP_ROWS - 1) / WRITE_STRIP_ROWS;
+    TaskScheduler scheduler(std::min(threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency()), std::max(strips, 1)));
+
+    if (image_format == ImageFormat::PNG) {
+        // stb compresses the whole 8 bit image at once; its rows go top down, so rows are stored flipped
+        std::vector<uint8_t> rgb_data(static_cast<size_t>(width) * height * 3);
+        const GammaTable& gamma = getGammaTable();
+        scheduler.parallelFor(strips, [&](int strip, int thread) {
+            int y1 = std::min((strip + 1) * WRITE_STRIP_ROWS, height);
+            for (int y = strip * WRITE_STRIP_ROWS; y < y1; y++) {
+                uint8_t* row = &rgb_data[static_cast<size_t>(height - 1 - y) * width * 3];
+                for (int x = 0; x < width; x++) {
+                    Vec3f color = getPixel(x, y);
+                    for (int k = 0; k < 3; k++) row[3 * x + k] = gamma.encode(color[k]);
+                }
+            }
+        });
+        if (!stbi_write_png(filename.c_str(), width, height, 3, rgb_data.data(), width * 3)) {
+            std::cerr << "Failed to write image: " << filename << std::endl;
+        }
+        return;
+    }
+
+    // Decoded a strip at a time, so no full size copy is made
+    RasterFile file;
+    if (!file.open(filename, image_format, resolution, format == PixelFormat::Half)) {
+        return;
+    }
+    scheduler.parallelFor(strips, [&](int strip, int thread) {
+        int y0 = strip * WRITE_STRIP_ROWS, y1 = std::min(y0 + WRITE_STRIP_ROWS, height);
+        std::vector<Vec3f> pixels(static_cast<size_t>(width) * (y1 - y0));
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < width; x++) {
+                pixels[static_cast<size_t>(y - y0) * width + x] = getPixel(x, y);
+            }
+        }
+        file.writeRegion(0, y0, width, y1, pixels.data());
+    });
+}
+
+bool RasterFile::open(const std::string& path, ImageFormat format, const Vec2i& resolution, bool half) {
+    close();
+    if (format == ImageFormat::PNG) {
+        std::cerr << "RasterFile: png has no fixed layout, use exr, pfm or ppm: " << path << std::endl;
+        return false;
+    }
+    this->format = format;
+    this->resolution = resolution;
+    this->half = half && format == ImageFormat::EXR;
+
+    int width = resolution.x(), height = resolution.y();
+    std::string header;
+    size_t row_size;
+    if (format == ImageFormat::PPM) {
+        header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        row_size = static_cast<size_t>(width) * 3;
+    } else if (format == ImageFormat::PFM) {
+        // A negative scale marks little endian floats
+        header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+        row_size = static_cast<size_t>(width) * 3 * sizeof(float);
+    } else {
+        // Every scanline is a block of its y, its byte count and the B, G and R rows, found through the offset table
+        header = exrHeader(resolution, this->half);
+        row_size = 2 * sizeof(int32_t) + static_cast<size_t>(width) * 3 * (this->half ? sizeof(uint16_t) : sizeof(float));
+        size_t first_row = header.size() + static_cast<size_t>(height) * sizeof(uint64_t);
+        for (int row = 0; row < height; row++) {
+            append<uint64_t>(header, first_row + row * row_size);
+        }
+    }
+    header_size = header.size();
+
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    if (format == ImageFormat::EXR) {
+        for (int row = 0; row < height; row++) {
+            std::string block;
+            append<int32_t>(block, row);
+            append<int32_t>(block, static_cast<int32_t>(row_size - 2 * sizeof(int32_t)));
+            file.seekp(static_cast<std::streamoff>(header_size + row * row_size));
+            file.write(block.data(), static_cast<std::streamsize>(block.size()));
+        }
+    }
+    // Lay out every row, so regions are written inside the file
+    file.seekp(static_cast<std::streamoff>(header_size + row_size * height - 1));
+    file.put('\0');
+    if (!file) {
+        std::cerr << "RasterFile: cannot create " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+size_t RasterFile::getOffset(int x, int y) const {
+    size_t width = resolution.x();
+    // PPM and EXR rows go top down, Image and PFM rows bottom up
+    size_t row = static_cast<size_t>(resolution.y() - 1 - y);
+    switch (format) {
+    case ImageFormat::PPM:
+        return header_size + (row * width + x) * 3;
+    case ImageFormat::PFM:
+        return header_size + (static_cast<size_t>(y) * width + x) * 3 * sizeof(float);
+    default: {
+        size_t channel_size = half ? sizeof(uint16_t) : sizeof(float);
+        return header_size + row * (2 * sizeof(int32_t) + 3 * width * channel_size) + 2 * sizeof(int32_t) + x * channel_size;
+    }
+    }
+}
+
+void RasterFile::writeRegion(int x0, int y0, int x1, int y1, const Vec3f* pixels) {
+    size_t width = x1 - x0;
+    size_t channel_size = format == ImageFormat::PPM ? 1 : (half ? sizeof(uint16_t) : sizeof(float));
+    size_t row_bytes = width * 3 * channel_size;
+    std::vector<char> bytes(row_bytes * (y1 - y0));
+    const GammaTable& gamma = getGammaTable();
+    for (int y = y0; y < y1; y++) {
+        const Vec3f* row = pixels + (y - y0) * width;
+        char* out = bytes.data() + (y - y0) * row_bytes;
+        for (size_t x = 0; x < width; x++) {
+            for (int k = 0; k < 3; k++) {
+                if (format == ImageFormat::PPM) {
+                    out[3 * x + k] = static_cast<char>(gamma.encode(row[x][k]));
+                } else if (format == ImageFormat::PFM) {
+                    std::memcpy(out + (3 * x + k) * sizeof(float), &row[x][k], sizeof(float));
+                } else {
+                    // Planar, blue first
+                    char* plane = out + (2 - k) * width * channel_size;
+                    if (half) {
+                        uint16_t value = pixel::floatToHalf(row[x][k]);
+                        std::memcpy(plane + x * sizeof(uint16_t), &value, sizeof(value));
+                    } else {
+                        std::memcpy(plane + x * sizeof(float), &row[x][k], sizeof(float));
+                    }
+                }
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int y = y0; y < y1; y++) {
+        const char* row = bytes.data() + (y - y0) * row_bytes;
+        if (format == ImageFormat::EXR) {
+            size_t plane_bytes = width * channel_size, plane_stride = static_cast<size_t>(resolution.x()) * channel_size;
+            for (int plane = 0; plane < 3; plane++) {
+                file.seekp(static_cast<std::streamoff>(getOffset(x0, y) + plane * plane_stride));
+                file.write(row + plane * plane_bytes, static_cast<std::streamsize>(plane_bytes));
+            }
+        } else {
+            file.seekp(static_cast<std::streamoff>(getOffset(x0, y)));
+            file.write(row, static_cast<std::streamsize>(row_bytes));
+        }
+    }
+}
+
+void RasterFile::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+void Film::addSample(int x, int y, const Vec3f& color) {
+    int i = x + y * resolution.x();
+    Pixel& pixel = pixels[i];
+    pixel.sum += color;
+    pixel.count++;
+    if (variances.empty()) {
+        return;
+    }
+    // Welford update of the luminance statistics
+    Variance& variance = variances[i];
+    float luminance = 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+    float delta = luminance - variance.mean;
+    variance.mean += delta / static_cast<float>(pixel.count);
+    variance.m2 += delta * (luminance - variance.mean);
+}
+
+float Film::getRelativeError(int x, int y) const {
+    int i = x + y * resolution.x();
+    const Pixel& pixel = pixels[i];
+    if (pixel.count < 2 || variances.empty()) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float variance = variances[i].m2 / static_cast<float>(pixel.count - 1);
+    float std_error = sqrtf(variance / static_cast<float>(pixel.count));
+    return std_error / std::max(variances[i].mean, MIN_LUMINANCE);
+}
+
+void Film::develop(Image& image) const {
+    for (int y = 0; y < resolution.y(); y++) {
+        for (int x = 0; x < resolution.x(); x++) {
+            const Pixel& pixel = pixels[x + y * resolution.x()];
+            if (pixel.count > 0) {
+                image.setPixel(x, y, pixel.sum / static_cast<float>(pixel.count));
+            }
+        }
+    }
+}
+
+void Film::clear() {
+    std::fill(pixels.begin(), pixels.end(), Pixel());
+    std::fill(variances.begin(), variances.end(), Variance());
+}
+
+bool Film::writeRows(const std::string& path, int y0, int y1) const {
+    y0 = std::max(y0, 0);
+    y1 = std::min(y1, resolution.y());
+    RowsHeader header {};
+    std::memcpy(header.magic, ROWS_MAGIC, sizeof(ROWS_MAGIC));
+    header.width = resolution.x();
+    header.height = resolution.y();
+    header.y0 = y0;
+    header.y1 = std::max(y0, y1);
+
+    // A temp file of this writer only, the owner and the backup of an item may write it at once
+    std::string temp_path = path + ".XXXXXX";
+    int fd = mkstemp(temp_path.data());
+    if (fd < 0) return false;
+    // mkstemp creates it private, the coordinator may run as another user
+    fchmod(fd, 0644);
+    close(fd);
+    std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+    std::error_code error;
+    if (!stream) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (header.y1 > header.y0) {
+        size_t count = static_cast<size_t>(header.y1 - header.y0) * resolution.x();
+        stream.write(reinterpret_cast<const char*>(&pixels[static_cast<size_t>(y0) * resolution.x()]), static_cast<std::streamsize>(count * sizeof(Pixel)));
+    }
+    stream.close();
+    if (!stream) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
     }
+    return true;
+}
 
-    stbi_flip_vertically_on_write(true);
-    stbi_write_png(filename.c_str(), resolution.x(), resolution.y(), 3, rgb_data.data(), resolution.x() * 3);
-}
\ No newline at end of file
+bool Film::mergeRows(const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    RowsHeader header {};
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, ROWS_MAGIC, sizeof(ROWS_MAGIC)) != 0 ||
+        header.width != resolution.x() || header.height != resolution.y() ||
+        header.y0 < 0 || header.y1 > resolution.y() || header.y0 > header.y1) {
+        return false;
+    }
+    std::vector<Pixel> rows(static_cast<size_t>(header.y1 - header.y0) * resolution.x());
+    if (!stream.read(reinterpret_cast<char*>(rows.data()), static_cast<std::streamsize>(rows.size() * sizeof(Pixel)))) {
+        return false;
+    }
+    if (rows.empty()) return true;
+    Pixel* target = &pixels[static_cast<size_t>(header.y0) * resolution.x()];
+    for (size_t i = 0; i < rows.size(); i++) {
+        target[i].sum += rows[i].sum;
+        target[i].count += rows[i].count;
+    }
+    return true;
+}
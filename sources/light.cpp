@@ -1,5 +1,7 @@
 #include "light.hpp"
 #include "geometry.hpp"
+#include "bsdf.hpp"
+#include <algorithm>
 
 Vec3f SquareAreaLight::emmision(const Vec3f& pos, const Vec3f& dir) const {
     // For Square Light: Only consider the angle between the normal and the direction
@@ -12,14 +14,17 @@ Vec3f SquareAreaLight::emmision(const Vec3f& pos, const Vec3f& dir) const {
 VPL SquareAreaLight::getVPL(Interaction& interaction,  RandomSampler& sampler) const {
     // Do random sampling.
     // For Square Light: Uniform Distribution
-    float dx = sampler.get1D(), dy = sampler.get1D();
+    Vec2f u = sampler.get2D();
+    float dx = u.x(), dy = u.y();
     
     float pdf = 1.0f / (size.x() * size.y());
 
     // Consider the position and the normal
     Vec3f tangent_y = normal.cross(tangent);
     Vec3f sample_pos = position + (dx - 0.5) * size.x() * tangent + (dy - 0.5) * size.y() * tangent_y;
-    return VPL(sample_pos, radiance, pdf);
+    VPL vpl(sample_pos, radiance, pdf);
+    vpl.normal = normal.normalized();
+    return vpl;
 }
 
 float SquareAreaLight::getPDF(const Interaction& interaction) const {
@@ -53,4 +58,74 @@ bool SquareAreaLight::intersect(const Ray& ray, Interaction& interaction) const
         return true;
     }
     return false;
-}
\ No newline at end of file
+}
+
+float SquareAreaLight::getPower() const {
+    // One sided emitter with a cosine lobe
+    float luminance = 0.2126f * radiance.x() + 0.7152f * radiance.y() + 0.0722f * radiance.z();
+    return PI * luminance * size.x() * size.y();
+}
+
+LightBounds SquareAreaLight::getBounds() const {
+    Vec3f tangent_y = normal.cross(tangent);
+    Vec3f half_extent = 0.5f * size.x() * tangent.cwiseAbs() + 0.5f * size.y() * tangent_y.cwiseAbs();
+
+    LightBounds bounds;
+    bounds.aabb = AABB(position - half_extent, position + half_extent);
+    bounds.axis = normal.normalized();
+    bounds.cos_theta_o = 1;
+    bounds.cos_theta_e = 0;
+    bounds.power = getPower();
+    return bounds;
+}
+
+LightBounds LightBounds::merge(const LightBounds& a, const LightBounds& b) {
+    if (a.power <= 0) return b;
+    if (b.power <= 0) return a;
+    LightBounds merged;
+    merged.aabb = AABB(a.aabb, b.aabb);
+    merged.power = a.power + b.power;
+    merged.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+
+    // Smallest cone holding both normal cones
+    float theta_a = acosf(utils::clamp(a.cos_theta_o, -1, 1)), theta_b = acosf(utils::clamp(b.cos_theta_o, -1, 1));
+    float theta_d = acosf(utils::clamp(a.axis.dot(b.axis), -1, 1));
+    if (std::min(theta_d + theta_b, PI) <= theta_a) {
+        merged.axis = a.axis;
+        merged.cos_theta_o = a.cos_theta_o;
+        return merged;
+    }
+    if (std::min(theta_d + theta_a, PI) <= theta_b) {
+        merged.axis = b.axis;
+        merged.cos_theta_o = b.cos_theta_o;
+        return merged;
+    }
+    float theta_o = (theta_a + theta_d + theta_b) / 2;
+    Vec3f rotation_axis = a.axis.cross(b.axis);
+    if (theta_o >= PI || rotation_axis.squaredNorm() < 1e-12f) {
+        // Whole sphere of directions
+        merged.axis = a.axis;
+        merged.cos_theta_o = -1;
+        return merged;
+    }
+    merged.axis = Eigen::AngleAxisf(theta_o - theta_a, rotation_axis.normalized()) * a.axis;
+    merged.cos_theta_o = cosf(theta_o);
+    return merged;
+}
+
+Vec3f light::samplePhoton(const Light& light, const VPL& origin, RandomSampler& sampler, Vec3f& direction) {
+    if (origin.normal.isZero()) {
+        direction = Vec3f(0, 0, 0);
+        return Vec3f(0, 0, 0);
+    }
+    static const IdealDiffuseBSDF cosine_lobe(Vec3f(1, 1, 1));
+    Interaction emission;
+    emission.normal = origin.normal;
+    float pdf = cosine_lobe.sample(emission, sampler);
+    direction = emission.w_i;
+    float cos_theta = origin.normal.dot(direction);
+    if (pdf <= 0 || cos_theta <= 0) return Vec3f(0, 0, 0);
+    // emmision() already holds the cosine falloff of the light, this is the projected area
+    Vec3f radiance = dispatch(light, [&](const auto& emitter) { return emitter.emmision(origin.position, direction); });
+    return radiance * cos_theta / (origin.pdf * pdf);
+}
@@ -0,0 +1,208 @@
+#include "light_sampler.hpp"
+#include <algorithm>
+
+AliasTable::AliasTable(const std::vector<float>& weights) {
+    bins.resize(weights.size());
+    if (weights.empty()) return;
+
+    double sum = 0;
+    for (float weight: weights) sum += std::max(weight, 0.0f);
+    int n = static_cast<int>(weights.size());
+    for (int i = 0; i < n; i++) {
+        bins[i].pmf = sum > 0 ? static_cast<float>(std::max(weights[i], 0.0f) / sum) : 1.0f / n;
+    }
+
+    // Vose: pair each under-full bin with an over-full one
+    std::vector<std::pair<int, double>> under, over;
+    for (int i = 0; i < n; i++) {
+        double scaled = static_cast<double>(bins[i].pmf) * n;
+        (scaled < 1 ? under : over).emplace_back(i, scaled);
+    }
+    while (!under.empty() && !over.empty()) {
+        auto small = under.back();
+        auto large = over.back();
+        under.pop_back();
+        over.pop_back();
+        bins[small.first].q = static_cast<float>(small.second);
+        bins[small.first].alias = large.first;
+
+        double excess = large.second - (1 - small.second);
+        (excess < 1 ? under : over).emplace_back(large.first, excess);
+    }
+    // Leftovers are 1 up to rounding
+    for (const auto& bin: under) bins[bin.first].q = 1;
+    for (const auto& bin: over) bins[bin.first].q = 1;
+}
+
+int AliasTable::sample(float u, float* pmf) const {
+    int n = static_cast<int>(bins.size());
+    float scaled = u * n;
+    int index = std::min(static_cast<int>(scaled), n - 1);
+    float remainder = scaled - index;
+    if (remainder >= bins[index].q) {
+        index = bins[index].alias;
+    }
+    if (pmf) *pmf = bins[index].pmf;
+    return index;
+}
+
+void LightSampler::build(const std::vector<std::shared_ptr<Light>>& lights, LightSamplerType type) {
+    this->type = type;
+    light_count = static_cast<int>(lights.size());
+    nodes.clear();
+    light_trails.assign(lights.size(), 0);
+
+    std::vector<float> powers(lights.size());
+    for (size_t i = 0; i < lights.size(); i++) {
+        powers[i] = lights[i]->getPower();
+    }
+    power_table = AliasTable(powers);
+
+    if (type == LightSamplerType::BVH && !lights.empty()) {
+        std::vector<std::pair<int, LightBounds>> bounds;
+        bounds.reserve(lights.size());
+        for (size_t i = 0; i < lights.size(); i++) {
+            bounds.emplace_back(static_cast<int>(i), lights[i]->getBounds());
+        }
+        nodes.reserve(2 * lights.size());
+        buildRecursive(bounds, 0, static_cast<int>(bounds.size()), 0, 0);
+    }
+}
+
+LightBounds LightSampler::buildRecursive(std::vector<std::pair<int, LightBounds>>& lights, int begin, int end, uint64_t trail, int depth) {
+    int node_id = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        nodes[node_id] = LightBVHNode(lights[begin].second, lights[begin].first, true);
+        light_trails[lights[begin].first] = trail;
+        return lights[begin].second;
+    }
+
+    // Median split along the widest extent of the light centers
+    AABB centers(lights[begin].second.aabb.getCenter(), lights[begin].second.aabb.getCenter());
+    for (int i = begin + 1; i < end; i++) {
+        Vec3f center = lights[i].second.aabb.getCenter();
+        centers.merge_with(AABB(center, center));
+    }
+    int axis = 0;
+    for (int dim = 1; dim < 3; dim++) {
+        if (centers.getSize(dim) > centers.getSize(axis)) axis = dim;
+    }
+    int mid = (begin + end) / 2;
+    std::nth_element(lights.begin() + begin, lights.begin() + mid, lights.begin() + end,
+        [axis](const auto& a, const auto& b) { return a.second.aabb.getCenter()[axis] < b.second.aabb.getCenter()[axis]; });
+
+    // Trails hold 64 levels, far more than a median split of any light count needs
+    LightBounds first = buildRecursive(lights, begin, mid, trail, depth + 1);
+    int second_id = static_cast<int>(nodes.size());
+    LightBounds second = buildRecursive(lights, mid, end, trail | (1ull << depth), depth + 1);
+    LightBounds merged = LightBounds::merge(first, second);
+    nodes[node_id] = LightBVHNode(merged, second_id, false);
+    return merged;
+}
+
+LightSampler::LightBVHNode::LightBVHNode(const LightBounds& bounds, int offset, bool is_leaf):
+    axis(bounds.axis), cos_theta_o(bounds.cos_theta_o), cos_theta_e(bounds.cos_theta_e),
+    power(bounds.power), offset(offset), is_leaf(is_leaf) {
+    center = bounds.aabb.getCenter();
+    Vec3f diagonal = bounds.aabb.getMax() - bounds.aabb.getMin();
+    radius_squared = diagonal.squaredNorm() / 4;
+    min_distance_squared = diagonal.norm() / 2;
+    sin_theta_o = sqrtf(std::max(0.0f, 1 - cos_theta_o * cos_theta_o));
+}
+
+// cos(max(0, a - b)) from the sines and cosines of a and b
+static inline float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    if (cos_a > cos_b) return 1;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+static inline float sinFromCos(float cos_x) {
+    return sqrtf(std::max(0.0f, 1 - cos_x * cos_x));
+}
+
+float LightSampler::LightBVHNode::importance(const Vec3f& p, const Vec3f& n) const {
+    if (power <= 0) return 0;
+    Vec3f to_point = p - center;
+    float distance_squared = to_point.squaredNorm();
+    // Inside the bounds every direction is possible
+    if (distance_squared <= radius_squared) {
+        return power / std::max(distance_squared, min_distance_squared);
+    }
+    Vec3f w = to_point / sqrtf(distance_squared);
+    distance_squared = std::max(distance_squared, min_distance_squared);
+
+    // Angle between the axis and the direction to the point, less the spread of the
+    // normals and the angle the bounds subtend at the point
+    float sin_theta_b = sqrtf(radius_squared / distance_squared), cos_theta_b = sinFromCos(sin_theta_b);
+    float cos_theta_w = axis.dot(w);
+    float cos_theta_x = cosSubClamped(sinFromCos(cos_theta_w), cos_theta_w, sin_theta_o, cos_theta_o);
+    float cos_theta_p = cosSubClamped(sinFromCos(cos_theta_x), cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= cos_theta_e) return 0;
+
+    // Receiver side: the surface may face the bounds up to theta_b closer than their center
+    float cos_theta_i = std::abs(w.dot(n));
+    float cos_theta_r = cosSubClamped(sinFromCos(cos_theta_i), cos_theta_i, sin_theta_b, cos_theta_b);
+    return std::max(power * cos_theta_p * cos_theta_r / distance_squared, 0.0f);
+}
+
+SampledLight LightSampler::sample(const Vec3f& position, const Vec3f& normal, float u) const {
+    if (light_count == 0) return {};
+    if (type == LightSamplerType::Uniform) {
+        return { std::min(static_cast<int>(u * light_count), light_count - 1), 1.0f / light_count };
+    }
+    if (type == LightSamplerType::Power) {
+        SampledLight sampled;
+        sampled.light = power_table.sample(u, &sampled.pmf);
+        return sampled;
+    }
+
+    if (nodes[0].importance(position, normal) <= 0) return {};
+    int node_id = 0;
+    float pmf = 1;
+    while (!nodes[node_id].is_leaf) {
+        const LightBVHNode& node = nodes[node_id];
+        float importance_first = nodes[node_id + 1].importance(position, normal),
+            importance_second = nodes[node.offset].importance(position, normal);
+        if (importance_first <= 0 && importance_second <= 0) return {};
+        float p_first = importance_first / (importance_first + importance_second);
+        // Reuse u for the next level
+        if (u < p_first) {
+            u = std::min(u / p_first, utils::ONE_MINUS_EPSILON);
+            pmf *= p_first;
+            node_id = node_id + 1;
+        }
+        else {
+            u = std::min((u - p_first) / (1 - p_first), utils::ONE_MINUS_EPSILON);
+            pmf *= 1 - p_first;
+            node_id = node.offset;
+        }
+    }
+    return { nodes[node_id].offset, pmf };
+}
+
+float LightSampler::getPMF(const Vec3f& position, const Vec3f& normal, int light) const {
+    if (light < 0 || light >= light_count) return 0;
+    if (type == LightSamplerType::Uniform) return 1.0f / light_count;
+    if (type == LightSamplerType::Power) return power_table.getPMF(light);
+
+    if (nodes[0].importance(position, normal) <= 0) return 0;
+    uint64_t trail = light_trails[light];
+    int node_id = 0;
+    float pmf = 1;
+    for (int depth = 0; !nodes[node_id].is_leaf; depth++) {
+        const LightBVHNode& node = nodes[node_id];
+        float importance_first = nodes[node_id + 1].importance(position, normal),
+            importance_second = nodes[node.offset].importance(position, normal);
+        if (importance_first <= 0 && importance_second <= 0) return 0;
+        float p_first = importance_first / (importance_first + importance_second);
+        if (trail & (1ull << depth)) {
+            pmf *= 1 - p_first;
+            node_id = node.offset;
+        }
+        else {
+            pmf *= p_first;
+            node_id = node_id + 1;
+        }
+    }
+    return pmf;
+}
@@ -0,0 +1,141 @@
+#include "mesh_cache.hpp"
+#include "accel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr char MAGIC[8] = "HRTMESH";
+
+    uint64_t floatBits(float x) {
+        uint32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapped == MAP_FAILED) return nullptr;
+    file->ptr = static_cast<const uint8_t*>(mapped);
+    file->length = static_cast<size_t>(info.st_size);
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (ptr != nullptr) {
+        munmap(const_cast<uint8_t*>(ptr), length);
+    }
+}
+
+uint64_t mesh_cache::computeKey(const ObjectConfig& config) {
+    auto obj = MappedFile::open(config.path);
+    if (obj == nullptr) return 0;
+
+    // Contents of the obj file, 8 bytes at a time
+    uint64_t key = utils::hash(VERSION, obj->size());
+    size_t words = obj->size() / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        std::memcpy(&word, obj->data() + 8 * i, sizeof(word));
+        key = utils::hash(key, word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, obj->data() + 8 * words, obj->size() - 8 * words);
+    key = utils::hash(key, tail);
+
+    // Settings that change the built mesh
+    key = utils::hash(key, floatBits(config.translate.x()), floatBits(config.translate.y()));
+    key = utils::hash(key, floatBits(config.translate.z()), floatBits(config.scale));
+    key = utils::hash(key, static_cast<uint64_t>(config.has_accel), static_cast<uint64_t>(config.accel_type));
+    key = utils::hash(key, static_cast<uint64_t>(config.grid_resolution), static_cast<uint64_t>(simd::BOX_WIDTH));
+    key = utils::hash(key, static_cast<uint64_t>(config.bvh_build), static_cast<uint64_t>(config.compact_bvh));
+    return key != 0 ? key : 1;
+}
+
+std::string mesh_cache::getPath(const std::string& cache_dir, const std::string& obj_path, uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "-%016llx.hrtmesh", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(cache_dir) / (std::filesystem::path(obj_path).stem().string() + name)).string();
+}
+
+bool mesh_cache::write(const std::string& path, Header header, const utils::Span<const uint8_t>* sections) {
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    auto align = [](uint64_t offset) {
+        return (offset + utils::CACHE_LINE_SIZE - 1) / utils::CACHE_LINE_SIZE * utils::CACHE_LINE_SIZE;
+    };
+    uint64_t offset = align(sizeof(Header));
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        header.offsets[i] = offset;
+        header.sizes[i] = sections[i].size();
+        offset = align(offset + sections[i].size());
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    // Written next to the final name and renamed, so a reader never maps a partial file.
+    // The temp file is unique: processes sharing the cache_dir may all write an entry at once
+    std::string temp_path = path + ".XXXXXX";
+    int fd = mkstemp(temp_path.data());
+    if (fd < 0) return false;
+    fchmod(fd, 0644);
+    close(fd);
+    std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+    if (!stream) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    const char zeros[utils::CACHE_LINE_SIZE] = {};
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    uint64_t written = sizeof(Header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        stream.write(zeros, static_cast<std::streamsize>(header.offsets[i] - written));
+        stream.write(reinterpret_cast<const char*>(sections[i].data()), static_cast<std::streamsize>(sections[i].size()));
+        written = header.offsets[i] + sections[i].size();
+    }
+    stream.close();
+    if (!stream) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<MappedFile> mesh_cache::open(const std::string& path, uint64_t key) {
+    auto file = MappedFile::open(path);
+    if (file == nullptr || file->size() < sizeof(Header)) return nullptr;
+    const Header& header = getHeader(*file);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+        header.key != key || header.node_size != sizeof(WideBVHNode) ||
+        header.compact_node_size != sizeof(CompactWideBVHNode)) {
+        return nullptr;
+    }
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        if (header.offsets[i] % utils::CACHE_LINE_SIZE != 0 || header.offsets[i] + header.sizes[i] > file->size()) {
+            return nullptr;
+        }
+    }
+    return file;
+}
@@ -0,0 +1,212 @@
+#include "obj_loader.hpp"
+#include "mesh_cache.hpp"
+#include "scheduler.hpp"
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <thread>
+
+namespace {
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        // Records in the chunk, then the records before it once the counts are summed
+        size_t vertices {0};
+        size_t normals {0};
+        size_t triangles {0};
+    };
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* skipSpaces(const char* p, const char* end) {
+        while (p < end && isSpace(*p)) p++;
+        return p;
+    }
+
+    const char* lineEnd(const char* p, const char* end) {
+        while (p < end && *p != '\n') p++;
+        return p;
+    }
+
+    // End of the fields of the record starting at p: the `#` of a trailing comment, or the line end
+    const char* recordEnd(const char* p, const char* line_end) {
+        while (p < line_end && *p != '#') p++;
+        return p;
+    }
+
+    // Record type of the line starting at p: 'v', 'n' (vn), 'f' or 0 for anything else
+    char recordType(const char* p, const char* end) {
+        if (p + 1 >= end || !isSpace(p[1])) {
+            if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) return 'n';
+            return 0;
+        }
+        return (p[0] == 'v' || p[0] == 'f') ? p[0] : 0;
+    }
+
+    int countTokens(const char* p, const char* end) {
+        int tokens = 0;
+        while (true) {
+            p = skipSpaces(p, end);
+            if (p >= end) return tokens;
+            tokens++;
+            while (p < end && !isSpace(*p)) p++;
+        }
+    }
+
+    const char* parseFloat(const char* p, const char* end, float& value) {
+        p = skipSpaces(p, end);
+        if (p < end && *p == '+') p++;
+        auto result = std::from_chars(p, end, value);
+        return result.ec == std::errc() ? result.ptr : nullptr;
+    }
+
+    const char* parseInt(const char* p, const char* end, long& value) {
+        auto result = std::from_chars(p, end, value);
+        return result.ec == std::errc() ? result.ptr : nullptr;
+    }
+
+    // 1-based or negative (relative to the `before` records so far) obj index to a 0-based one, -1 if invalid
+    int resolveIndex(long index, size_t before, size_t total) {
+        long resolved = index > 0 ? index - 1 : static_cast<long>(before) + index;
+        return (index != 0 && resolved >= 0 && resolved < static_cast<long>(total)) ? static_cast<int>(resolved) : -1;
+    }
+
+    void countChunk(Chunk& chunk) {
+        for (const char* p = chunk.begin; p < chunk.end;) {
+            p = skipSpaces(p, chunk.end);
+            const char* line_end = lineEnd(p, chunk.end);
+            const char* end = recordEnd(p, line_end);
+            switch (recordType(p, end)) {
+                case 'v': chunk.vertices++; break;
+                case 'n': chunk.normals++; break;
+                case 'f': chunk.triangles += std::max(0, countTokens(p + 1, end) - 2); break;
+                default: break;
+            }
+            p = line_end + 1;
+        }
+    }
+
+    // Parse the records of the chunk into the slots the counting pass reserved, false on a malformed record
+    bool parseChunk(const Chunk& chunk, obj_loader::ObjData& data, size_t& error_line) {
+        size_t vertex = chunk.vertices, normal = chunk.normals, triangle = chunk.triangles;
+        size_t line = 0;
+        for (const char* p = chunk.begin; p < chunk.end; line++) {
+            p = skipSpaces(p, chunk.end);
+            const char* line_end = lineEnd(p, chunk.end);
+            const char* end = recordEnd(p, line_end);
+            char type = recordType(p, end);
+            if (type == 'v' || type == 'n') {
+                Vec3f value;
+                const char* q = p + (type == 'n' ? 2 : 1);
+                for (int k = 0; k < 3 && q != nullptr; k++) {
+                    q = parseFloat(q, end, value[k]);
+                }
+                if (q == nullptr) {
+                    error_line = line;
+                    return false;
+                }
+                (type == 'v' ? data.vertices[vertex++] : data.normals[normal++]) = value;
+            }
+            else if (type == 'f') {
+                // Corners as v, v/vt, v//vn or v/vt/vn, fanned around the first one
+                int first_v = -1, first_n = -1, last_v = -1, last_n = -1, corners = 0;
+                for (const char* q = skipSpaces(p + 1, end); q < end; q = skipSpaces(q, end), corners++) {
+                    long v_index = 0, n_index = 0;
+                    q = parseInt(q, end, v_index);
+                    if (q != nullptr && q < end && *q == '/') {
+                        q++;
+                        long ignored;
+                        if (q < end && *q != '/') q = parseInt(q, end, ignored);
+                        if (q != nullptr && q < end && *q == '/') q = parseInt(q + 1, end, n_index);
+                    }
+                    int v = q != nullptr ? resolveIndex(v_index, vertex, data.vertices.size()) : -1;
+                    int n = n_index != 0 ? resolveIndex(n_index, normal, data.normals.size()) : -1;
+                    if (v < 0 || (n_index != 0 && n < 0)) {
+                        error_line = line;
+                        return false;
+                    }
+                    if (corners == 0) {
+                        first_v = v;
+                        first_n = n;
+                    }
+                    else if (corners >= 2) {
+                        int triangle_vertices[3] = { first_v, last_v, v }, triangle_normals[3] = { first_n, last_n, n };
+                        for (int k = 0; k < 3; k++) {
+                            data.v_indices[3 * triangle + k] = triangle_vertices[k];
+                            data.n_indices[3 * triangle + k] = triangle_normals[k];
+                        }
+                        triangle++;
+                    }
+                    last_v = v;
+                    last_n = n;
+                }
+            }
+            p = line_end + 1;
+        }
+        return true;
+    }
+}
+
+bool obj_loader::load(const std::string& path, ObjData& data, int threads, std::string& error) {
+    auto file = MappedFile::open(path);
+    if (file == nullptr) {
+        // MappedFile cannot map a zero length file
+        std::error_code size_error;
+        bool empty = std::filesystem::is_regular_file(path, size_error) && std::filesystem::file_size(path, size_error) == 0;
+        error = empty ? path + ": empty file" : "cannot open " + path;
+        return false;
+    }
+    const char* begin = reinterpret_cast<const char*>(file->data());
+    const char* end = begin + file->size();
+
+    // Chunks end after a newline, so no record is split
+    std::vector<Chunk> chunks;
+    for (const char* p = begin; p < end;) {
+        const char* chunk_end = p + std::min(CHUNK_SIZE, static_cast<size_t>(end - p));
+        chunk_end = std::min(lineEnd(chunk_end, end) + 1, end);
+        chunks.push_back({ p, chunk_end });
+        p = chunk_end;
+    }
+    auto chunk_count = static_cast<int>(chunks.size());
+    int hardware_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    TaskScheduler scheduler(std::min(threads > 0 ? threads : hardware_threads, chunk_count));
+    scheduler.parallelFor(chunk_count, [&](int chunk, int thread) { countChunk(chunks[chunk]); });
+
+    // Exclusive prefix sums give every chunk its first slot
+    size_t vertices = 0, normals = 0, triangles = 0;
+    for (auto& chunk: chunks) {
+        size_t chunk_vertices = chunk.vertices, chunk_normals = chunk.normals, chunk_triangles = chunk.triangles;
+        chunk.vertices = vertices;
+        chunk.normals = normals;
+        chunk.triangles = triangles;
+        vertices += chunk_vertices;
+        normals += chunk_normals;
+        triangles += chunk_triangles;
+    }
+    data.vertices.resize(vertices);
+    data.normals.resize(normals);
+    data.v_indices.resize(3 * triangles);
+    data.n_indices.resize(3 * triangles);
+
+    std::atomic<int> failed_chunk {chunk_count};
+    std::vector<size_t> error_lines(chunks.size(), 0);
+    scheduler.parallelFor(chunk_count, [&](int chunk, int thread) {
+        if (!parseChunk(chunks[chunk], data, error_lines[chunk])) {
+            int expected = failed_chunk.load();
+            while (chunk < expected && !failed_chunk.compare_exchange_weak(expected, chunk)) {}
+        }
+    });
+    if (failed_chunk.load() < chunk_count) {
+        // Report the first bad line of the file
+        int chunk = failed_chunk.load();
+        size_t line = error_lines[chunk] + 1;
+        for (const char* p = begin; p < chunks[chunk].begin; p++) {
+            line += *p == '\n';
+        }
+        error = path + ":" + std::to_string(line) + ": malformed record";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#include "photon_map.hpp"
+#include "scheduler.hpp"
+
+namespace {
+    // Sampler streams of the photon paths, after every pixel stream of the render
+    constexpr uint32_t PHOTON_STREAM = 1u << 31;
+    // Photon paths per task
+    constexpr int CHUNK_SIZE = 1024;
+}
+
+void PhotonMap::build(Scene& scene, const PhotonMapConfig& config, int max_depth, int rr_depth, int threads, SamplerType sampler_type, uint32_t seed) {
+    neighbors = config.neighbors;
+    radius = config.radius;
+    std::vector<float> powers;
+    for (const auto& light: scene.getLights()) {
+        powers.push_back(light->getPower());
+    }
+    if (powers.empty()) {
+        clear();
+        return;
+    }
+    AliasTable light_table(powers);
+
+    int chunk_count = (config.photons + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<std::vector<Photon>> chunks(chunk_count);
+    TaskScheduler scheduler(threads);
+    scheduler.parallelFor(chunk_count, [&](int chunk, int thread) {
+        RandomSampler sampler(sampler_type, seed);
+        int end = std::min(config.photons, (chunk + 1) * CHUNK_SIZE);
+        for (int path = chunk * CHUNK_SIZE; path < end; path++) {
+            sampler.startSample(PHOTON_STREAM + path, 0);
+            float pmf;
+            const Light& light = scene.getLight(light_table.sample(sampler.get1D(), &pmf));
+            Interaction origin;
+            auto vpl = light::dispatch(light, [&](const auto& emitter) { return emitter.getVPL(origin, sampler); });
+            Vec3f direction;
+            Vec3f power = light::samplePhoton(light, vpl, sampler, direction) / (pmf * config.photons);
+            if (power.isZero()) continue;
+            Ray ray(vpl.position, direction);
+
+            Vec3f beta(1, 1, 1);
+            for (int depth = 0; depth < max_depth; depth++) {
+                Interaction itra;
+                if (!scene.intersect(ray, itra) || itra.type != Interaction::InterType::GEOMETRY || itra.material == nullptr) break;
+                itra.w_o = -1 * ray.getDirection();
+                if (itra.normal.dot(itra.w_o) < 0) {
+                    itra.normal = -1 * itra.normal;
+                }
+                bool delta = bsdf::isDelta(*itra.material);
+                if (depth > 0 && !delta) {
+                    chunks[chunk].push_back({itra.position, power.cwiseProduct(beta), itra.w_o});
+                }
+
+                float pdf = bsdf::sample(*itra.material, itra, sampler);
+                if (delta) {
+                    beta = beta.cwiseProduct(bsdf::evaluate(*itra.material, itra));
+                } else {
+                    float cos_theta = itra.normal.dot(itra.w_i);
+                    if (pdf <= 0 || cos_theta <= 0) break;
+                    beta = beta.cwiseProduct(bsdf::evaluate(*itra.material, itra) * cos_theta / pdf);
+                }
+                if (depth + 1 >= rr_depth) {
+                    float survive = std::min(1.0f, beta.maxCoeff());
+                    if (sampler.get1D() >= survive) break;
+                    beta /= survive;
+                }
+                ray = Ray(itra.position, itra.w_i);
+            }
+        }
+    });
+
+    std::vector<Photon> photons;
+    for (const auto& chunk: chunks) {
+        photons.insert(photons.end(), chunk.begin(), chunk.end());
+    }
+    tree = KDTree<Photon>(std::move(photons));
+}
+
+Vec3f PhotonMap::estimate(const Interaction& interaction) const {
+    if (tree.empty() || interaction.material == nullptr) return Vec3f(0, 0, 0);
+    thread_local std::vector<KDTree<Photon>::Neighbor> found;
+    float radius2 = tree.findNearest(interaction.position, neighbors, radius, found);
+
+    Interaction lookup = interaction;
+    Vec3f flux(0, 0, 0);
+    for (const auto& neighbor: found) {
+        const Photon& photon = tree[neighbor.index];
+        // Zero for photons arriving at the back of the surface, from the other side of a wall
+        lookup.w_i = photon.direction;
+        flux += bsdf::evaluate(*interaction.material, lookup).cwiseProduct(photon.power);
+    }
+    return flux / (PI * radius2);
+}
@@ -0,0 +1,187 @@
+#include "render_farm.hpp"
+#include "HypoxRayTracer.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr auto POLL_INTERVAL = std::chrono::milliseconds(500);
+
+    std::string getItemName(int item) {
+        return "item_" + std::to_string(item);
+    }
+    fs::path getClaimPath(const fs::path& job_dir, int item) {
+        return job_dir / "claims" / getItemName(item);
+    }
+    /*
+    Claim of the backup-th backup of an item, taken by the worker that backs up
+    its straggling owner, or the straggling backup before it
+    */
+    fs::path getBackupPath(const fs::path& job_dir, int item, int backup) {
+        return job_dir / "claims" / (getItemName(item) + ".backup" + std::to_string(backup));
+    }
+    fs::path getFilmPath(const fs::path& job_dir, int item) {
+        return job_dir / "films" / (getItemName(item) + ".film");
+    }
+
+    int getTileRows(const Vec2i& resolution) {
+        return (resolution.y() + HypoxRayTracer::TILE_SIZE - 1) / HypoxRayTracer::TILE_SIZE;
+    }
+
+    // False if another worker already owns the claim
+    bool claim(const fs::path& path) {
+        std::error_code error;
+        return fs::create_directory(path, error) && !error;
+    }
+
+    float secondsSinceWrite(const fs::path& path) {
+        std::error_code error;
+        auto time = fs::last_write_time(path, error);
+        if (error) return 0;
+        return std::chrono::duration<float>(fs::file_time_type::clock::now() - time).count();
+    }
+}
+
+int render_farm::Job::getStripCount(int tile_rows) const {
+    if (shard == ShardMode::Samples) return 1;
+    int rows = std::max(1, rows_per_item);
+    return (tile_rows + rows - 1) / rows;
+}
+
+bool render_farm::submit(const std::string& job_dir, const Job& job) {
+    std::error_code error;
+    fs::path dir(job_dir);
+    // Claims and films of an earlier job would be taken for this one's, so a job directory is used once
+    for (const char* subdir: { "claims", "films" }) {
+        if (fs::exists(dir / subdir, error) && !fs::is_empty(dir / subdir, error)) {
+            std::cerr << "Render farm: " << (dir / subdir) << " holds an earlier job, submit to a new job directory" << std::endl;
+            return false;
+        }
+    }
+    fs::create_directories(dir / "claims", error);
+    fs::create_directories(dir / "films", error);
+    if (error) return false;
+
+    nlohmann::json raw;
+    // Absolute, workers may start from another directory
+    raw["config"] = fs::absolute(job.config_path, error).string();
+    raw["shard"] = job.shard == ShardMode::Samples ? "samples" : "tiles";
+    raw["rows_per_item"] = job.rows_per_item;
+    raw["passes"] = job.passes;
+    raw["seed"] = job.seed;
+    raw["straggler_seconds"] = job.straggler_seconds;
+    // Renamed into place, so a worker polling for the job never reads half of it
+    fs::path temp_path = dir / "job.json.tmp";
+    std::ofstream(temp_path) << raw.dump(2) << std::endl;
+    fs::rename(temp_path, dir / "job.json", error);
+    return !error;
+}
+
+bool render_farm::readJob(const std::string& job_dir, Job& job) {
+    std::ifstream file(fs::path(job_dir) / "job.json");
+    if (!file) return false;
+    nlohmann::json raw = nlohmann::json::parse(file, nullptr, false);
+    if (raw.is_discarded() || !raw.contains("config")) return false;
+    job.config_path = raw["config"].get<std::string>();
+    job.shard = raw.value("shard", "tiles") == "samples" ? ShardMode::Samples : ShardMode::Tiles;
+    job.rows_per_item = std::max(1, raw.value("rows_per_item", 4));
+    job.passes = std::max(1, raw.value("passes", 1));
+    job.seed = raw.value("seed", 0u);
+    job.straggler_seconds = raw.value("straggler_seconds", 60.0f);
+    return true;
+}
+
+int render_farm::work(const std::string& job_dir, int threads) {
+    Job job;
+    if (!readJob(job_dir, job)) {
+        std::cerr << "Render farm: no job in " << job_dir << std::endl;
+        return -1;
+    }
+    // The scene is loaded once (from the mesh cache when the config has one) for all the items
+    Config config(job.config_path);
+    config.threads = threads;
+    config.seed = job.seed;
+    config.render_mode = RenderMode::Final;
+    auto image = std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y());
+    auto camera = std::make_shared<Camera>(config.camera_config, image);
+    auto scene = std::make_shared<Scene>(config);
+    HypoxRayTracer tracer(camera, scene, config);
+
+    fs::path dir(job_dir);
+    int tile_rows = getTileRows(config.image_resolution);
+    int rows_per_strip = job.shard == ShardMode::Samples ? tile_rows : job.rows_per_item;
+    int item_count = job.getItemCount(tile_rows);
+    Film film(config.image_resolution, false);
+    int rendered = 0;
+    auto render_item = [&](int item) {
+        int strip = item / job.passes, pass = item % job.passes;
+        int row0 = strip * rows_per_strip, row1 = std::min(row0 + rows_per_strip, tile_rows);
+        film.clear();
+        tracer.renderTileRows(film, row0, row1, pass);
+        if (!film.writeRows(getFilmPath(dir, item).string(), row0 * HypoxRayTracer::TILE_SIZE, row1 * HypoxRayTracer::TILE_SIZE)) {
+            std::cerr << "Render farm: cannot write " << getFilmPath(dir, item) << std::endl;
+            return;
+        }
+        rendered++;
+        printf("Render farm: item %d of %d done\n", item + 1, item_count);
+    };
+
+    for (int item = 0; item < item_count; item++) {
+        if (claim(getClaimPath(dir, item))) render_item(item);
+    }
+
+    // Everything is claimed: back up the latest claim of an item once it is late,
+    // whether the owner's or a backup's, so the item finishes while any worker lives
+    std::vector<int> pending;
+    for (int item = 0; item < item_count; item++) pending.push_back(item);
+    while (!pending.empty()) {
+        std::vector<int> waiting;
+        for (int item: pending) {
+            if (fs::exists(getFilmPath(dir, item))) continue;
+            int backups = 0;
+            while (fs::exists(getBackupPath(dir, item, backups + 1))) backups++;
+            fs::path latest = backups == 0 ? getClaimPath(dir, item) : getBackupPath(dir, item, backups);
+            if (secondsSinceWrite(latest) >= job.straggler_seconds && claim(getBackupPath(dir, item, backups + 1))) {
+                render_item(item);
+            }
+            waiting.push_back(item);
+        }
+        pending.swap(waiting);
+        if (!pending.empty()) std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+    return rendered;
+}
+
+bool render_farm::merge(const std::string& job_dir, Film& film, float timeout_seconds) {
+    Job job;
+    if (!readJob(job_dir, job)) {
+        std::cerr << "Render farm: no job in " << job_dir << std::endl;
+        return false;
+    }
+    fs::path dir(job_dir);
+    int item_count = job.getItemCount(getTileRows(film.getResolution()));
+    auto start = std::chrono::steady_clock::now();
+    int next = 0;
+    // Films are merged as soon as they arrive, but strictly in item order
+    while (next < item_count) {
+        if (!fs::exists(getFilmPath(dir, next))) {
+            if (timeout_seconds > 0 && std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() >= timeout_seconds) {
+                std::cerr << "Render farm: timed out with " << item_count - next << " of " << item_count << " items missing" << std::endl;
+                return false;
+            }
+            std::this_thread::sleep_for(POLL_INTERVAL);
+            continue;
+        }
+        if (!film.mergeRows(getFilmPath(dir, next).string())) {
+            std::cerr << "Render farm: cannot read " << getFilmPath(dir, next) << std::endl;
+            return false;
+        }
+        next++;
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#include "render_session.hpp"
+
+// The session always accumulates passes, whatever the configured mode
+static Config progressiveConfig(Config config) {
+    config.render_mode = RenderMode::Progressive;
+    return config;
+}
+
+RenderSession::RenderSession(const Config& config):
+    image(std::make_shared<Image>(config.image_resolution.x(), config.image_resolution.y(), config.framebuffer)),
+    camera(std::make_shared<Camera>(config.camera_config, image)),
+    scene(std::make_shared<Scene>(config)),
+    tracer(camera, scene, progressiveConfig(config)),
+    film(config.image_resolution, true) {}
+
+int RenderSession::render(int passes) {
+    if (objects_moved) {
+        scene->refitAccel();
+        objects_moved = false;
+    }
+    if (lights_changed) {
+        scene->buildLightAccel();
+        lights_changed = false;
+    }
+    int rendered = tracer.renderPasses(film, pass_count, passes);
+    pass_count += rendered;
+    return rendered;
+}
+
+void RenderSession::restart() {
+    film.clear();
+    pass_count = 0;
+}
+
+void RenderSession::setCameraPosition(const Vec3f& position) {
+    camera->setPosition(position);
+    restart();
+}
+
+void RenderSession::lookAt(const Vec3f& look_at, const Vec3f& ref_up) {
+    camera->lookAt(look_at, ref_up);
+    restart();
+}
+
+void RenderSession::setFov(float fov) {
+    camera->setFov(fov);
+    restart();
+}
+
+bool RenderSession::setMaterialColor(const std::string& name, const Vec3f& color) {
+    int material = scene->findMaterial(name);
+    if (material < 0) {
+        return false;
+    }
+    setMaterialColor(static_cast<MaterialID>(material), color);
+    return true;
+}
+
+void RenderSession::setMaterialColor(MaterialID material, const Vec3f& color) {
+    scene->getMaterial(material)->setColor(color);
+    tracer.invalidatePhotonMap();
+    restart();
+}
+
+void RenderSession::setLightPosition(int light_id, const Vec3f& position) {
+    scene->getLight(light_id).setPosition(position);
+    lights_changed = true;
+    tracer.invalidatePhotonMap();
+    restart();
+}
+
+void RenderSession::setLightRadiance(int light_id, const Vec3f& radiance) {
+    // The light sampler weights lights by their power
+    scene->getLight(light_id).setColor(radiance);
+    lights_changed = true;
+    tracer.invalidatePhotonMap();
+    restart();
+}
+
+bool RenderSession::setObjectTransform(ObjectID object, const Mat4f& transform) {
+    Geometry& geometry = scene->getObject(object);
+    if (geometry.getGeometryType() != GeometryType::Instance) {
+        return false;
+    }
+    static_cast<Instance&>(geometry).setTransform(transform);
+    objects_moved = true;
+    tracer.invalidatePhotonMap();
+    restart();
+    return true;
+}
@@ -1,73 +1,196 @@
 #include "scene.hpp"
 #include <iostream>
+#include "scheduler.hpp"
 
 Scene::Scene(const Config& config) {
-    // Set light (Now only one light)
-    auto light_config = config.lights_config[0];
-
-    light = std::make_shared<SquareAreaLight>(config.lights_config[0]);
+    for (const auto& light_config: config.lights_config) {
+        lights.push_back(std::make_shared<SquareAreaLight>(light_config));
+    }
+    light_sampler_type = config.light_sampler_type;
+    dispatch_type = config.dispatch_type;
     
     ambient_light = Vec3f(0.1, 0.1, 0.1); // TODO: Temporarily set to 0.1
 
+    // Pick the SIMD kernels before rendering starts
+    simd::getKernels();
+
     // Material Config
-    std::map<std::string, std::shared_ptr<BSDF>> materials;
     for(const auto& material_config: config.materials_config) {
-        std::shared_ptr<BSDF> material = nullptr;
         if (material_config.type == MaterialType::Diffuse) {
-            material = std::make_shared<IdealDiffuseBSDF>(material_config);
+            material_names[material_config.name] = addMaterial<IdealDiffuseBSDF>(material_config);
         }
         else if (material_config.type == MaterialType::Specular) {
-            material = std::make_shared<IdealSpecularBSDF>(material_config);
+            material_names[material_config.name] = addMaterial<IdealSpecularBSDF>(material_config);
         }
         else {
             puts("Material Type Error!");
         }
+    }
 
-        materials[material_config.name] = material;
+    // Each obj file is loaded once in object space and shared by all the objects placing it
+    std::map<std::string, int> mesh_ids;
+    std::vector<ObjectConfig> mesh_configs;
+    std::vector<int> object_meshes;
+    object_meshes.reserve(config.objects_config.size());
+    for (const auto& object_config: config.objects_config) {
+        std::string key = object_config.path + "#" + std::to_string(object_config.has_accel) +
+            "#" + std::to_string(static_cast<int>(object_config.accel_type)) +
+            "#" + std::to_string(object_config.grid_resolution) +
+            "#" + std::to_string(static_cast<int>(object_config.bvh_build)) +
+            "#" + std::to_string(object_config.compact_bvh);
+        auto inserted = mesh_ids.emplace(key, static_cast<int>(mesh_configs.size()));
+        if (inserted.second) {
+            ObjectConfig mesh_config = object_config;
+            mesh_config.translate = Vec3f(0, 0, 0);
+            mesh_config.scale = 1;
+            mesh_configs.push_back(mesh_config);
+        }
+        object_meshes.push_back(inserted.first->second);
     }
 
-    for (auto object_config: config.objects_config) {
-        auto object = std::make_shared<Mesh>(object_config);
+    // Meshes are independent, so they load in parallel, and the threads left over parse and build each of them
+    auto mesh_count = static_cast<int>(mesh_configs.size());
+    Mesh* meshes = arena.allocateArray<Mesh>(mesh_count);
+    int load_threads = TaskScheduler(config.threads).getThreadCount();
+    int mesh_threads = std::max(1, std::min(load_threads, mesh_count));
+    TaskScheduler loader(mesh_threads);
+    loader.parallelFor(mesh_count, [&](int mesh, int thread) {
+        int threads = std::max(1, load_threads / mesh_threads);
+        new (&meshes[mesh]) Mesh(mesh_configs[mesh], threads, threads);
+    });
+    arena.adoptArray(meshes, mesh_count);
+
+    objects.reserve(config.objects_config.size());
+    for (size_t i = 0; i < config.objects_config.size(); i++) {
+        const auto& object_config = config.objects_config[i];
+        ObjectID object = addObject<Instance>(&meshes[object_meshes[i]], object_config.translate, object_config.scale);
         // Add Materials by name
-        object->setMaterial(materials[object_config.material_name]);
-        objects.push_back(object);
-        //std::cout << "Object Bounding Box: " << object->getAABB() << std::endl;
+        int material = findMaterial(object_config.material_name);
+        getObject(object).setMaterial(material >= 0 ? getMaterial(static_cast<MaterialID>(material)) : nullptr);
     }
+    printf("Objects: %zu, Unique Meshes: %d, Lights: %zu, Arena: %zu KB\n", objects.size(), mesh_count, lights.size(), arena.getCapacity() / 1024);
 
+    buildAccel();
 }
 
-bool Scene::intersect(const Ray& ray, Interaction& interaction) {
-    /* Check intersection of ray and this scene */
-    Interaction itra;
+void Scene::buildAccel() {
+    std::vector<AABB> object_aabbs;
+    object_aabbs.reserve(objects.size());
+    for (const auto& object: objects) {
+        object_aabbs.push_back(object->getAABB());
+    }
+    tlas.build(object_aabbs, 1);
+    buildLightAccel();
+    accel_dirty = false;
+}
+
+void Scene::buildLightAccel() {
+    std::vector<AABB> light_aabbs;
+    light_aabbs.reserve(lights.size());
+    for (const auto& light: lights) {
+        light_aabbs.push_back(light->getBounds().aabb);
+    }
+    light_accel.build(light_aabbs, 1);
+    light_sampler.build(lights, light_sampler_type);
+}
+
+void Scene::refitAccel() {
+    if (accel_dirty || tlas.getNodes().empty()) {
+        buildAccel();
+        return;
+    }
+    std::vector<AABB> object_aabbs;
+    object_aabbs.reserve(objects.size());
+    for (const auto& object: objects) {
+        object_aabbs.push_back(object->getAABB());
+    }
+    tlas.refit(object_aabbs);
+}
+
+bool Scene::isShadowed(const Ray& ray) const {
+    stats::add(stats::ShadowRays);
+    if (!accel_dirty) {
+        const auto& object_ids = tlas.getPrimIndices();
+        return tlas.occluded(ray, [&](int slot) {
+            return visitObject(object_ids[slot], [&](const auto& object) { return object.occluded(ray); });
+        });
+    }
+    for (size_t object_id = 0; object_id < objects.size(); object_id++) {
+        if (objects[object_id]->getAABB().intersect(ray) &&
+            visitObject(static_cast<int>(object_id), [&](const auto& object) { return object.occluded(ray); })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scene::intersectLight(const Ray& ray, Interaction& itra) const {
     itra.distance = ray.getTMax();
 
-    // Check with light
-    Interaction itra_light;
-    if (
-        light->intersect(ray, itra_light) &&
-        itra_light.distance > ray.getTMin()
-    ) {
-        itra = itra_light;
-        itra.type = Interaction::InterType::LIGHT;
-    }
-    // Check with objects
-    Interaction itra_obj;
-    
-    for (auto object: objects) {
-        // Test with aabb first
-        auto aabb = object->getAABB();
-        if (!aabb.intersect(ray)) {
-            continue;
+    // Check with lights
+    auto intersect_light = [&](int light_id, float& t_closest) {
+        Interaction itra_light;
+        if (
+            light::dispatch(*lights[light_id], [&](const auto& emitter) { return emitter.intersect(ray, itra_light); }) &&
+            itra_light.distance > ray.getTMin() &&
+            itra_light.distance < t_closest
+        ) {
+            itra = itra_light;
+            itra.type = Interaction::InterType::LIGHT;
+            itra.light_id = light_id;
+            t_closest = itra_light.distance;
+            return true;
+        }
+        return false;
+    };
+    float t_max = ray.getTMax();
+    if (!accel_dirty) {
+        const auto& light_ids = light_accel.getPrimIndices();
+        light_accel.intersect(ray, t_max, [&](int slot, float& t_closest) {
+            return intersect_light(light_ids[slot], t_closest);
+        });
+    }
+    else {
+        for (int light_id = 0; light_id < static_cast<int>(lights.size()); light_id++) {
+            intersect_light(light_id, t_max);
         }
-        if (object->intersect(ray, itra_obj)) {
-            if (
-                itra_obj.distance < itra.distance &&
-                itra_obj.distance > ray.getTMin()
-            ) {
-                itra = itra_obj;
+    }
+}
+
+bool Scene::intersect(const Ray& ray, Interaction& interaction) {
+    /* Check intersection of ray and this scene */
+    stats::add(stats::SceneIntersects);
+    Interaction itra;
+    intersectLight(ray, itra);
+    // Check with objects, keeping only the closest hit record
+    HitRecord hit;
+    hit.t = itra.distance;
+    if (!accel_dirty) {
+        const auto& object_ids = tlas.getPrimIndices();
+        tlas.intersect(ray, hit.t, [&](int slot, float&) {
+            int object_id = object_ids[slot];
+            if (visitObject(object_id, [&](const auto& object) { return object.intersect(ray, hit); })) {
+                hit.geom_id = object_id;
+                return true;
+            }
+            return false;
+        });
+    }
+    else {
+        for (size_t object_id = 0; object_id < objects.size(); object_id++) {
+            // Test with aabb first
+            if (!objects[object_id]->getAABB().intersect(ray)) {
+                continue;
+            }
+            if (visitObject(static_cast<int>(object_id), [&](const auto& object) { return object.intersect(ray, hit); })) {
+                hit.geom_id = static_cast<int>(object_id);
             }
         }
     }
+    // Shade only the closest hit
+    if (hit.geom_id >= 0) {
+        visitObject(hit.geom_id, [&](const auto& object) { object.fillInteraction(ray, hit, itra); });
+    }
 
     if (itra.distance > ray.getTMin() ){
         interaction = itra;
@@ -76,3 +199,38 @@ bool Scene::intersect(const Ray& ray, Interaction& interaction) {
     }
     return false;
 }
+
+uint64_t Scene::intersectPacket(const Ray* rays, int count, Interaction* interactions) {
+    uint64_t hits = 0;
+    if (accel_dirty || count > BVH::PACKET_SIZE) {
+        for (int i = 0; i < count; i++) {
+            if (intersect(rays[i], interactions[i])) hits |= 1ull << i;
+        }
+        return hits;
+    }
+
+    stats::add(stats::SceneIntersects, count);
+    HitRecord records[BVH::PACKET_SIZE];
+    float t_max[BVH::PACKET_SIZE];
+    for (int i = 0; i < count; i++) {
+        interactions[i].type = Interaction::InterType::NONE;
+        intersectLight(rays[i], interactions[i]);
+        records[i] = HitRecord();
+        records[i].t = t_max[i] = interactions[i].distance;
+    }
+    const auto& object_ids = tlas.getPrimIndices();
+    tlas.intersectPacket(rays, count, t_max, [&](int i, int slot, float& t_closest) {
+        int object_id = object_ids[slot];
+        if (visitObject(object_id, [&](const auto& object) { return object.intersect(rays[i], records[i]); })) {
+            records[i].geom_id = object_id;
+            t_closest = records[i].t;
+        }
+    });
+    for (int i = 0; i < count; i++) {
+        if (records[i].geom_id >= 0) {
+            visitObject(records[i].geom_id, [&](const auto& object) { object.fillInteraction(rays[i], records[i], interactions[i]); });
+        }
+        if (interactions[i].distance > rays[i].getTMin()) hits |= 1ull << i;
+    }
+    return hits;
+}
@@ -0,0 +1,118 @@
+#include "scheduler.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static int64_t nowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+TaskScheduler::TaskScheduler(int num_threads): num_threads(num_threads) {
+    if (this->num_threads <= 0) {
+        this->num_threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (this->num_threads <= 0) {
+        this->num_threads = 1;
+    }
+    ranges = std::vector<TaskRange>(this->num_threads);
+}
+
+void TaskScheduler::parallelFor(int count, const TaskFunc& func) {
+    if (count <= 0) {
+        return;
+    }
+    // Contiguous blocks keep neighbouring tasks (e.g. adjacent tiles) on one thread
+    for (int i = 0; i < num_threads; i++) {
+        auto begin = static_cast<uint32_t>(static_cast<int64_t>(count) * i / num_threads);
+        auto end = static_cast<uint32_t>(static_cast<int64_t>(count) * (i + 1) / num_threads);
+        ranges[i].range.store(pack(begin, end), std::memory_order_relaxed);
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+    for (int i = 1; i < num_threads; i++) {
+        workers.emplace_back(&TaskScheduler::workerLoop, this, i, std::cref(func));
+    }
+    // The calling thread works as thread 0
+    workerLoop(0, func);
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+void TaskScheduler::workerLoop(int thread, const TaskFunc& func) {
+    while (true) {
+        int task = popTask(thread);
+        if (task >= 0) {
+            func(task, thread);
+        } else if (!stealTasks(thread)) {
+            // No task is ever added, so once every block is empty we are done
+            return;
+        }
+    }
+}
+
+int TaskScheduler::popTask(int thread) {
+    auto& range = ranges[thread].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t begin = rangeBegin(current), end = rangeEnd(current);
+        if (begin >= end) {
+            return -1;
+        }
+        if (range.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel)) {
+            return static_cast<int>(begin);
+        }
+    }
+}
+
+bool TaskScheduler::stealTasks(int thread) {
+    for (int i = 1; i < num_threads; i++) {
+        auto& victim = ranges[(thread + i) % num_threads].range;
+        uint64_t current = victim.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t begin = rangeBegin(current), end = rangeEnd(current);
+            if (begin >= end) {
+                break;
+            }
+            // Take the back half, the victim keeps working on the front
+            uint32_t split = end - (end - begin + 1) / 2;
+            if (victim.compare_exchange_weak(current, pack(begin, split), std::memory_order_acq_rel)) {
+                // Our own block is empty, so thieves leave it alone until this store
+                ranges[thread].range.store(pack(split, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+ProgressReporter::ProgressReporter(const char* label, int total, int interval_ms):
+    label(label), total(total), interval_ns(static_cast<int64_t>(interval_ms) * 1000000) {
+    last_report_ns.store(nowNanoseconds(), std::memory_order_relaxed);
+    print(0);
+}
+
+void ProgressReporter::advance(int amount) {
+    int current = done.fetch_add(amount, std::memory_order_relaxed) + amount;
+    int64_t now = nowNanoseconds();
+    int64_t last = last_report_ns.load(std::memory_order_relaxed);
+    // Only the thread that moves the timestamp forward prints
+    if (now - last >= interval_ns &&
+        last_report_ns.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        print(current);
+    }
+}
+
+void ProgressReporter::finish() {
+    print(total);
+    printf("\n");
+}
+
+void ProgressReporter::print(int done) const {
+    printf("\r%s: %.2f%%", label, total > 0 ? 100.0 * done / total : 100.0);
+    fflush(stdout);
+}
@@ -0,0 +1,540 @@
+#include "simd.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include "stats.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HYPOX_SIMD_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#define HYPOX_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace simd {
+
+// ========== Scalar ==========
+
+static int intersectTrianglesScalar(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float& t_max, float& u, float& v
+) {
+    int hit = -1;
+    for (int i = first; i < first + count; i++) {
+        float e1x = tri.e1[0][i], e1y = tri.e1[1][i], e1z = tri.e1[2][i];
+        float e2x = tri.e2[0][i], e2y = tri.e2[1][i], e2z = tri.e2[2][i];
+        float sx = ray.o[0] - tri.v0[0][i], sy = ray.o[1] - tri.v0[1][i], sz = ray.o[2] - tri.v0[2][i];
+        // s1 = d x e2, s2 = s x e1
+        float s1x = ray.d[1] * e2z - ray.d[2] * e2y,
+            s1y = ray.d[2] * e2x - ray.d[0] * e2z,
+            s1z = ray.d[0] * e2y - ray.d[1] * e2x;
+        float s2x = sy * e1z - sz * e1y,
+            s2y = sz * e1x - sx * e1z,
+            s2z = sx * e1y - sy * e1x;
+
+        float det = s1x * e1x + s1y * e1y + s1z * e1z;
+        float sign = det < 0 ? -1.0f : 1.0f;
+        float abs_det = std::abs(det);
+        float t_scaled = sign * (s2x * e2x + s2y * e2y + s2z * e2z),
+            u_scaled = sign * (s1x * sx + s1y * sy + s1z * sz),
+            v_scaled = sign * (s2x * ray.d[0] + s2y * ray.d[1] + s2z * ray.d[2]);
+        if (
+            abs_det <= 0 || u_scaled < 0 || v_scaled < 0 || u_scaled + v_scaled > abs_det ||
+            t_scaled < ray.t_min * abs_det || t_scaled >= t_max * abs_det
+        ) {
+            continue;
+        }
+        float inv_det = 1 / abs_det;
+        t_max = t_scaled * inv_det;
+        u = u_scaled * inv_det;
+        v = v_scaled * inv_det;
+        hit = i;
+    }
+    return hit;
+}
+
+static bool occludedTrianglesScalar(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float t_max
+) {
+    float u, v;
+    return intersectTrianglesScalar(tri, first, count, ray, t_max, u, v) >= 0;
+}
+
+static int intersectBoxesScalar(const float (*bounds)[BOX_WIDTH], const RayData& ray, float t_max, float* t_near) {
+    int mask = 0;
+    for (int c = 0; c < BOX_WIDTH; c++) {
+        float t_in = ray.t_min, t_out = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            // Pick the near and far planes from the direction sign
+            bool positive = ray.inv_d[axis] >= 0;
+            float near_plane = positive ? bounds[axis][c] : bounds[axis + 3][c],
+                far_plane = positive ? bounds[axis + 3][c] : bounds[axis][c];
+            t_in = std::max(t_in, (near_plane - ray.o[axis]) * ray.inv_d[axis]);
+            t_out = std::min(t_out, (far_plane - ray.o[axis]) * ray.inv_d[axis]);
+        }
+        t_near[c] = t_in;
+        if (t_in <= t_out) mask |= 1 << c;
+    }
+    return mask;
+}
+
+static int intersectQuantizedBoxesScalar(const QuantizedBoxes& boxes, const RayData& ray, float t_max, float* t_near) {
+    // t of a plane is q * scale + offset, with the grid folded into the ray
+    float scale[3], offset[3];
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = boxes.step[axis] * ray.inv_d[axis];
+        offset[axis] = (boxes.origin[axis] - ray.o[axis]) * ray.inv_d[axis];
+    }
+    int mask = 0;
+    for (int c = 0; c < BOX_WIDTH; c++) {
+        float t_in = ray.t_min, t_out = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            bool positive = ray.inv_d[axis] >= 0;
+            float near_plane = positive ? boxes.planes[axis][c] : boxes.planes[axis + 3][c],
+                far_plane = positive ? boxes.planes[axis + 3][c] : boxes.planes[axis][c];
+            t_in = std::max(t_in, near_plane * scale[axis] + offset[axis]);
+            t_out = std::min(t_out, far_plane * scale[axis] + offset[axis]);
+        }
+        t_near[c] = t_in;
+        if (t_in <= t_out) mask |= 1 << c;
+    }
+    return mask & boxes.valid;
+}
+
+// ========== SSE4.1 / AVX2 ==========
+
+#ifdef HYPOX_SIMD_X86
+
+__attribute__((target("sse4.1")))
+static int intersectTrianglesSSE(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float& t_max, float& u, float& v
+) {
+    const __m128 ox = _mm_set1_ps(ray.o[0]), oy = _mm_set1_ps(ray.o[1]), oz = _mm_set1_ps(ray.o[2]);
+    const __m128 dx = _mm_set1_ps(ray.d[0]), dy = _mm_set1_ps(ray.d[1]), dz = _mm_set1_ps(ray.d[2]);
+    const __m128 sign_bit = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps(), t_min = _mm_set1_ps(ray.t_min);
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    int hit = -1;
+    for (int base = first; base < first + count; base += 4) {
+        __m128 e1x = _mm_loadu_ps(tri.e1[0] + base), e1y = _mm_loadu_ps(tri.e1[1] + base), e1z = _mm_loadu_ps(tri.e1[2] + base);
+        __m128 e2x = _mm_loadu_ps(tri.e2[0] + base), e2y = _mm_loadu_ps(tri.e2[1] + base), e2z = _mm_loadu_ps(tri.e2[2] + base);
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(tri.v0[0] + base)),
+            sy = _mm_sub_ps(oy, _mm_loadu_ps(tri.v0[1] + base)),
+            sz = _mm_sub_ps(oz, _mm_loadu_ps(tri.v0[2] + base));
+        __m128 s1x = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y)),
+            s1y = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z)),
+            s1z = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 s2x = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y)),
+            s2y = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z)),
+            s2z = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s1x, e1x), _mm_mul_ps(s1y, e1y)), _mm_mul_ps(s1z, e1z));
+        __m128 sign = _mm_and_ps(det, sign_bit);
+        __m128 abs_det = _mm_xor_ps(det, sign);
+        __m128 t_scaled = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s2x, e2x), _mm_mul_ps(s2y, e2y)), _mm_mul_ps(s2z, e2z)), sign);
+        __m128 u_scaled = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s1x, sx), _mm_mul_ps(s1y, sy)), _mm_mul_ps(s1z, sz)), sign);
+        __m128 v_scaled = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s2x, dx), _mm_mul_ps(s2y, dy)), _mm_mul_ps(s2z, dz)), sign);
+
+        __m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(first + count - base), lane));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(abs_det, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u_scaled, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v_scaled, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u_scaled, v_scaled), abs_det));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(t_scaled, _mm_mul_ps(t_min, abs_det)));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(t_scaled, _mm_mul_ps(_mm_set1_ps(t_max), abs_det)));
+        int mask = _mm_movemask_ps(valid);
+        if (mask == 0) continue;
+
+        // Divide only for blocks with a candidate hit
+        __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), abs_det);
+        alignas(16) float t_lane[4], u_lane[4], v_lane[4];
+        _mm_store_ps(t_lane, _mm_mul_ps(t_scaled, inv_det));
+        _mm_store_ps(u_lane, _mm_mul_ps(u_scaled, inv_det));
+        _mm_store_ps(v_lane, _mm_mul_ps(v_scaled, inv_det));
+        for (int l = 0; l < 4; l++) {
+            if ((mask & (1 << l)) && t_lane[l] < t_max) {
+                t_max = t_lane[l];
+                u = u_lane[l];
+                v = v_lane[l];
+                hit = base + l;
+            }
+        }
+    }
+    return hit;
+}
+
+__attribute__((target("sse4.1")))
+static bool occludedTrianglesSSE(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float t_max
+) {
+    float u, v;
+    return intersectTrianglesSSE(tri, first, count, ray, t_max, u, v) >= 0;
+}
+
+__attribute__((target("sse4.1")))
+static int intersectBoxesSSE(const float (*bounds)[BOX_WIDTH], const RayData& ray, float t_max, float* t_near) {
+    int mask = 0;
+    for (int half = 0; half < BOX_WIDTH; half += 4) {
+        __m128 t_in = _mm_set1_ps(ray.t_min), t_out = _mm_set1_ps(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            bool positive = ray.inv_d[axis] >= 0;
+            __m128 near_plane = _mm_load_ps(bounds[positive ? axis : axis + 3] + half),
+                far_plane = _mm_load_ps(bounds[positive ? axis + 3 : axis] + half);
+            __m128 o = _mm_set1_ps(ray.o[axis]), inv_d = _mm_set1_ps(ray.inv_d[axis]);
+            t_in = _mm_max_ps(t_in, _mm_mul_ps(_mm_sub_ps(near_plane, o), inv_d));
+            t_out = _mm_min_ps(t_out, _mm_mul_ps(_mm_sub_ps(far_plane, o), inv_d));
+        }
+        _mm_storeu_ps(t_near + half, t_in);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t_in, t_out)) << half;
+    }
+    return mask;
+}
+
+// Four 8 bit planes as floats
+__attribute__((target("sse4.1")))
+static inline __m128 loadPlanesSSE(const uint8_t* planes) {
+    int32_t bytes;
+    std::memcpy(&bytes, planes, sizeof(bytes));
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+}
+
+__attribute__((target("sse4.1")))
+static int intersectQuantizedBoxesSSE(const QuantizedBoxes& boxes, const RayData& ray, float t_max, float* t_near) {
+    int mask = 0;
+    for (int half = 0; half < BOX_WIDTH; half += 4) {
+        __m128 t_in = _mm_set1_ps(ray.t_min), t_out = _mm_set1_ps(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            bool positive = ray.inv_d[axis] >= 0;
+            __m128 near_plane = loadPlanesSSE(boxes.planes[positive ? axis : axis + 3] + half),
+                far_plane = loadPlanesSSE(boxes.planes[positive ? axis + 3 : axis] + half);
+            __m128 scale = _mm_set1_ps(boxes.step[axis] * ray.inv_d[axis]),
+                offset = _mm_set1_ps((boxes.origin[axis] - ray.o[axis]) * ray.inv_d[axis]);
+            t_in = _mm_max_ps(t_in, _mm_add_ps(_mm_mul_ps(near_plane, scale), offset));
+            t_out = _mm_min_ps(t_out, _mm_add_ps(_mm_mul_ps(far_plane, scale), offset));
+        }
+        _mm_storeu_ps(t_near + half, t_in);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t_in, t_out)) << half;
+    }
+    return mask & boxes.valid;
+}
+
+__attribute__((target("avx2,fma")))
+static int intersectTrianglesAVX2(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float& t_max, float& u, float& v
+) {
+    const __m256 ox = _mm256_set1_ps(ray.o[0]), oy = _mm256_set1_ps(ray.o[1]), oz = _mm256_set1_ps(ray.o[2]);
+    const __m256 dx = _mm256_set1_ps(ray.d[0]), dy = _mm256_set1_ps(ray.d[1]), dz = _mm256_set1_ps(ray.d[2]);
+    const __m256 sign_bit = _mm256_set1_ps(-0.0f), zero = _mm256_setzero_ps(), t_min = _mm256_set1_ps(ray.t_min);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int hit = -1;
+    for (int base = first; base < first + count; base += 8) {
+        __m256 e1x = _mm256_loadu_ps(tri.e1[0] + base), e1y = _mm256_loadu_ps(tri.e1[1] + base), e1z = _mm256_loadu_ps(tri.e1[2] + base);
+        __m256 e2x = _mm256_loadu_ps(tri.e2[0] + base), e2y = _mm256_loadu_ps(tri.e2[1] + base), e2z = _mm256_loadu_ps(tri.e2[2] + base);
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(tri.v0[0] + base)),
+            sy = _mm256_sub_ps(oy, _mm256_loadu_ps(tri.v0[1] + base)),
+            sz = _mm256_sub_ps(oz, _mm256_loadu_ps(tri.v0[2] + base));
+        __m256 s1x = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y)),
+            s1y = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z)),
+            s1z = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+        __m256 s2x = _mm256_fmsub_ps(sy, e1z, _mm256_mul_ps(sz, e1y)),
+            s2y = _mm256_fmsub_ps(sz, e1x, _mm256_mul_ps(sx, e1z)),
+            s2z = _mm256_fmsub_ps(sx, e1y, _mm256_mul_ps(sy, e1x));
+
+        __m256 det = _mm256_fmadd_ps(s1x, e1x, _mm256_fmadd_ps(s1y, e1y, _mm256_mul_ps(s1z, e1z)));
+        __m256 sign = _mm256_and_ps(det, sign_bit);
+        __m256 abs_det = _mm256_xor_ps(det, sign);
+        __m256 t_scaled = _mm256_xor_ps(_mm256_fmadd_ps(s2x, e2x, _mm256_fmadd_ps(s2y, e2y, _mm256_mul_ps(s2z, e2z))), sign);
+        __m256 u_scaled = _mm256_xor_ps(_mm256_fmadd_ps(s1x, sx, _mm256_fmadd_ps(s1y, sy, _mm256_mul_ps(s1z, sz))), sign);
+        __m256 v_scaled = _mm256_xor_ps(_mm256_fmadd_ps(s2x, dx, _mm256_fmadd_ps(s2y, dy, _mm256_mul_ps(s2z, dz))), sign);
+
+        __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(first + count - base), lane));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(abs_det, zero, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u_scaled, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(v_scaled, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u_scaled, v_scaled), abs_det, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t_scaled, _mm256_mul_ps(t_min, abs_det), _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t_scaled, _mm256_mul_ps(_mm256_set1_ps(t_max), abs_det), _CMP_LT_OQ));
+        int mask = _mm256_movemask_ps(valid);
+        if (mask == 0) continue;
+
+        // Divide only for blocks with a candidate hit
+        __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), abs_det);
+        alignas(32) float t_lane[8], u_lane[8], v_lane[8];
+        _mm256_store_ps(t_lane, _mm256_mul_ps(t_scaled, inv_det));
+        _mm256_store_ps(u_lane, _mm256_mul_ps(u_scaled, inv_det));
+        _mm256_store_ps(v_lane, _mm256_mul_ps(v_scaled, inv_det));
+        for (int l = 0; l < 8; l++) {
+            if ((mask & (1 << l)) && t_lane[l] < t_max) {
+                t_max = t_lane[l];
+                u = u_lane[l];
+                v = v_lane[l];
+                hit = base + l;
+            }
+        }
+    }
+    return hit;
+}
+
+__attribute__((target("avx2,fma")))
+static bool occludedTrianglesAVX2(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float t_max
+) {
+    float u, v;
+    return intersectTrianglesAVX2(tri, first, count, ray, t_max, u, v) >= 0;
+}
+
+__attribute__((target("avx2,fma")))
+static int intersectBoxesAVX2(const float (*bounds)[BOX_WIDTH], const RayData& ray, float t_max, float* t_near) {
+    __m256 t_in = _mm256_set1_ps(ray.t_min), t_out = _mm256_set1_ps(t_max);
+    for (int axis = 0; axis < 3; axis++) {
+        bool positive = ray.inv_d[axis] >= 0;
+        __m256 near_plane = _mm256_load_ps(bounds[positive ? axis : axis + 3]),
+            far_plane = _mm256_load_ps(bounds[positive ? axis + 3 : axis]);
+        // (plane - o) * inv_d as plane * inv_d - o * inv_d
+        __m256 inv_d = _mm256_set1_ps(ray.inv_d[axis]), o_inv_d = _mm256_set1_ps(ray.o[axis] * ray.inv_d[axis]);
+        t_in = _mm256_max_ps(t_in, _mm256_fmsub_ps(near_plane, inv_d, o_inv_d));
+        t_out = _mm256_min_ps(t_out, _mm256_fmsub_ps(far_plane, inv_d, o_inv_d));
+    }
+    _mm256_storeu_ps(t_near, t_in);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_in, t_out, _CMP_LE_OQ));
+}
+
+// Eight 8 bit planes as floats
+__attribute__((target("avx2")))
+static inline __m256 loadPlanesAVX2(const uint8_t* planes) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes))));
+}
+
+__attribute__((target("avx2,fma")))
+static int intersectQuantizedBoxesAVX2(const QuantizedBoxes& boxes, const RayData& ray, float t_max, float* t_near) {
+    __m256 t_in = _mm256_set1_ps(ray.t_min), t_out = _mm256_set1_ps(t_max);
+    for (int axis = 0; axis < 3; axis++) {
+        bool positive = ray.inv_d[axis] >= 0;
+        __m256 near_plane = loadPlanesAVX2(boxes.planes[positive ? axis : axis + 3]),
+            far_plane = loadPlanesAVX2(boxes.planes[positive ? axis + 3 : axis]);
+        __m256 scale = _mm256_set1_ps(boxes.step[axis] * ray.inv_d[axis]),
+            offset = _mm256_set1_ps((boxes.origin[axis] - ray.o[axis]) * ray.inv_d[axis]);
+        t_in = _mm256_max_ps(t_in, _mm256_fmadd_ps(near_plane, scale, offset));
+        t_out = _mm256_min_ps(t_out, _mm256_fmadd_ps(far_plane, scale, offset));
+    }
+    _mm256_storeu_ps(t_near, t_in);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_in, t_out, _CMP_LE_OQ)) & boxes.valid;
+}
+
+#endif // HYPOX_SIMD_X86
+
+// ========== NEON ==========
+
+#ifdef HYPOX_SIMD_NEON
+
+static inline int movemaskNEON(uint32x4_t mask) {
+    const uint32x4_t bits = { 1, 2, 4, 8 };
+    return static_cast<int>(vaddvq_u32(vandq_u32(mask, bits)));
+}
+
+static int intersectTrianglesNEON(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float& t_max, float& u, float& v
+) {
+    const float32x4_t ox = vdupq_n_f32(ray.o[0]), oy = vdupq_n_f32(ray.o[1]), oz = vdupq_n_f32(ray.o[2]);
+    const float32x4_t dx = vdupq_n_f32(ray.d[0]), dy = vdupq_n_f32(ray.d[1]), dz = vdupq_n_f32(ray.d[2]);
+    const float32x4_t zero = vdupq_n_f32(0.0f), t_min = vdupq_n_f32(ray.t_min);
+    const int32x4_t lane = { 0, 1, 2, 3 };
+    int hit = -1;
+    for (int base = first; base < first + count; base += 4) {
+        float32x4_t e1x = vld1q_f32(tri.e1[0] + base), e1y = vld1q_f32(tri.e1[1] + base), e1z = vld1q_f32(tri.e1[2] + base);
+        float32x4_t e2x = vld1q_f32(tri.e2[0] + base), e2y = vld1q_f32(tri.e2[1] + base), e2z = vld1q_f32(tri.e2[2] + base);
+        float32x4_t sx = vsubq_f32(ox, vld1q_f32(tri.v0[0] + base)),
+            sy = vsubq_f32(oy, vld1q_f32(tri.v0[1] + base)),
+            sz = vsubq_f32(oz, vld1q_f32(tri.v0[2] + base));
+        // a * b - c * d as fms(a * b, c, d)
+        float32x4_t s1x = vfmsq_f32(vmulq_f32(dy, e2z), dz, e2y),
+            s1y = vfmsq_f32(vmulq_f32(dz, e2x), dx, e2z),
+            s1z = vfmsq_f32(vmulq_f32(dx, e2y), dy, e2x);
+        float32x4_t s2x = vfmsq_f32(vmulq_f32(sy, e1z), sz, e1y),
+            s2y = vfmsq_f32(vmulq_f32(sz, e1x), sx, e1z),
+            s2z = vfmsq_f32(vmulq_f32(sx, e1y), sy, e1x);
+
+        float32x4_t det = vfmaq_f32(vfmaq_f32(vmulq_f32(s1z, e1z), s1y, e1y), s1x, e1x);
+        uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(det), vdupq_n_u32(0x80000000u));
+        float32x4_t abs_det = vabsq_f32(det);
+        float32x4_t t_scaled = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(
+            vfmaq_f32(vfmaq_f32(vmulq_f32(s2z, e2z), s2y, e2y), s2x, e2x)), sign));
+        float32x4_t u_scaled = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(
+            vfmaq_f32(vfmaq_f32(vmulq_f32(s1z, sz), s1y, sy), s1x, sx)), sign));
+        float32x4_t v_scaled = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(
+            vfmaq_f32(vfmaq_f32(vmulq_f32(s2z, dz), s2y, dy), s2x, dx)), sign));
+
+        uint32x4_t valid = vcgtq_s32(vdupq_n_s32(first + count - base), lane);
+        valid = vandq_u32(valid, vcgtq_f32(abs_det, zero));
+        valid = vandq_u32(valid, vcgeq_f32(u_scaled, zero));
+        valid = vandq_u32(valid, vcgeq_f32(v_scaled, zero));
+        valid = vandq_u32(valid, vcleq_f32(vaddq_f32(u_scaled, v_scaled), abs_det));
+        valid = vandq_u32(valid, vcgeq_f32(t_scaled, vmulq_f32(t_min, abs_det)));
+        valid = vandq_u32(valid, vcltq_f32(t_scaled, vmulq_f32(vdupq_n_f32(t_max), abs_det)));
+        int mask = movemaskNEON(valid);
+        if (mask == 0) continue;
+
+        float32x4_t inv_det = vdivq_f32(vdupq_n_f32(1.0f), abs_det);
+        float t_lane[4], u_lane[4], v_lane[4];
+        vst1q_f32(t_lane, vmulq_f32(t_scaled, inv_det));
+        vst1q_f32(u_lane, vmulq_f32(u_scaled, inv_det));
+        vst1q_f32(v_lane, vmulq_f32(v_scaled, inv_det));
+        for (int l = 0; l < 4; l++) {
+            if ((mask & (1 << l)) && t_lane[l] < t_max) {
+                t_max = t_lane[l];
+                u = u_lane[l];
+                v = v_lane[l];
+                hit = base + l;
+            }
+        }
+    }
+    return hit;
+}
+
+static bool occludedTrianglesNEON(
+    const TriangleArrays& tri, int first, int count, const RayData& ray, float t_max
+) {
+    float u, v;
+    return intersectTrianglesNEON(tri, first, count, ray, t_max, u, v) >= 0;
+}
+
+static int intersectBoxesNEON(const float (*bounds)[BOX_WIDTH], const RayData& ray, float t_max, float* t_near) {
+    int mask = 0;
+    for (int half = 0; half < BOX_WIDTH; half += 4) {
+        float32x4_t t_in = vdupq_n_f32(ray.t_min), t_out = vdupq_n_f32(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            bool positive = ray.inv_d[axis] >= 0;
+            float32x4_t near_plane = vld1q_f32(bounds[positive ? axis : axis + 3] + half),
+                far_plane = vld1q_f32(bounds[positive ? axis + 3 : axis] + half);
+            float32x4_t o = vdupq_n_f32(ray.o[axis]), inv_d = vdupq_n_f32(ray.inv_d[axis]);
+            t_in = vmaxq_f32(t_in, vmulq_f32(vsubq_f32(near_plane, o), inv_d));
+            t_out = vminq_f32(t_out, vmulq_f32(vsubq_f32(far_plane, o), inv_d));
+        }
+        vst1q_f32(t_near + half, t_in);
+        mask |= movemaskNEON(vcleq_f32(t_in, t_out)) << half;
+    }
+    return mask;
+}
+
+static int intersectQuantizedBoxesNEON(const QuantizedBoxes& boxes, const RayData& ray, float t_max, float* t_near) {
+    float32x4_t near_planes[3][2], far_planes[3][2];
+    for (int axis = 0; axis < 3; axis++) {
+        bool positive = ray.inv_d[axis] >= 0;
+        uint16x8_t near_bytes = vmovl_u8(vld1_u8(boxes.planes[positive ? axis : axis + 3])),
+            far_bytes = vmovl_u8(vld1_u8(boxes.planes[positive ? axis + 3 : axis]));
+        near_planes[axis][0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(near_bytes)));
+        near_planes[axis][1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(near_bytes)));
+        far_planes[axis][0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(far_bytes)));
+        far_planes[axis][1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(far_bytes)));
+    }
+    int mask = 0;
+    for (int half = 0; half < 2; half++) {
+        float32x4_t t_in = vdupq_n_f32(ray.t_min), t_out = vdupq_n_f32(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            float32x4_t scale = vdupq_n_f32(boxes.step[axis] * ray.inv_d[axis]),
+                offset = vdupq_n_f32((boxes.origin[axis] - ray.o[axis]) * ray.inv_d[axis]);
+            t_in = vmaxq_f32(t_in, vfmaq_f32(offset, near_planes[axis][half], scale));
+            t_out = vminq_f32(t_out, vfmaq_f32(offset, far_planes[axis][half], scale));
+        }
+        vst1q_f32(t_near + 4 * half, t_in);
+        mask |= movemaskNEON(vcleq_f32(t_in, t_out)) << (4 * half);
+    }
+    return mask & boxes.valid;
+}
+
+#endif // HYPOX_SIMD_NEON
+
+// ========== Dispatch ==========
+
+static const Kernels scalar_kernels = {
+    ISA::Scalar, intersectTrianglesScalar, occludedTrianglesScalar, intersectBoxesScalar, intersectQuantizedBoxesScalar
+};
+#ifdef HYPOX_SIMD_X86
+static const Kernels sse_kernels = {
+    ISA::SSE, intersectTrianglesSSE, occludedTrianglesSSE, intersectBoxesSSE, intersectQuantizedBoxesSSE
+};
+static const Kernels avx2_kernels = {
+    ISA::AVX2, intersectTrianglesAVX2, occludedTrianglesAVX2, intersectBoxesAVX2, intersectQuantizedBoxesAVX2
+};
+#endif
+#ifdef HYPOX_SIMD_NEON
+static const Kernels neon_kernels = {
+    ISA::NEON, intersectTrianglesNEON, occludedTrianglesNEON, intersectBoxesNEON, intersectQuantizedBoxesNEON
+};
+#endif
+
+bool isSupported(ISA isa) {
+    switch (isa) {
+    case ISA::Scalar:
+        return true;
+#ifdef HYPOX_SIMD_X86
+    case ISA::SSE:
+        return __builtin_cpu_supports("sse4.1");
+    case ISA::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#ifdef HYPOX_SIMD_NEON
+    case ISA::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* getName(ISA isa) {
+    switch (isa) {
+    case ISA::SSE: return "sse";
+    case ISA::AVX2: return "avx2";
+    case ISA::NEON: return "neon";
+    default: return "scalar";
+    }
+}
+
+const Kernels& getKernels(ISA isa) {
+    switch (isa) {
+#ifdef HYPOX_SIMD_X86
+    case ISA::SSE: return sse_kernels;
+    case ISA::AVX2: return avx2_kernels;
+#endif
+#ifdef HYPOX_SIMD_NEON
+    case ISA::NEON: return neon_kernels;
+#endif
+    default: return scalar_kernels;
+    }
+}
+
+static const Kernels& selectKernels() {
+    const ISA preference[] = { ISA::AVX2, ISA::SSE, ISA::NEON, ISA::Scalar };
+    ISA selected = ISA::Scalar;
+    for (ISA isa: preference) {
+        if (isSupported(isa)) {
+            selected = isa;
+            break;
+        }
+    }
+
+    const char* forced = std::getenv("HYPOX_SIMD");
+    if (forced != nullptr) {
+        bool found = false;
+        for (ISA isa: preference) {
+            if (std::strcmp(forced, getName(isa)) == 0 && isSupported(isa)) {
+                selected = isa;
+                found = true;
+            }
+        }
+        if (!found) {
+            printf("HYPOX_SIMD=%s is not supported here, use %s\n", forced, getName(selected));
+        }
+    }
+    if (stats::ENABLED) printf("SIMD Kernels: %s\n", getName(selected));
+    return getKernels(selected);
+}
+
+const Kernels& getKernels() {
+    static const Kernels& kernels = selectKernels();
+    return kernels;
+}
+
+}
@@ -0,0 +1,104 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace {
+#ifdef HYPOX_STATS
+    // Live thread blocks and the counts of the threads that exited
+    struct Registry {
+        std::mutex mutex;
+        std::vector<stats::ThreadCounters*> threads;
+        stats::Counters retired;
+    };
+
+    Registry& getRegistry() {
+        // Never destroyed, threads may still exit while static objects are torn down
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+#endif
+}
+
+#ifdef HYPOX_STATS
+namespace {
+    // Registers the counters of its thread, and folds them into the totals when the thread exits
+    struct ThreadRegistration {
+        ThreadRegistration() {
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.threads.push_back(&stats::thread_counters);
+        }
+        ~ThreadRegistration() {
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for (int i = 0; i < stats::COUNTER_COUNT; i++) {
+                registry.retired.values[i] += stats::thread_counters.values[i];
+            }
+            registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), &stats::thread_counters));
+        }
+    };
+}
+
+void stats::registerThread() {
+    thread_local ThreadRegistration registration;
+    thread_counters.registered = true;
+}
+#endif
+
+stats::Counters stats::collect() {
+    Counters totals;
+#ifdef HYPOX_STATS
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    totals = registry.retired;
+    for (const ThreadCounters* counters: registry.threads) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            totals.values[i] += counters->values[i];
+        }
+    }
+#endif
+    return totals;
+}
+
+void stats::reset() {
+#ifdef HYPOX_STATS
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retired = Counters();
+    for (ThreadCounters* counters: registry.threads) {
+        std::fill(std::begin(counters->values), std::end(counters->values), 0);
+    }
+#endif
+}
+
+void stats::print(const Counters& counters) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        auto counter = static_cast<Counter>(i);
+        if (counter == LoadTime || counter == BuildTime) {
+            printf("  %-22s %14.2f ms\n", getName(counter), counters[counter] * 1e-6);
+        } else {
+            printf("  %-22s %14llu\n", getName(counter), static_cast<unsigned long long>(counters[counter]));
+        }
+    }
+}
+
+const char* stats::getName(Counter counter) {
+    switch (counter) {
+    case PrimaryRays: return "primary_rays";
+    case BounceRays: return "bounce_rays";
+    case ShadowRays: return "shadow_rays";
+    case NodeTests: return "node_tests";
+    case TriangleTests: return "triangle_tests";
+    case SceneIntersects: return "scene_intersects";
+    case MeshIntersects: return "mesh_intersects";
+    case MeshOcclusionTests: return "mesh_occlusion_tests";
+    case BSDFSamples: return "bsdf_samples";
+    case BSDFEvaluations: return "bsdf_evaluations";
+    case LightSamples: return "light_samples";
+    case LoadTime: return "load_time_ns";
+    case BuildTime: return "build_time_ns";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,109 @@
+#include "tile_trace.hpp"
+#include "image.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+void TileTrace::start(int threads, const Vec2i& resolution, int tile_size) {
+    thread_events.clear();
+    thread_events.resize(threads);
+    this->resolution = resolution;
+    this->tile_size = tile_size;
+    epoch = Clock::now();
+}
+
+bool TileTrace::empty() const {
+    return std::all_of(thread_events.begin(), thread_events.end(), [](const ThreadEvents& thread) { return thread.events.empty(); });
+}
+
+std::vector<int64_t> TileTrace::getTileTimes() const {
+    int tiles_x = (resolution.x() + tile_size - 1) / tile_size;
+    int tiles_y = (resolution.y() + tile_size - 1) / tile_size;
+    std::vector<int64_t> times(tiles_x * tiles_y, 0);
+    for (const auto& thread: thread_events) {
+        for (const auto& event: thread.events) {
+            times[event.tile] += event.end_ns - event.begin_ns;
+        }
+    }
+    return times;
+}
+
+bool TileTrace::writeChromeTrace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "TileTrace: cannot write " << path << std::endl;
+        return false;
+    }
+    // Complete events ("X") in microseconds, one track per scheduler thread
+    int tiles_x = (resolution.x() + tile_size - 1) / tile_size;
+    nlohmann::json events = nlohmann::json::array();
+    for (int thread = 0; thread < static_cast<int>(thread_events.size()); thread++) {
+        events.push_back({
+            {"name", "thread_name"}, {"ph", "M"}, {"pid", 0}, {"tid", thread},
+            {"args", {{"name", "Render thread " + std::to_string(thread)}}}
+        });
+        for (const auto& event: thread_events[thread].events) {
+            events.push_back({
+                {"name", "tile " + std::to_string(event.tile)}, {"cat", "tile"}, {"ph", "X"},
+                {"ts", event.begin_ns * 1e-3}, {"dur", (event.end_ns - event.begin_ns) * 1e-3},
+                {"pid", 0}, {"tid", thread},
+                {"args", {
+                    {"tile", event.tile}, {"pass", event.pass},
+                    {"x", (event.tile % tiles_x) * tile_size}, {"y", (event.tile / tiles_x) * tile_size}
+                }}
+            });
+        }
+    }
+    nlohmann::json trace;
+    trace["traceEvents"] = std::move(events);
+    trace["displayTimeUnit"] = "ms";
+    file << trace.dump() << std::endl;
+    return static_cast<bool>(file);
+}
+
+bool TileTrace::writeHeatmap(const std::string& path) const {
+    std::vector<int64_t> times = getTileTimes();
+    int64_t max_time = std::max<int64_t>(1, *std::max_element(times.begin(), times.end()));
+    int tiles_x = (resolution.x() + tile_size - 1) / tile_size;
+
+    // Black to red to yellow to white as the tile time goes to the slowest one
+    Image heatmap(resolution.x(), resolution.y());
+    for (int y = 0; y < resolution.y(); y++) {
+        for (int x = 0; x < resolution.x(); x++) {
+            float heat = static_cast<float>(times[(y / tile_size) * tiles_x + x / tile_size]) / static_cast<float>(max_time);
+            heatmap.setPixel(x, y, Vec3f(utils::clamp01(3 * heat), utils::clamp01(3 * heat - 1), utils::clamp01(3 * heat - 2)));
+        }
+    }
+    heatmap.writeImage(path);
+    return true;
+}
+
+void TileTrace::write(const std::string& image_path, TileTraceOutput output) const {
+    if (output == TileTraceOutput::None || empty()) {
+        return;
+    }
+    std::filesystem::path image(image_path);
+    std::string stem = (image.parent_path() / image.stem()).string();
+    if (output == TileTraceOutput::Chrome || output == TileTraceOutput::Both) {
+        if (writeChromeTrace(stem + "_trace.json")) {
+            printf("Tile trace written to %s_trace.json\n", stem.c_str());
+        }
+    }
+    if (output == TileTraceOutput::Heatmap || output == TileTraceOutput::Both) {
+        if (writeHeatmap(stem + "_heatmap.png")) {
+            printf("Tile heatmap written to %s_heatmap.png\n", stem.c_str());
+        }
+    }
+
+    std::vector<int64_t> times = getTileTimes();
+    auto slowest = std::max_element(times.begin(), times.end());
+    int64_t total = 0;
+    for (int64_t time: times) total += time;
+    int tiles_x = (resolution.x() + tile_size - 1) / tile_size;
+    int tile = static_cast<int>(slowest - times.begin());
+    printf("Tiles: %zu, mean %.2f ms, slowest %.2f ms (tile %d at %d, %d)\n", times.size(),
+        total * 1e-6 / static_cast<double>(times.size()), *slowest * 1e-6,
+        tile, (tile % tiles_x) * tile_size, (tile / tiles_x) * tile_size);
+}
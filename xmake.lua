@@ -1,24 +1,80 @@
 add_languages("c++17")
 local depends = {
-    "eigen", "stb", "openmp", "tinyobjloader", "nlohmann_json"
+    "eigen", "stb", "nlohmann_json"
 }
 
 add_requires(depends)
 
+-- `xmake f -m debug|release|profile`, release by default. Debug defines DEBUG;
+-- release and profile optimize with LTO, -march=native and fast math, and
+-- profile adds the symbols and instrumentation of a profiling build
+add_rules("mode.debug", "mode.release", "mode.profile")
+set_defaultmode("release")
+if is_mode("debug") then
+    add_defines("DEBUG")
+end
+if is_mode("release", "profile") then
+    set_optimize("fastest")
+    set_policy("build.optimization.lto", true)
+    set_fpmodels("fast")
+    -- utils::powerHeuristic relies on std::isinf, which -ffast-math alone folds away
+    add_cxflags("-march=native", "-fno-finite-math-only", {tools = {"gcc", "clang"}})
+    add_ldflags("-fno-finite-math-only", {tools = {"gcc", "clang"}})
+end
+
+-- `xmake f --stats=y` compiles the render statistics counters into HypoxRayTracer
+option("stats")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Count rays, traversal steps and shading calls (HYPOX_STATS)")
+option_end()
+
 target("HypoxRayTracer")
     add_includedirs("includes")
     add_files("sources/*.cpp")
     add_packages(depends, {public = true})
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
     set_targetdir(".")
     add_files("main.cpp")
-    -- Add macro "DEBUG"
-    add_defines("DEBUG")
+    if has_config("stats") then
+        add_defines("HYPOX_STATS")
+    end
     set_kind("binary")
 
 target("LightFormerFrontEnd")
     add_includedirs("includes")
     add_files("sources/*.cpp")
     add_packages(depends, {public = true})
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
     set_targetdir(".")
     add_files("lightformer.cpp")
-    set_kind("binary")
\ No newline at end of file
+    set_kind("binary")
+
+-- Render benchmark with the statistics counters compiled in, run with `xmake run HypoxBenchmark`
+target("HypoxBenchmark")
+    add_includedirs("includes")
+    add_files("sources/*.cpp")
+    add_packages(depends, {public = true})
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
+    set_targetdir(".")
+    add_files("benchmark.cpp")
+    add_defines("HYPOX_STATS")
+    set_kind("binary")
+
+-- Coordinator and workers of distributed renders over a shared job directory
+target("HypoxDistributed")
+    add_includedirs("includes")
+    add_files("sources/*.cpp")
+    add_packages(depends, {public = true})
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
+    set_targetdir(".")
+    add_files("distributed.cpp")
+    set_kind("binary")